@@ -0,0 +1,384 @@
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlhighlighter.h"
+#include "qxml/xmlscanner.h"
+#include "xmlcorpusgenerator.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QRandomGenerator>
+#include <QTemporaryFile>
+#include <QTextBlock>
+#include <QTextStream>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+//====================================================================
+//=== Allocation counting
+//====================================================================
+static std::atomic<quint64> allocationCount{ 0 };
+
+#if defined(__GLIBC__)
+// QString, QVector and QByteArray allocate their data with malloc, not
+// operator new, so the C allocator is hooked. A malloc defined here takes
+// the place of the one in libc for Qt and the library too, and operator
+// new ends up in it as well.
+#define QXML_BENCH_ALLOCATIONS "allocs/node"
+
+extern "C"
+{
+  void* __libc_malloc(std::size_t size);
+  void* __libc_calloc(std::size_t count, std::size_t size);
+  void* __libc_realloc(void* p, std::size_t size);
+
+  void*
+  malloc(std::size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+  }
+
+  void*
+  calloc(std::size_t count, std::size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+  }
+
+  void*
+  realloc(void* p, std::size_t size) noexcept
+  {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+  }
+}
+#else
+// elsewhere only operator new is counted, which misses the data of the Qt
+// containers, the figure is labelled so.
+#define QXML_BENCH_ALLOCATIONS "new/node"
+
+void*
+operator new(std::size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void*
+operator new[](std::size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void
+operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+void
+operator delete[](void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+#endif
+
+//====================================================================
+//=== Benchmark helpers
+//====================================================================
+namespace {
+
+struct Result
+{
+  QString name;
+  qint64 bytes = 0;
+  qint64 nsecs = 0;
+  qint64 operations = 0;
+  qint64 nodes = 0;
+  quint64 allocations = 0;
+};
+
+QTextStream&
+out()
+{
+  static QTextStream stream(stdout);
+  return stream;
+}
+
+//! Returns the size of text as the UTF-8 file it is read from, throughput is
+//! measured against it.
+qint64
+fileBytes(const QString& text)
+{
+  return qint64(text.toUtf8().size());
+}
+
+QString
+sizeString(qint64 bytes)
+{
+  if (bytes >= 1024 * 1024)
+    return QString("%1MB").arg(bytes / (1024 * 1024));
+  return QString("%1KB").arg(bytes / 1024);
+}
+
+void
+report(const Result& r)
+{
+  auto seconds = double(r.nsecs) / 1e9;
+  auto mbps = seconds > 0 ? (double(r.bytes) / (1024.0 * 1024.0)) / seconds : 0;
+  auto line = QString("%1 %2 %3 ms %4 MB/s")
+                .arg(r.name, -36)
+                .arg(sizeString(r.bytes), 7)
+                .arg(double(r.nsecs) / 1e6, 11, 'f', 3)
+                .arg(mbps, 10, 'f', 2);
+  if (r.operations > 0) {
+    line += QString(" %1 ns/op").arg(double(r.nsecs) / r.operations, 10, 'f', 1);
+  }
+  if (r.nodes > 0) {
+    line += QString(" %1 " QXML_BENCH_ALLOCATIONS)
+              .arg(double(r.allocations) / r.nodes, 7, 'f', 2);
+  }
+  out() << line << Qt::endl;
+}
+
+template<typename F>
+qint64
+elapsed(F function)
+{
+  QElapsedTimer timer;
+  timer.start();
+  function();
+  return timer.nsecsElapsed();
+}
+
+void
+benchParseString(const QString& text)
+{
+  QTextDocument document;
+  document.setPlainText(text);
+  XmlEventParser parser(&document);
+
+  Result r{ "XmlEventParser::parseString", fileBytes(text) };
+  auto before = allocationCount.load();
+  r.nsecs = elapsed([&] { parser.parseString(text); });
+  r.allocations = allocationCount.load() - before;
+  r.nodes = parser.nodes().size();
+  report(r);
+
+  // the position pass on its own, on a tree that has none yet. A chunked
+  // parse leaves the tree unpositioned until adoptTree() takes it over.
+  XmlEventParser chunked(nullptr);
+  auto bytes = text.toUtf8();
+  chunked.beginChunks();
+  chunked.parseChunk(bytes.constData(), bytes.size());
+  if (!chunked.finishChunks())
+    return;
+  XmlEventParser positioned(&document);
+  Result p{ "XmlEventParser::adoptTree (positions)", fileBytes(text) };
+  before = allocationCount.load();
+  p.nsecs = elapsed([&] { positioned.adoptTree(chunked, text); });
+  p.allocations = allocationCount.load() - before;
+  p.nodes = positioned.nodes().size();
+  report(p);
+}
+
+void
+benchParseFile(const QString& text)
+{
+  QTemporaryFile file;
+  if (!file.open())
+    return;
+  file.write(text.toUtf8());
+  file.close();
+
+  QTextDocument document;
+  document.setPlainText(text);
+  XmlEventParser parser(&document);
+
+  Result r{ "XmlEventParser::parseFile", fileBytes(text) };
+  auto before = allocationCount.load();
+  r.nsecs = elapsed([&] { parser.parseFile(file.fileName()); });
+  r.allocations = allocationCount.load() - before;
+  r.nodes = parser.nodes().size();
+  report(r);
+}
+
+void
+benchLookupAndToString(const QString& text)
+{
+  QTextDocument document;
+  document.setPlainText(text);
+  XmlEventParser parser(&document);
+  parser.parseString(text);
+
+  const int lookups = 1000;
+  QRandomGenerator random(7);
+  Result l{ "XmlEventParser::nodeForPosition", fileBytes(text) };
+  l.operations = lookups;
+  l.nsecs = elapsed([&] {
+    for (int i = 0; i < lookups; ++i)
+      parser.nodeForPosition(random.bounded(int(text.length())));
+  });
+  report(l);
+
+  Result s{ "StartNode::toString", 0 };
+  s.nsecs = elapsed([&] {
+    for (auto node : parser.nodes()) {
+      if (node->type == Node::Start) {
+        node->toString();
+        ++s.operations;
+      }
+    }
+  });
+  // the tags are measured in UTF-8 outside the timing.
+  for (auto node : parser.nodes()) {
+    if (node->type == Node::Start)
+      s.bytes += fileBytes(node->toString());
+  }
+  report(s);
+}
+
+void
+benchHighlight(const QString& text)
+{
+  QTextDocument document;
+  document.setPlainText(text);
+  XmlEventParser parser(&document);
+  parser.parseString(text);
+  XmlHighlighter highlighter(&parser, &document);
+
+  Result r{ "XmlHighlighter::highlightBlock", fileBytes(text) };
+  r.operations = document.blockCount();
+  auto before = allocationCount.load();
+  r.nsecs = elapsed([&] { highlighter.rehighlight(); });
+  r.allocations = allocationCount.load() - before;
+  r.nodes = parser.nodes().size();
+  report(r);
+
+  // a single block in the middle of the document, the cost of one keystroke.
+  auto block = document.findBlockByNumber(document.blockCount() / 2);
+  Result b{ "XmlHighlighter::highlightBlock (1)",
+              fileBytes(block.text()) };
+  b.operations = 1;
+  b.nsecs = elapsed([&] { highlighter.rehighlightBlock(block); });
+  report(b);
+}
+
+void
+benchScanner(const QString& text)
+{
+  // the structural scan with every instruction set the processor has.
+  const XmlScanner scanner;
+  auto data = reinterpret_cast<const char16_t*>(text.utf16());
+  auto utf8 = text.toUtf8();
+  auto best = XmlScanner::isa();
+  for (auto isa : { XmlScanner::Scalar, XmlScanner::Sse2, XmlScanner::Neon,
+                    XmlScanner::Avx2 }) {
+    XmlScanner::setIsa(isa);
+    if (XmlScanner::isa() != isa)
+      continue;
+    std::vector<uint32_t> offsets;
+    offsets.reserve(size_t(text.length() / 8));
+
+    Result r{ QString("XmlScanner::scan utf16 (%1)")
+                .arg(XmlScanner::isaName(isa)),
+              qint64(utf8.size()) };
+    r.nsecs =
+      elapsed([&] { scanner.scan(data, size_t(text.length()), offsets); });
+    report(r);
+
+    offsets.clear();
+    Result u{ QString("XmlScanner::scan utf8 (%1)")
+                .arg(XmlScanner::isaName(isa)),
+              utf8.size() };
+    u.nsecs = elapsed(
+      [&] { scanner.scan(utf8.constData(), size_t(utf8.size()), offsets); });
+    report(u);
+  }
+  XmlScanner::setIsa(best);
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== main
+//====================================================================
+int
+main(int argc, char* argv[])
+{
+  // QTextDocument layout needs a platform plugin, use one that needs no
+  // display.
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QGuiApplication app(argc, argv);
+  QCoreApplication::setApplicationName("qxml_bench");
+
+  QCommandLineParser options;
+  options.setApplicationDescription(
+    "Throughput benchmarks for the QXml parser, position index, node lookup "
+    "and highlighter.");
+  options.addHelpOption();
+  QCommandLineOption presetOption(
+    "preset",
+    "Corpus shape: default, svg, records or soap (default records).",
+    "name",
+    "records");
+  QCommandLineOption seedOption("seed", "Corpus seed (default 1).", "n", "1");
+  QCommandLineOption minOption(
+    "min-size", "Smallest input size in KB (default 1).", "kb", "1");
+  QCommandLineOption maxOption(
+    "max-size",
+    "Largest input size in KB (default 65536, use 512000 for 500 MB).",
+    "kb",
+    "65536");
+  options.addOption(presetOption);
+  options.addOption(seedOption);
+  options.addOption(minOption);
+  options.addOption(maxOption);
+  options.process(app);
+
+  const qint64 minSize = options.value(minOption).toLongLong() * 1024;
+  const qint64 maxSize = options.value(maxOption).toLongLong() * 1024;
+  const QList<qint64> sizes = {
+    1LL << 10,   16LL << 10,  256LL << 10, 1LL << 20,
+    16LL << 20,  64LL << 20,  256LL << 20, 500LL << 20,
+  };
+
+  for (auto size : sizes) {
+    if (size < minSize || size > maxSize)
+      continue;
+    auto corpus = XmlCorpusGenerator::preset(
+      XmlCorpusGenerator::presetFromName(options.value(presetOption)));
+    corpus.seed = options.value(seedOption).toULongLong();
+    corpus.size = size;
+    auto text = XmlCorpusGenerator(corpus).generate();
+    out() << "--- " << sizeString(size) << " ---" << Qt::endl;
+    benchParseString(text);
+    benchParseFile(text);
+    benchLookupAndToString(text);
+    benchHighlight(text);
+    benchScanner(text);
+  }
+
+  return 0;
+}
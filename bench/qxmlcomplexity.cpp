@@ -0,0 +1,295 @@
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlhighlighter.h"
+#include "xmlcorpusgenerator.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include <cmath>
+#include <functional>
+
+/*
+ * Scaling checks for pathological inputs.
+ *
+ * Each case is generated at n, 2n, 4n and 8n. Parsing, the position pass,
+ * node lookup and highlighting are timed at every size and the growth exponent
+ * is fitted on a log-log scale. A stage fails when it grows measurably faster
+ * than n log n, which is what a quadratic path such as a search from offset 0
+ * inside a per node loop looks like.
+ *
+ * The program exits with 1 if any stage fails.
+ */
+namespace {
+
+//! libxml2 rejects documents nested deeper than 256 elements unless
+//! XML_PARSE_HUGE is set, which xmlwrapp does not do.
+const qint64 LIBXML_MAX_DEPTH = 256;
+//! The number of chains in the deep nesting case, so that it takes long
+//! enough to time.
+const qint64 DEEP_CHAINS = 2000;
+
+struct Case
+{
+  QString name;
+  //! The size parameter at 8n.
+  qint64 full;
+  std::function<XmlCorpusGenerator::Options(qint64 n)> options;
+  //! The largest size parameter at 8n whatever the scale, 0 for none.
+  qint64 maximum = 0;
+};
+
+QTextStream&
+out()
+{
+  static QTextStream stream(stdout);
+  return stream;
+}
+
+template<typename F>
+qint64
+elapsed(F function)
+{
+  QElapsedTimer timer;
+  timer.start();
+  function();
+  return timer.nsecsElapsed();
+}
+
+//! Least squares slope of log(y) against log(x).
+double
+slope(const QVector<double>& x, const QVector<double>& y)
+{
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  auto n = x.size();
+  for (auto i = 0; i < n; ++i) {
+    auto lx = std::log(x.at(i));
+    auto ly = std::log(y.at(i));
+    sx += lx;
+    sy += ly;
+    sxx += lx * lx;
+    sxy += lx * ly;
+  }
+  auto d = n * sxx - sx * sx;
+  return d == 0 ? 0 : (n * sxy - sx * sy) / d;
+}
+
+QList<Case>
+cases()
+{
+  QList<Case> list;
+  // chains of n nested elements, as many of them at every depth. A stage
+  // that is quadratic in the depth grows with n squared.
+  list.append({ "deep nesting (depth)",
+                240,
+                [](qint64 n) {
+                  XmlCorpusGenerator::Options o;
+                  o.depth = int(n);
+                  o.fanOut = 1;
+                  o.attributeCount = 0;
+                  o.textWeight = 1;
+                  o.commentWeight = o.cdataWeight = o.piWeight = 0;
+                  o.whitespaceRatio = 0;
+                  o.singleLine = true;
+                  o.names = QStringList{ "d" };
+                  // a chain takes about 8 characters per level.
+                  o.size = n * 8 * DEEP_CHAINS;
+                  return o;
+                },
+                LIBXML_MAX_DEPTH - 16 });
+  list.append({ "attributes on one element", 50000, [](qint64 n) {
+                 XmlCorpusGenerator::Options o;
+                 o.depth = 0;
+                 o.attributeCount = int(n);
+                 o.valueLength = 4;
+                 o.textWeight = 1;
+                 o.commentWeight = o.cdataWeight = o.piWeight = 0;
+                 o.size = 1;
+                 return o;
+               } });
+  list.append({ "single line (bytes)", 100LL << 20, [](qint64 n) {
+                 auto o = XmlCorpusGenerator::preset(
+                   XmlCorpusGenerator::FlatRecords);
+                 o.singleLine = true;
+                 o.whitespaceRatio = 0;
+                 o.size = n;
+                 return o;
+               } });
+  list.append({ "identical attribute values", 1000000, [](qint64 n) {
+                 auto o = XmlCorpusGenerator::preset(
+                   XmlCorpusGenerator::FlatRecords);
+                 o.attributeCount = 4;
+                 o.identicalValues = true;
+                 // about 20 characters of document per attribute.
+                 o.size = n * 20;
+                 return o;
+               } });
+  list.append({ "comments", 1000000, [](qint64 n) {
+                 XmlCorpusGenerator::Options o;
+                 o.depth = 0;
+                 o.attributeCount = 0;
+                 o.textWeight = o.cdataWeight = o.piWeight = 0;
+                 o.commentWeight = 1;
+                 o.leafLength = 8;
+                 // about 22 characters per indented comment.
+                 o.size = n * 22;
+                 return o;
+               } });
+  return list;
+}
+
+struct Timings
+{
+  double parse = 0;
+  double positions = 0;
+  double lookup = 0;
+  double highlight = 0;
+  bool parsed = true;
+};
+
+Timings
+measure(const QString& text)
+{
+  Timings t;
+  QTextDocument document;
+  document.setPlainText(text);
+
+  XmlEventParser parser(&document);
+  t.parse = elapsed([&] { t.parsed = parser.parseString(text); });
+  if (!t.parsed)
+    return t;
+
+  // the position pass on its own, on the unpositioned tree of a chunked
+  // parse, see XmlEventParser::finishChunks().
+  XmlEventParser chunked(nullptr);
+  auto bytes = text.toUtf8();
+  chunked.beginChunks();
+  chunked.parseChunk(bytes.constData(), bytes.size());
+  chunked.finishChunks();
+  XmlEventParser positioned(&document);
+  t.positions = elapsed([&] { positioned.adoptTree(chunked, text); });
+
+  QRandomGenerator random(3);
+  t.lookup = elapsed([&] {
+    for (int i = 0; i < 1000; ++i)
+      parser.nodeForPosition(random.bounded(int(text.length())));
+  });
+
+  XmlHighlighter highlighter(&parser, &document);
+  t.highlight = elapsed([&] { highlighter.rehighlight(); });
+  return t;
+}
+
+} // end of anonymous namespace
+
+int
+main(int argc, char* argv[])
+{
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QGuiApplication app(argc, argv);
+  QCoreApplication::setApplicationName("qxml_complexity");
+
+  QCommandLineParser options;
+  options.setApplicationDescription(
+    "Times parsing, positioning, lookup and highlighting of pathological "
+    "inputs at n, 2n, 4n and 8n and fails if any stage scales worse than "
+    "n log n.");
+  options.addHelpOption();
+  QCommandLineOption scaleOption(
+    "scale",
+    "Multiplier applied to every case size (default 1, where 8n is the full "
+    "size, e.g. 1M attribute values or 100 MB). The nesting depth stays "
+    "below the libxml2 limit.",
+    "factor",
+    "1");
+  QCommandLineOption toleranceOption(
+    "tolerance",
+    "Allowed growth exponent above n log n (default 0.3).",
+    "exponent",
+    "0.3");
+  QCommandLineOption caseOption(
+    "case", "Only run cases whose name contains text.", "text");
+  options.addOption(scaleOption);
+  options.addOption(toleranceOption);
+  options.addOption(caseOption);
+  options.process(app);
+
+  auto scale = options.value(scaleOption).toDouble();
+  auto tolerance = options.value(toleranceOption).toDouble();
+  auto failures = 0;
+
+  for (const auto& c : cases()) {
+    if (options.isSet(caseOption) &&
+        !c.name.contains(options.value(caseOption), Qt::CaseInsensitive))
+      continue;
+
+    QVector<double> sizes;
+    QVector<Timings> timings;
+    auto full = qint64(c.full * scale);
+    if (c.maximum > 0)
+      full = qMin(full, c.maximum);
+    auto base = qMax<qint64>(1, full / 8);
+    auto rejected = false;
+    for (auto multiple : { 1, 2, 4, 8 }) {
+      auto n = base * multiple;
+      auto text = XmlCorpusGenerator(c.options(n)).generate();
+      auto t = measure(text);
+      sizes.append(double(n));
+      timings.append(t);
+      rejected = rejected || !t.parsed;
+      out() << QString("%1 n=%2 parse %3 ms positions %4 ms lookup %5 ms "
+                       "highlight %6 ms%7")
+                 .arg(c.name, -28)
+                 .arg(n, 10)
+                 .arg(t.parse / 1e6, 10, 'f', 2)
+                 .arg(t.positions / 1e6, 10, 'f', 2)
+                 .arg(t.lookup / 1e6, 8, 'f', 2)
+                 .arg(t.highlight / 1e6, 10, 'f', 2)
+                 .arg(t.parsed ? QString() : QString(" (rejected by libxml2)"))
+            << Qt::endl;
+    }
+
+    // the timings of a rejected text are those of an empty tree, they say
+    // nothing about the scaling.
+    if (rejected) {
+      out() << "  FAIL the case was rejected by libxml2" << Qt::endl;
+      ++failures;
+      continue;
+    }
+
+    // the exponent n log n itself shows over the same sizes.
+    QVector<double> nlogn;
+    for (auto n : sizes)
+      nlogn.append(n * std::log2(n + 1));
+    auto allowed = slope(sizes, nlogn) + tolerance;
+
+    auto check = [&](const char* stage, double Timings::*member) {
+      QVector<double> y;
+      for (const auto& t : timings)
+        y.append(qMax(1.0, t.*member));
+      auto k = slope(sizes, y);
+      auto ok = k <= allowed;
+      out() << QString("  %1 %2 exponent %3 (allowed %4)")
+                 .arg(ok ? "PASS" : "FAIL")
+                 .arg(stage, -10)
+                 .arg(k, 0, 'f', 2)
+                 .arg(allowed, 0, 'f', 2)
+            << Qt::endl;
+      if (!ok)
+        ++failures;
+    };
+    check("parse", &Timings::parse);
+    check("positions", &Timings::positions);
+    check("lookup", &Timings::lookup);
+    check("highlight", &Timings::highlight);
+  }
+
+  out() << (failures ? QString("%1 stage(s) scale worse than n log n")
+                         .arg(failures)
+                     : QString("all stages scale within n log n"))
+        << Qt::endl;
+  return failures ? 1 : 0;
+}
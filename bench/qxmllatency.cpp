@@ -0,0 +1,325 @@
+#include "qxml/xmledit.h"
+#include "xmlcorpusgenerator.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QMap>
+#include <QRegularExpression>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+
+/*
+ * Keystroke latency replay.
+ *
+ * Loads a generated document into an XmlEdit on the offscreen platform and
+ * replays a script of edits through the editor's own document, exactly as
+ * typing would. Each edit is timed from the moment it is applied until the
+ * editor reports, with treeUpdated(), that the node tree and highlighting
+ * match the text again.
+ *
+ * Script commands, one per line, # starts a comment:
+ *
+ *   move start|middle|end|tag   place the cursor, tag is just inside the
+ *                               first start tag after the middle
+ *   move <offset>               place the cursor at offset
+ *   type <text>                 type text, one edit per character
+ *   backspace <n>               n backspaces, one edit each
+ *   delete <n>                  n forward deletes, one edit each
+ *   newline                     press return
+ *   paste <n>                   paste a block of n records as one edit
+ *   undo [n]                    n undo steps, one edit each
+ */
+namespace {
+
+const char* defaultScript = R"(
+move tag
+type  id="key-1" class="changed"
+backspace 10
+move middle
+newline
+type <note priority="high">typed while editing</note>
+paste 50
+undo 2
+move end
+paste 200
+undo
+move start
+type <!-- header -->
+)";
+
+QTextStream&
+out()
+{
+  static QTextStream stream(stdout);
+  return stream;
+}
+
+QString
+pasteBlock(int records)
+{
+  QString block;
+  for (auto i = 0; i < records; ++i) {
+    block += QString("<record id=\"p%1\"><field>pasted value %1</field>"
+                     "</record>\n")
+               .arg(i);
+  }
+  return block;
+}
+
+double
+percentile(QVector<double> values, double p)
+{
+  if (values.isEmpty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  auto index = int(std::ceil(p * values.size())) - 1;
+  return values.at(qBound(0, index, int(values.size()) - 1));
+}
+
+class Replay
+{
+public:
+  explicit Replay(XmlEdit* editor)
+    : m_editor(editor)
+  {
+    QObject::connect(
+      editor, &XmlEdit::treeUpdated, editor, [this]() { m_updated = true; });
+  }
+
+  bool run(const QString& script)
+  {
+    const auto lines = script.split('\n');
+    for (const auto& line : lines) {
+      auto trimmed = line.trimmed();
+      if (trimmed.isEmpty() || trimmed.startsWith('#'))
+        continue;
+      auto space = trimmed.indexOf(' ');
+      auto command = space < 0 ? trimmed : trimmed.left(space);
+      // type keeps the leading space of its argument.
+      auto argument = space < 0 ? QString() : line.mid(line.indexOf(command) +
+                                                       command.length() + 1);
+      if (!execute(command, argument)) {
+        out() << "unknown script command: " << line << Qt::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void report()
+  {
+    QVector<double> all;
+    for (auto it = m_latencies.cbegin(); it != m_latencies.cend(); ++it) {
+      print(it.key(), it.value());
+      all += it.value();
+    }
+    print("all edits", all);
+  }
+
+private:
+  XmlEdit* m_editor;
+  bool m_updated = false;
+  QMap<QString, QVector<double>> m_latencies;
+
+  QTextDocument* document() { return m_editor->document(); }
+
+  void print(const QString& name, const QVector<double>& values)
+  {
+    double total = 0;
+    for (auto v : values)
+      total += v;
+    out() << QString("%1 edits %2 mean %3 ms p50 %4 ms p99 %5 ms max %6 ms")
+               .arg(name, -10)
+               .arg(values.size(), 6)
+               .arg(values.isEmpty() ? 0 : total / values.size(), 9, 'f', 3)
+               .arg(percentile(values, 0.50), 9, 'f', 3)
+               .arg(percentile(values, 0.99), 9, 'f', 3)
+               .arg(percentile(values, 1.0), 9, 'f', 3)
+          << Qt::endl;
+  }
+
+  //! Applies edit and waits until the editor has caught up with it.
+  template<typename F>
+  void timed(const QString& kind, F edit)
+  {
+    m_updated = false;
+    QElapsedTimer timer;
+    timer.start();
+    edit();
+    if (!m_updated) {
+      QEventLoop loop;
+      QObject::connect(
+        m_editor, &XmlEdit::treeUpdated, &loop, &QEventLoop::quit);
+      QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+      loop.exec();
+    }
+    m_latencies[kind].append(double(timer.nsecsElapsed()) / 1e6);
+  }
+
+  void moveTo(int position)
+  {
+    auto cursor = m_editor->textCursor();
+    cursor.setPosition(qBound(0, position, document()->characterCount() - 1));
+    m_editor->setTextCursor(cursor);
+  }
+
+  bool execute(const QString& command, const QString& argument)
+  {
+    if (command == "move") {
+      auto where = argument.trimmed();
+      auto length = document()->characterCount() - 1;
+      if (where == "start") {
+        moveTo(0);
+      } else if (where == "middle") {
+        moveTo(length / 2);
+      } else if (where == "end") {
+        moveTo(length);
+      } else if (where == "tag") {
+        auto text = document()->toPlainText();
+        auto open = text.indexOf(QRegularExpression("<[A-Za-z]"), length / 2);
+        auto close = open < 0 ? -1 : text.indexOf('>', open);
+        moveTo(close < 0 ? length / 2 : close);
+      } else {
+        moveTo(where.toInt());
+      }
+      return true;
+    }
+
+    if (command == "type") {
+      for (const auto c : argument) {
+        timed("type", [&] {
+          auto cursor = m_editor->textCursor();
+          cursor.insertText(QString(c));
+          m_editor->setTextCursor(cursor);
+        });
+      }
+      return true;
+    }
+
+    if (command == "backspace" || command == "delete") {
+      auto count = qMax(1, argument.trimmed().toInt());
+      for (auto i = 0; i < count; ++i) {
+        timed(command, [&] {
+          auto cursor = m_editor->textCursor();
+          if (command == "backspace")
+            cursor.deletePreviousChar();
+          else
+            cursor.deleteChar();
+          m_editor->setTextCursor(cursor);
+        });
+      }
+      return true;
+    }
+
+    if (command == "newline") {
+      timed("type", [&] {
+        auto cursor = m_editor->textCursor();
+        cursor.insertBlock();
+        m_editor->setTextCursor(cursor);
+      });
+      return true;
+    }
+
+    if (command == "paste") {
+      auto block = pasteBlock(qMax(1, argument.trimmed().toInt()));
+      timed("paste", [&] {
+        auto cursor = m_editor->textCursor();
+        cursor.insertText(block);
+        m_editor->setTextCursor(cursor);
+      });
+      return true;
+    }
+
+    if (command == "undo") {
+      auto count = qMax(1, argument.trimmed().toInt());
+      for (auto i = 0; i < count && document()->isUndoAvailable(); ++i) {
+        timed("undo", [&] { m_editor->undo(); });
+      }
+      return true;
+    }
+
+    return false;
+  }
+};
+
+} // end of anonymous namespace
+
+int
+main(int argc, char* argv[])
+{
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  QCoreApplication::setApplicationName("qxml_latency");
+
+  QCommandLineParser options;
+  options.setApplicationDescription(
+    "Replays a script of edits in an offscreen XmlEdit and reports the time "
+    "from each edit to the tree and highlighting being up to date.");
+  options.addHelpOption();
+  QCommandLineOption sizeOption(
+    "size", "Document size in KB (default 1024).", "kb", "1024");
+  QCommandLineOption presetOption(
+    "preset", "Corpus shape: default, svg, records or soap.", "name", "records");
+  QCommandLineOption seedOption("seed", "Corpus seed (default 1).", "n", "1");
+  QCommandLineOption scriptOption(
+    "script", "Edit script file, a built in script if omitted.", "file");
+  QCommandLineOption repeatOption(
+    "repeat", "Number of times the script is replayed.", "n", "1");
+  options.addOptions(
+    { sizeOption, presetOption, seedOption, scriptOption, repeatOption });
+  options.process(app);
+
+  auto corpus = XmlCorpusGenerator::preset(
+    XmlCorpusGenerator::presetFromName(options.value(presetOption)));
+  corpus.seed = options.value(seedOption).toULongLong();
+  corpus.size = options.value(sizeOption).toLongLong() * 1024;
+
+  QString script = QString::fromUtf8(defaultScript);
+  if (options.isSet(scriptOption)) {
+    QFile file(options.value(scriptOption));
+    if (!file.open(QIODevice::ReadOnly)) {
+      out() << "unable to open script " << file.fileName() << Qt::endl;
+      return 1;
+    }
+    script = QString::fromUtf8(file.readAll());
+  }
+
+  XmlEdit editor;
+  editor.resize(1024, 768);
+  editor.show();
+
+  // treeUpdated() for a newly set text may follow setText(), it is waited
+  // for so that it is not counted as an edit.
+  QElapsedTimer load;
+  auto loaded = false;
+  QEventLoop loadLoop;
+  QObject::connect(&editor, &XmlEdit::treeUpdated, &loadLoop, [&]() {
+    loaded = true;
+    loadLoop.quit();
+  });
+  load.start();
+  editor.setText(XmlCorpusGenerator(corpus).generate());
+  if (!loaded)
+    loadLoop.exec();
+  QObject::disconnect(&editor, &XmlEdit::treeUpdated, &loadLoop, nullptr);
+  out() << QString("load %1 KB in %2 ms")
+             .arg(corpus.size / 1024)
+             .arg(double(load.nsecsElapsed()) / 1e6, 0, 'f', 1)
+        << Qt::endl;
+  QCoreApplication::processEvents();
+
+  Replay replay(&editor);
+  for (auto i = options.value(repeatOption).toInt(); i > 0; --i) {
+    if (!replay.run(script))
+      return 1;
+  }
+  replay.report();
+  return 0;
+}
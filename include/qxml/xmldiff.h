@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+#include "qxml/xmlsnapshot.h"
+
+/*!
+ * \ingroup widgets
+ * \class XmlDiff xmldiff.h "include/qxml/xmldiff.h"
+ * \brief Compares two documents structurally.
+ *
+ * compare() walks two XmlSnapshot trees and returns the edits that turn the
+ * first into the second: nodes inserted, deleted or moved, attributes
+ * added, removed or changed and text changed. Subtrees with equal hashes
+ * are skipped at once, so identical regions cost nothing however large,
+ * and children are matched by hash before anything else. Only the parts
+ * that differ are descended into. Attribute order and the layout of the
+ * text are not differences.
+ *
+ * Each operation holds the text positions in both documents, so it can be
+ * shown against either text.
+ */
+class XmlDiff
+{
+public:
+  /*!
+   * \brief One edit of the script compare() returns.
+   */
+  struct Operation
+  {
+    enum Type
+    {
+      Inserted,         //!< A node is only in the new document.
+      Deleted,          //!< A node is only in the old document.
+      Moved,            //!< An unchanged node has moved.
+      AttributeAdded,   //!< An attribute is only in the new document.
+      AttributeRemoved, //!< An attribute is only in the old document.
+      AttributeChanged, //!< An attribute value has changed.
+      TextChanged,      //!< Text, CDATA, a comment or PI data has changed.
+    };
+
+    Type type = Inserted;
+    //! The kind of node the edit is on, the element for attributes.
+    XmlSnapshotNode::Kind kind = XmlSnapshotNode::Element;
+    //! The element name, attribute name or instruction target.
+    QString name;
+    //! The names of the enclosing elements, as /root/child.
+    QString path;
+    //! The old and new attribute value or content.
+    QString oldValue;
+    QString newValue;
+    //! The node or value in the old text, -1 if it is not there.
+    int oldPosition = -1;
+    int oldLength = 0;
+    //! The node or value in the new text, -1 if it is not there.
+    int newPosition = -1;
+    int newLength = 0;
+  };
+  using Script = QVector<Operation>;
+
+  //! Returns the edits that turn from into to, none if they are equal.
+  static Script compare(const XmlSnapshot& from, const XmlSnapshot& to);
+  //! \brief Parses the files from and to and compares them.
+  //!
+  //! The files are read as UTF-8, like XmlEdit reads them, whatever their
+  //! declaration says. Positions are in UTF-16 code units of the files, CR
+  //! LF line ends included. Returns no edits and sets error, if given, if a
+  //! file cannot be read or is not well formed.
+  static Script compareFiles(const QString& from,
+                             const QString& to,
+                             QString* error = nullptr);
+
+  //! \brief Returns the snapshot of text, null and sets error, if given, if
+  //! text is not well formed.
+  //!
+  //! The text is parsed as a QTextDocument would hold it, so a CR LF pair
+  //! is a single line end and the positions after it are one less than in
+  //! text. No document is made, the positions are offsets in that text.
+  static XmlSnapshot::Ptr snapshotOf(const QString& text,
+                                     QString* error = nullptr);
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <QObject>
+#include <QSet>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+#include "qxml/xmlvalidator.h"
+
+class XmlEventParser;
+class XmlFormatRuns;
+class XmlFormatWorker;
+class XmlHighlighter;
+class XmlSnapshot;
+class XmlValidator;
+
+/*!
+ * \ingroup widgets
+ * \class XmlDocument xmldocument.h "include/qxml/xmldocument.h"
+ * \brief The text, node tree and highlighting that XmlEdit views share.
+ *
+ * An XmlDocument owns the QTextDocument, the XmlEventParser that parses it
+ * and the XmlHighlighter that formats it. It tracks edits, reparses and
+ * backfills the highlighting, whichever view the edits come from. Views
+ * hold it through a QSharedPointer, see XmlEdit::setXmlDocument(), so a
+ * file shown in a split view or in several tabs is held and parsed once.
+ * Each view keeps only its own cursor, scroll position and viewport.
+ *
+ * After every successful parse an immutable XmlSnapshot of the tree is
+ * published, see snapshot(), for code on other threads. With a schema set,
+ * see setSchemaLocation(), each snapshot is validated on a worker thread
+ * once editing pauses, see validationErrors().
+ *
+ * Elements, comments and CDATA sections that span lines can be folded. The
+ * fold ranges are found once per parse and kept per block, and a folded
+ * range hides its blocks so that they are not laid out. Block visibility
+ * belongs to the text, so a fold shows in every view.
+ */
+class XmlDocument : public QObject
+{
+  Q_OBJECT
+public:
+  //! How long editing has to pause before the text is validated, in
+  //! milliseconds.
+  static const int VALIDATE_DELAY = 500;
+
+  /*!
+   * \brief An estimate of the heap a document takes, see memoryUsage().
+   */
+  struct MemoryUsage
+  {
+    //! The text and its blocks.
+    qint64 document = 0;
+    //! The node tree, see XmlEventParser::memoryUsage().
+    qint64 parser = 0;
+    //! The highlighting, see XmlHighlighter::memoryUsage().
+    qint64 highlighter = 0;
+    //! The nodes of the current snapshot, including those it shares with
+    //! older snapshots still held elsewhere.
+    qint64 snapshot = 0;
+    //! Folds, soft breaks and validation errors.
+    qint64 caches = 0;
+
+    //! Returns the sum of the categories.
+    qint64 total() const;
+  };
+
+  explicit XmlDocument(QObject* parent = nullptr);
+  ~XmlDocument();
+
+  //! Returns the text document shared by the views.
+  QTextDocument* textDocument() const;
+  //! Returns the parser of the text.
+  XmlEventParser* parser() const;
+  //! Returns the highlighter of the text.
+  XmlHighlighter* highlighter() const;
+
+  //! \brief Returns the snapshot of the last successful parse, null if
+  //! there has been none.
+  //!
+  //! May be called from any thread. The snapshot stays valid for as long as
+  //! the pointer is held, however often the text is parsed meanwhile. While
+  //! a new text is being set it is still that of the old one, see
+  //! XmlSnapshot::revision().
+  std::shared_ptr<const XmlSnapshot> snapshot() const;
+
+  //! Returns the XML Schema or DTD the text is validated against, empty if
+  //! none.
+  const QString& schemaLocation() const;
+  //! \brief Validates the text against the schema at location after every
+  //! parse, see XmlSchema::typeOf(). An empty location stops validating.
+  //!
+  //! The compiled schema comes from XmlSchemaCache, so documents that use
+  //! the same schema share it.
+  void setSchemaLocation(const QString& location);
+  //! Validates the current snapshot now rather than once editing pauses.
+  void validate();
+  //! Returns the errors of the last validation, their positions are in the
+  //! text of revision validatedRevision().
+  const XmlValidationErrors& validationErrors() const;
+  //! Returns the revision of the text last validated, -1 if none has been.
+  int validatedRevision() const;
+
+  //! \brief Returns an estimate of the heap the document takes, by
+  //! category.
+  //!
+  //! The tree, the highlighting and the snapshot are tallied as they are
+  //! built, nothing is walked, so it is cheap enough to poll. The views
+  //! sharing the document are not included.
+  MemoryUsage memoryUsage() const;
+
+  //! Returns true if the text has been edited since it was set.
+  bool isModified() const;
+
+  //! Returns true if no view may edit the text.
+  bool isReadOnly() const;
+  //! Makes every view of the text read only, or editable again.
+  void setReadOnly(bool readOnly);
+
+  //! Returns the positions of the soft breaks in the text, ascending.
+  const QVector<int>& softBreaks() const;
+  //! Returns true if the text is shown soft reformatted.
+  bool isSoftReformatted() const;
+  //! Records the soft breaks inserted into the text that is about to be set,
+  //! the text is read only while there are any.
+  void setSoftBreaks(const QVector<int>& softBreaks);
+
+  //! \brief Prepares for the text to be replaced.
+  //!
+  //! Edits stop being tracked, the tree is dropped and formatting is
+  //! deferred until the new text is shown. Every block is formatted and
+  //! every node built again, only the snapshot keeps the unchanged
+  //! subtrees, see replaceText() for a reload.
+  void beginText();
+  //! \brief Parses text, the text that replaced the old one, and tracks
+  //! edits again.
+  //!
+  //! In XmlHighlighter::LexicalMode the parse waits for the event loop.
+  void endText(const QString& text);
+  //! \brief Takes over the tree parsed by other from the current text, which
+  //! was formatted lexically while it was parsed, and tracks edits again.
+  void endText(XmlEventParser& other, bool wellFormed);
+
+  //! \brief Replaces the text with text as a single edit of the part that
+  //! differs, and reparses it at once.
+  //!
+  //! For reloading a file another program has rewritten. The text before
+  //! and after the difference keeps its blocks, formats and folds, the
+  //! snapshot keeps the unchanged subtrees and only the blocks whose nodes
+  //! changed are formatted again. The edit can be undone, the text is not
+  //! modified afterwards.
+  void replaceText(const QString& text);
+
+  //! Reparses the text and rehighlights what the parse changed.
+  void reparse();
+  //! Reparses the text once control returns to the event loop.
+  void scheduleReparse();
+  //! Builds the format runs of text on the worker thread, from the nodes of
+  //! the current snapshot.
+  void requestFormatRuns(const QString& text);
+
+  //! Formats the deferred blocks from block on, count of them.
+  void formatBlocks(QTextBlock block, int count);
+  //! Formats the remaining deferred blocks while the editor is idle.
+  void startBackfill();
+
+  //! Returns the last block of the fold that starts in block blockNumber, -1
+  //! if none does.
+  int foldEnd(int blockNumber) const;
+  //! Returns true if the fold that starts in block blockNumber is folded.
+  bool isFolded(int blockNumber) const;
+  //! Hides the blocks of the fold that starts in block blockNumber, all but
+  //! the first.
+  void fold(int blockNumber);
+  //! Shows the blocks of the fold that starts in block blockNumber again,
+  //! folds inside it stay folded.
+  void unfold(int blockNumber);
+  //! Folds or unfolds the fold that starts in block blockNumber.
+  void toggleFold(int blockNumber);
+  //! Shows every folded block again.
+  void unfoldAll();
+
+  //! Rehighlights the whole text.
+  void updateHighlighting();
+  //! Rehighlights the blocks that hold text between from and to.
+  void updateHighlighting(int from, int to);
+
+signals:
+  //! Emitted when the node tree and the highlighting match the current text.
+  void treeUpdated();
+  //! Emitted when the text becomes read only, or editable again.
+  void readOnlyChanged(bool readOnly);
+  //! Emitted when a new snapshot has been published.
+  void snapshotPublished();
+  //! Emitted when the fold ranges or the folded blocks have changed.
+  void foldsChanged();
+  //! Emitted when validationErrors() have been replaced.
+  void validationFinished();
+
+private:
+  QTextDocument* m_document;
+  XmlEventParser* m_parser;
+  XmlHighlighter* m_highlighter;
+  QTimer* m_reparseTimer;
+  QThread* m_formatThread;
+  XmlFormatWorker* m_formatWorker;
+  //! Only the newest format run request is built, older ones are skipped.
+  std::atomic<int> m_formatGeneration{ 0 };
+  //! Formats the blocks nobody has scrolled to while the editor is idle.
+  QTimer* m_backfillTimer;
+  //! Where the backfill continues, moved with edits before it.
+  int m_backfillPosition = 0;
+  bool m_modified = false;
+  bool m_rehighlighting = false;
+  bool m_readOnly = false;
+  //! The text changed since the last parse, -1 if none.
+  int m_editFrom = -1;
+  int m_editTo = -1;
+  //! The positions of the inserted soft breaks, ascending.
+  QVector<int> m_softBreaks;
+  //! Only swapped atomically, readers on other threads load it unlocked.
+  std::shared_ptr<const XmlSnapshot> m_snapshot;
+  //! The text has been replaced since m_snapshot was built.
+  bool m_textReplaced = false;
+  //! The last block of the fold that starts in each block, -1 for none.
+  QVector<int> m_foldEnds;
+  //! The starts of the folded ranges, they move with edits.
+  QVector<QTextCursor> m_folds;
+  //! The block numbers of m_folds when they were last applied.
+  QSet<int> m_foldedBlocks;
+  QString m_schemaLocation;
+  //! Restarted by every snapshot, validates once editing pauses.
+  QTimer* m_validateTimer;
+  //! Started with the first schema.
+  QThread* m_validateThread = nullptr;
+  XmlValidator* m_validator = nullptr;
+  //! Only the newest validation request is run, older ones are skipped.
+  std::atomic<int> m_validateGeneration{ 0 };
+  XmlValidationErrors m_validationErrors;
+  int m_validatedRevision = -1;
+
+  void watchEdits();
+  void publishSnapshot(int from = -1, int to = -1);
+  void dropSnapshot();
+  void updateFoldRanges();
+  void applyFolds();
+  void textHasChanged(int position, int charsRemoved, int charsAdded);
+  void formatRunsReady(const XmlFormatRuns& runs);
+  void backfillHighlighting();
+  void validationReady(int generation,
+                       int revision,
+                       const XmlValidationErrors& errors);
+};
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "SMLibraries/widgets/lnplaintextedit.h"
+#include "qxml/xmlhighlighter.h"
 
+#include <QSharedPointer>
 #include <QTableWidget>
+#include <QThread>
 
+class XmlDocument;
 class XmlEventParser;
-class XmlHighlighter;
+class XmlFileLoader;
 class Node;
 class XmlEdit;
 
@@ -22,6 +26,10 @@ public:
   QString filename() const;
   void setFilename(const QString& Filename);
 
+  //! Sets the highlighter whose colours are saved, when the editor moves to
+  //! another XmlDocument.
+  void setHighlighter(XmlHighlighter* highlighter);
+
 private:
   XmlHighlighter* m_highlighter;
   QString m_filename;
@@ -89,16 +97,51 @@ private:
 };
 // Q_DECLARE_METATYPE(HtmlEditSettings::Colors);
 
+/*!
+ * \brief The column beside the line numbers of an XmlEdit that shows the
+ * fold markers, clicking one folds or unfolds it.
+ */
+class XmlFoldArea : public QWidget
+{
+public:
+  //! The width of the column.
+  static const int WIDTH = 12;
+
+  explicit XmlFoldArea(XmlEdit* editor);
+
+  QSize sizeHint() const override;
+
+protected:
+  void paintEvent(QPaintEvent* event) override;
+  void mousePressEvent(QMouseEvent* event) override;
+
+private:
+  XmlEdit* m_editor;
+};
+
 class XmlEdit : public LNPlainTextEdit
 {
   Q_OBJECT
 public:
   XmlEdit(QWidget* parent = nullptr);
   XmlEdit(BaseConfig* config, QWidget* parent = nullptr);
+  ~XmlEdit();
 
   // LNPlainTextEdit interface
   bool isModified() const override;
 
+  //! Returns the document the editor shows, shared with any other editor
+  //! that shows it.
+  QSharedPointer<XmlDocument> xmlDocument() const;
+  //! \brief Shows document in this editor.
+  //!
+  //! To show one text in several editors, for a split view or in several
+  //! tabs, pass the xmlDocument() of one to setXmlDocument() of the others.
+  //! They then share the text, the node tree and the highlighting, each
+  //! keeps its own cursor and scroll position. The previous document is
+  //! deleted when no editor shows it any longer.
+  void setXmlDocument(QSharedPointer<XmlDocument> document);
+
   //! Returns the file name loaded via loadFile(const QString&) or
   //! loadHref(const QString&, const QString&)
   const QString filename() const;
@@ -108,6 +151,68 @@ public:
   void loadFromZip(const QString& zipFile, const QString& href);
   //! Loads plain text into the editor
   void setText(const QString& text);
+  //! \brief Replaces the text with text, keeping whatever has not changed,
+  //! see XmlDocument::replaceText().
+  //!
+  //! For reloading a file another program has rewritten. A text that is or
+  //! would be soft reformatted is set with setText() instead.
+  void replaceText(const QString& text);
+
+  //! Returns the file size from which loadFile() loads progressively, 0 if
+  //! it never does.
+  qint64 progressiveLoadThreshold() const;
+  //! \brief Sets the file size from which loadFile() loads progressively.
+  //!
+  //! The file is then read, decoded and parsed in chunks on a worker thread
+  //! and each chunk is appended to the document as it arrives, so the start
+  //! of the file can be read and scrolled while the rest loads. The editor is
+  //! read only until loadFinished(). Once a chunk has a line longer than
+  //! longLineThreshold() the rest of the text is soft reformatted as it
+  //! arrives. The default is 4 MB, 0 switches this off.
+  void setProgressiveLoadThreshold(qint64 threshold);
+  //! Returns true while a progressive load is running.
+  bool isLoading() const;
+  //! Stops a progressive load, the text loaded so far is kept.
+  void cancelLoad();
+
+  //! Returns the highlight mode.
+  XmlHighlighter::Mode highlightMode() const;
+  //! \brief Sets the highlight mode and rehighlights the text.
+  //!
+  //! In XmlHighlighter::LexicalMode setText() shows the text without waiting
+  //! for it to be parsed, which suits huge or malformed documents.
+  void setHighlightMode(XmlHighlighter::Mode mode);
+
+  //! Returns the line length above which setText() soft reformats the text,
+  //! 0 if it never does.
+  int longLineThreshold() const;
+  //! \brief Sets the line length above which setText() soft reformats.
+  //!
+  //! A minified document is a single block, which QTextLayout has to lay out
+  //! and the highlighter has to format as a whole on every change. When any
+  //! line is longer than threshold the text is shown with line breaks
+  //! inserted between tags every few hundred characters. A break only goes
+  //! where whitespace does not count, never in a value, comment, CDATA
+  //! section, instruction or text, nor in an element that keeps its
+  //! whitespace or has text, see XmlSoftReformatter. A progressive load
+  //! starts breaking at the first line longer than threshold. The view is
+  //! read only, sourceText() returns the text without the breaks. The
+  //! default is 10000, 0 switches this off.
+  void setLongLineThreshold(int threshold);
+  //! Returns true if the text is shown soft reformatted.
+  bool isSoftReformatted() const;
+  //! Returns the text as it was set, without soft breaks.
+  QString sourceText() const;
+  //! Maps a position in the editor to the position in sourceText().
+  int sourcePosition(int position) const;
+  //! Maps a position in sourceText() to the position in the editor.
+  int viewPosition(int sourcePosition) const;
+
+  //! Reparses the current text and rehighlights it immediately.
+  //!
+  //! Edits schedule this automatically once control returns to the event
+  //! loop, so several changes made in one go are parsed once.
+  void reparse();
 
   //! Returns a pointer to the the Node at the mouse position or nullptr if
   //! no node exists at that point.
@@ -124,22 +229,66 @@ public:
 signals:
   void sendError(const QString&);
   void sendWarning(const QString&);
+  //! Emitted when the node tree and the highlighting match the current text.
+  void treeUpdated();
+  //! Emitted as a progressive load proceeds, read of total bytes.
+  void loadProgress(qint64 read, qint64 total);
+  //! Emitted when a progressive load has completed.
+  void loadFinished();
 
 protected:
   //! \reimplements{lNPlainTextEdit::paintEvent(QPaintEvent*)
   void paintEvent(QPaintEvent* e) override;
   //! \reimplements{lNPlainTextEdit::contextMenuEvent(QContextMenuEvent*)
   void contextMenuEvent(QContextMenuEvent* event) override;
+  //! \reimplements{lNPlainTextEdit::resizeEvent(QResizeEvent*)
+  void resizeEvent(QResizeEvent* event) override;
 
 private:
+  friend class XmlFoldArea;
+
   //  QTextDocument* m_document = nullptr;
-  XmlEventParser* m_parser;
-  XmlHighlighter* m_highlighter;
+  QSharedPointer<XmlDocument> m_xmlDocument;
+  //! The parser and highlighter of m_xmlDocument.
+  XmlEventParser* m_parser = nullptr;
+  XmlHighlighter* m_highlighter = nullptr;
+  XmlEditSettings* m_xmlSettings = nullptr;
   QWidget* m_parent;
-  bool m_modified;
   QString m_filename;
   QString m_zipFile;
+  int m_longLineThreshold = 10000;
+  QThread* m_loadThread = nullptr;
+  XmlFileLoader* m_loader = nullptr;
+  //! Chunks of a load that has been cancelled or replaced are dropped.
+  int m_loadGeneration = 0;
+  bool m_loading = false;
+  //! The soft breaks of the chunks loaded so far.
+  QVector<int> m_loadSoftBreaks;
+  qint64 m_progressiveLoadThreshold = 4 * 1024 * 1024;
+  XmlFoldArea* m_foldArea = nullptr;
+  //! The left viewport margin with the fold column added.
+  int m_foldMargin = -1;
 
-  void textHasChanged(int position, int charsRemoved, int charsAdded);
   void initialise();
+  void initXmlDocument();
+  void attachXmlDocument();
+  void highlightVisibleBlocks();
+  void matchTags();
+  void updateFoldArea(const QRect& rect, int dy);
+  void updateFoldAreaGeometry();
+  void paintFoldArea(QPaintEvent* event);
+  void foldAreaClicked(const QPoint& position);
+  QString softReformat(const QString& text);
+  bool hasLongLines(const QString& text) const;
+  void readFile(const QString& filename);
+  void initLoader();
+  void loadProgressively(const QString& filename);
+  void chunkLoaded(int generation,
+                   const QString& text,
+                   const QVector<int>& softBreaks,
+                   qint64 read,
+                   qint64 total);
+  void fileLoaded(int generation, bool wellFormed);
+  void fileLoadFailed(int generation, const QString& message);
+  void finishLoading();
 };
@@ -3,14 +3,18 @@
 #include <QFile>
 #include <QMap>
 #include <QObject>
+#include <QTextBlock>
 #include <QTextCursor>
 #include <QTextDocument>
 #include <QTextStream>
 #include <QThread>
 #include <QUrl>
 
+#include <vector>
+
 #include <xmlwrapp/event_parser.h>
 
+class XmlTextPosition;
 struct XmlAttribute;
 struct Node;
 struct NameNode;
@@ -29,7 +33,15 @@ struct ProcessingInstruction;
  *
  * XmlWrapp is a C++ wrapper for the C libxml2 XML parsing library.
  * XmlEventParser is a Qt wrapper for the XmlWrapp event_parser part of the
- * XmlWrapp library.
+ * XmlWrapp library. A libxml push parser can only be used once so each parse
+ * drives a new push parser, which means that the same XmlEventParser can be
+ * used to parse the text again after it has been edited. Each parse
+ * replaces the nodes and errors of the previous one.
+ *
+ * It is still an xml::event_parser whose callbacks build the nodes, so code
+ * that feeds it through parse_chunk() and parse_finish(), or overrides the
+ * callbacks, keeps working. That input goes through the xmlwrapp parser
+ * with its defaults and none of the limits below.
  *
  * Use parseFile(const QFile&), parseFile(const QString&), parseString(const
  * QString&) or parseUrl(const QUrl&) to parse the xml data.
@@ -40,6 +52,14 @@ struct ProcessingInstruction;
  * errors by accessing via errors() which returns a QMultiMap<QString,
  * BaseNode*> of error strings => the node causing the problem.
  *
+ * Input from outside can be parsed within bounds, see setLimits(). A parse
+ * that would nest too deep, build too much or expand entities too far
+ * stops at the callback that would exceed a bound, see limitError().
+ * libxml is driven directly so that its options can be set: it never goes
+ * to the network (XML_PARSE_NONET), does not substitute entities (no
+ * XML_PARSE_NOENT), so a declared entity is never expanded, and keeps the
+ * caps it drops with XML_PARSE_HUGE.
+ *
  * The positioning of the various start/end points are as below.
  * \code
  *  ⭣ node start
@@ -75,6 +95,145 @@ public:
     IsInPIData,   //!< Is in the processing instruction data
   };
 
+  /*!
+   * \brief A contiguous range of nodes() that overlap one text block.
+   */
+  struct NodeRange
+  {
+    //! The index in nodes() of the first node in the block.
+    int first = 0;
+    //! The number of nodes in the block.
+    int count = 0;
+  };
+
+  /*!
+   * \brief A range of text positions, from inclusive to to exclusive.
+   */
+  struct TextRange
+  {
+    int from = -1;
+    int to = -1;
+
+    bool isEmpty() const { return from < 0 || to <= from; }
+  };
+
+  /*!
+   * \brief What a text position is in, see contextAt().
+   *
+   * The ancestors of element are its Node::parent chain, depth of them.
+   */
+  struct Context
+  {
+    //! The node that holds the position, null between nodes.
+    Node* node = nullptr;
+    //! The innermost element that holds the position, null outside the root
+    //! element. node may be its start or end tag.
+    StartNode* element = nullptr;
+    //! The depth of element, 0 for the root element and -1 for none.
+    int depth = -1;
+    //! The part of node that holds the position.
+    IsInNodeType region = NotInNode;
+    //! The index of the attribute of an IsInAttributeName or
+    //! IsInAttributeValue region, -1 otherwise.
+    int attributeIndex = -1;
+
+    //! Returns the ancestor of element at depth level, element itself at
+    //! depth and null for none.
+    StartNode* ancestor(int level) const;
+  };
+
+  /*!
+   * \brief Bounds on what one parse may build, see setLimits().
+   *
+   * A bound of 0 is no bound, which is the default for all of them. The
+   * bounds are checked in the parse callbacks, before a node is made, and
+   * the first one exceeded stops the parse, see limitError(). Lengths are
+   * in bytes of UTF-8.
+   */
+  struct Limits
+  {
+    //! The deepest nesting of elements, the root element is at depth 1.
+    int maxDepth = 0;
+    //! The most nodes, end tags included.
+    int maxNodes = 0;
+    //! The most attributes of one element.
+    int maxAttributes = 0;
+    //! The longest element name, attribute name or instruction target.
+    int maxNameLength = 0;
+    //! The longest run of text, attribute value, CDATA section, comment or
+    //! instruction data.
+    int maxTextLength = 0;
+    //! The most heap the node tree may take, as estimated while parsing.
+    qint64 maxTreeBytes = 0;
+    //! \brief The most bytes of names and content the parse may deliver
+    //! per byte of input, which bounds the expansion of entities.
+    //!
+    //! Without entity references it is at most 1. Inputs shorter than 1 KiB
+    //! are counted as 1 KiB.
+    int maxExpansion = 0;
+
+    //! Returns bounds suited to input from outside.
+    static Limits untrusted();
+  };
+
+  /*!
+   * \enum XmlEventParser::LimitType
+   *
+   * The bound a parse exceeded, see Limits.
+   */
+  enum LimitType
+  {
+    NoLimitExceeded,      //!< The parse stayed within its limits.
+    DepthLimit,           //!< Limits::maxDepth
+    NodeLimit,            //!< Limits::maxNodes
+    AttributeLimit,       //!< Limits::maxAttributes
+    NameLengthLimit,      //!< Limits::maxNameLength
+    TextLengthLimit,      //!< Limits::maxTextLength
+    TreeBytesLimit,       //!< Limits::maxTreeBytes
+    EntityExpansionLimit, //!< Limits::maxExpansion
+  };
+
+  /*!
+   * \brief The bound that stopped a parse, see limitError().
+   */
+  struct LimitError
+  {
+    LimitType limit = NoLimitExceeded;
+    //! The bound and the value that exceeded it.
+    qint64 maximum = 0;
+    qint64 value = 0;
+    //! The element, attribute or target at fault, empty for content.
+    QString name;
+    //! The depth of the element being parsed, 0 outside the root element.
+    int depth = 0;
+    //! The number of nodes parsed before the parse was stopped.
+    int nodeCount = 0;
+  };
+
+  /*!
+   * \brief An estimate of the heap the tree takes, see memoryUsage().
+   */
+  struct MemoryUsage
+  {
+    //! The nodes and their lists of children.
+    qint64 nodes = 0;
+    //! The attributes and the attribute lists.
+    qint64 attributes = 0;
+    //! Names, values, text and data.
+    qint64 strings = 0;
+    //! The positioned QTextCursors of the nodes and attributes.
+    qint64 cursors = 0;
+    //! errors() and errorMessage().
+    qint64 errors = 0;
+    //! nodes() and the block index.
+    qint64 indices = 0;
+
+    //! Returns the sum of the categories.
+    qint64 total() const;
+  };
+
+  //! document may be null, the node positions are then offsets in the
+  //! parsed text, see XmlTextPosition.
   explicit XmlEventParser(QTextDocument* document, QObject* parent = nullptr);
   ~XmlEventParser();
 
@@ -93,9 +252,36 @@ public:
   //! \brief Parses the text string.
   //!
   //! Returns true if the parser encounters no errors, otherwise returns false.
+  //! If the text is not well formed the nodes of the previous successful
+  //! parse are kept and errorMessage() describes the problem. If it exceeds
+  //! a bound, see setLimits(), there are no nodes at all.
   //!
   bool parseString(const QString& text);
 
+  //! \brief Starts a parse of UTF-8 text that arrives in chunks.
+  //!
+  //! The nodes of the previous parse are deleted. Feed the text to
+  //! parseChunk() and complete the parse with finishChunks(). The chunks are
+  //! parsed as they come, the whole text is never held by the parser.
+  void beginChunks();
+
+  //! Parses the next chunk of the text. Returns false once the text is known
+  //! not to be well formed, later chunks are then ignored.
+  bool parseChunk(const char* data, int length);
+
+  //! \brief Completes a chunked parse.
+  //!
+  //! Returns true if the text was well formed. The nodes have no positions
+  //! until they are taken over by adoptTree(), a parser without a document can
+  //! run a chunked parse on a worker thread for that reason.
+  bool finishChunks();
+
+  //! \brief Replaces the nodes with those of the chunked parse completed by
+  //! other and positions them in text, the text that was parsed.
+  //!
+  //! other is left empty. Call this on the thread that owns the document.
+  void adoptTree(XmlEventParser& other, const QString& text);
+
   //!
   //! \brief Parses the url specified by the network QUrl if it exists.
   //!
@@ -103,15 +289,63 @@ public:
   //!
   bool parseUrl(QUrl& url);
 
+  //! Deletes the nodes and errors of the previous parse.
+  void clear();
+
+  //! Returns the bounds of every parse.
+  const Limits& limits() const;
+  //! Sets the bounds of the parses that start from now on.
+  void setLimits(const Limits& limits);
+  //! \brief Returns the bound that stopped the last parse.
+  //!
+  //! Its limit is NoLimitExceeded if none did. If one did the parse failed,
+  //! the tree is empty rather than that of the previous parse, and
+  //! errorMessage() says which bound it was.
+  const LimitError& limitError() const;
+
+  //! \brief Returns an estimate of the heap the tree takes, by category.
+  //!
+  //! The tree is tallied as it is parsed, a call only adds up the errors
+  //! and the indices, so it is cheap enough to poll.
+  MemoryUsage memoryUsage() const;
+
   bool isHaltOnError() const;
   void setHaltOnError(bool HaltOnError);
 
   const QMultiMap<QString, Node*>& errors() const;
+  //! Returns the libxml error message of the last parse, if any.
+  const QString& errorMessage() const;
+
+  //! \brief Returns the text range whose nodes differ from the previous parse.
+  //!
+  //! Only the nodes in this range are formatted differently, the range is
+  //! empty if the last parse failed or nothing but node content changed.
+  TextRange changedRange() const;
 
   Node* rootNode() const;
   Node *nodeForPosition(int position);
+  //! \brief Returns the node, element and region that hold position.
+  //!
+  //! The nodes are binary searched by position, so this is cheap enough for
+  //! every cursor move and hover. It allocates nothing and, unlike
+  //! Node::isIn(), changes no node.
+  Context contextAt(int position) const;
   const QVector<Node*>& nodes() const;
 
+  //! \brief Returns the range of nodes() that overlap block.
+  //!
+  //! The index is built along with the node positions and shifted with
+  //! every edit of the document, so this is a lookup by block number. Until
+  //! the next parse an edited block holds the nodes of the blocks it
+  //! replaced. If the index could not be kept the range is found by a binary
+  //! search of the node positions instead.
+  NodeRange nodesInBlock(const QTextBlock& block) const;
+
+  //! Returns the position of the start of each block of text, the first at
+  //! 0. Blocks are separated as in a QTextDocument, by LF, CR, CR LF or the
+  //! paragraph separator.
+  static std::vector<int> blockStarts(const QString& text);
+
 signals:
   void sendError(const QString&);
   void sendWarning(const QString&);
@@ -123,6 +357,10 @@ protected:
   Node* m_rootNode = nullptr;
   Node* m_parentNode = nullptr;
   QVector<Node*> m_nodes;
+  QVector<NodeRange> m_blockIndex;
+  int m_blockIndexRevision = -1;
+  TextRange m_changedRange;
+  QString m_errorMessage;
   bool m_haltOnError = true;
   bool m_downloadCorrect = false;
 
@@ -138,10 +376,56 @@ protected:
   void downloadError(const QString& errorString);
   void downloadComplete(const QByteArray& data);
 
+  //! Attaches text positions to the nodes created by the parse callbacks.
+  void calculateNodePositions(const QString& text);
+  void shiftBlockIndex(int position, int charsRemoved, int charsAdded);
+
 private:
-  QTextCursor createCursor(int position);
+  class Handler;
+  Handler* m_chunkHandler = nullptr;
+  bool m_chunksWellFormed = false;
+  Limits m_limits;
+  LimitError m_limitError;
+  //! What the current parse has been given, delivered and built so far.
+  qint64 m_inputBytes = 0;
+  qint64 m_deliveredBytes = 0;
+  qint64 m_treeBytes = 0;
+  //! The length of the text delivered since the last markup.
+  qint64 m_textRunBytes = 0;
+  //! The tally of the tree, kept by admit() and the declaration.
+  MemoryUsage m_treeUsage;
+
+  //! The node store of one parse.
+  struct Tree
+  {
+    QVector<Node*> nodes;
+    QMultiMap<QString, Node*> errors;
+    QVector<NodeRange> blockIndex;
+    int blockIndexRevision = -1;
+    Node* root = nullptr;
+    MemoryUsage usage;
+  };
+
+  void startLimits();
+  void finishLimits();
+  bool exceeds(LimitType limit,
+               qint64 maximum,
+               qint64 value,
+               const std::string& name = std::string());
+  bool admit(qint64 delivered,
+             const MemoryUsage& added,
+             const std::string& name);
+
+  Tree takeTree();
+  void restoreTree(Tree& tree);
+  static TextRange changedRange(const QVector<Node*>& before,
+                                const QVector<Node*>& after);
+
+  XmlTextPosition createCursor(int position);
+  int calculateAttributePositions(StartNode* start,
+                                  const QString& text,
+                                  int pos);
   int reverseSearchForChar(QChar c, QString text, int searchFrom);
-  void calculateNodePositions(const QString& text);
 
   static const QRegularExpression XMLDECL_REGEX;
   static const QRegularExpression XML_REGEX;
@@ -157,33 +441,60 @@ private:
   void getXmlDeclaration(const QString& text);
 };
 
+/*!
+ * \brief A position in the text of a node or attribute.
+ *
+ * With a document it is a QTextCursor, which follows the edits of the
+ * document. A parser without a document, as XmlDiff and XmlFileLoader use,
+ * records the offset in the parsed text instead.
+ */
+class XmlTextPosition
+{
+public:
+  XmlTextPosition() = default;
+  XmlTextPosition(const QTextCursor& cursor);
+  //! A fixed offset in the parsed text.
+  explicit XmlTextPosition(int position);
+
+  //! Returns the position, -1 if it has not been set.
+  int position() const;
+  bool isNull() const;
+  //! Returns the cursor, a null one for a fixed offset.
+  const QTextCursor& cursor() const;
+  operator QTextCursor() const;
+
+private:
+  QTextCursor m_cursor;
+  int m_position = -1;
+};
+
 struct XmlAttribute
 {
   XmlAttribute();
   XmlAttribute(const QString& name);
 
-  int nameStart();
+  int nameStart() const;
 
-  int nameLength();
+  int nameLength() const;
 
-  int valueStart();
+  int valueStart() const;
 
-  int valueLength();
+  int valueLength() const;
 
-  bool hasValue();
+  bool hasValue() const;
 
   XmlEventParser::XmlEventParser::IsInNodeType isIn(int cursorPos);
 
   //! The tag name
   QString name;
   //! The start position of the tag
-  QTextCursor nameStartCursor;
+  XmlTextPosition nameStartCursor;
   //! The attribute value
   QString value;
   //! The end position of the tag
-  QTextCursor valueStartCursor;
+  XmlTextPosition valueStartCursor;
   //! allows for gaps between name and assignment =
-  QTextCursor assignCursor;
+  XmlTextPosition assignCursor;
 };
 
 //! \struct Node
@@ -230,34 +541,47 @@ struct Node
   virtual QString toString() = 0;
 
   //! \brief The start position of the BaseNode in the text
-  int start();
+  int start() const;
 
   //! \brief The end position of the BaseNode in the text
-  int end();
+  int end() const;
 
   /*!
    * \brief Returns the tag length.
    */
-  int length();
+  int length() const;
 
   //! Adds n spaces to string s.
   static void addSpaces(int n, QString& s);
 
-  bool contains(int position);
+  bool contains(int position) const;
+
+  //! Returns seed combined with value, for building hash.
+  static quint64 combineHash(quint64 seed, quint64 value);
+  //! Returns seed combined with the hash of value, for building hash.
+  static quint64 combineHash(quint64 seed, const QString& value);
 
   Node* parent = nullptr;
   //! The child nodes of this nodes.
   QVector<Node*> children;
-  //! The QTextCursor at the start position of the tag.
-  QTextCursor startCursor;
-  //! The QTextCursor at the end position of the tag.
-  QTextCursor endCursor;
+  //! The position at the start position of the tag.
+  XmlTextPosition startCursor;
+  //! The position at the end position of the tag.
+  XmlTextPosition endCursor;
   //! The node type.
   Type type = Base;
   //! The errors generated by the process.
   Errors errors = NoError;
   //! Stores newlines inside tags.
   QList<int> newLines;
+  //! \brief The structural hash of the node and everything below it.
+  //!
+  //! It covers the name, the attributes, whatever their order, the content
+  //! and the hashes of the children, not the layout of the text. Text
+  //! children that are only whitespace are left out, so that indenting a
+  //! subtree differently does not change it. Equal hashes mean equal
+  //! subtrees. An element has it once its end tag has been parsed.
+  quint64 hash = 0;
 };
 
 struct NameNode : Node
@@ -268,11 +592,11 @@ struct NameNode : Node
   /*!
    * \brief Returns the tag name start position.
    */
-  int nameStart();
+  int nameStart() const;
   /*!
    * \brief Returns the length of the text.
    */
-  int nameLength();
+  int nameLength() const;
 
   /*!
    * \brief isIn method of all name nodes types.
@@ -282,8 +606,8 @@ struct NameNode : Node
    */
   XmlEventParser::IsInNodeType isIn(int cursorPos) override;
 
-  //! The QTextCursor at the start position of the tag name.
-  QTextCursor nameStartCursor;
+  //! The position at the start position of the tag name.
+  XmlTextPosition nameStartCursor;
   //! The tag name.
   QString name;
 };
@@ -316,17 +640,17 @@ struct XmlDeclarationNode : NameNode
   int standaloneAssignStart();
   int standaloneValueStart();
 
-  QTextCursor versionCursor;
-  QTextCursor versionAssign;
-  QTextCursor versionValueCursor;
+  XmlTextPosition versionCursor;
+  XmlTextPosition versionAssign;
+  XmlTextPosition versionValueCursor;
   QString version;
-  QTextCursor encodingCursor;
-  QTextCursor encodingAssign;
-  QTextCursor encodingValueCursor;
+  XmlTextPosition encodingCursor;
+  XmlTextPosition encodingAssign;
+  XmlTextPosition encodingValueCursor;
   QString encoding;
-  QTextCursor standaloneCursor;
-  QTextCursor standaloneAssign;
-  QTextCursor standaloneValueCursor;
+  XmlTextPosition standaloneCursor;
+  XmlTextPosition standaloneAssign;
+  XmlTextPosition standaloneValueCursor;
   QString standalone;
 };
 
@@ -351,7 +675,9 @@ struct StartNode : NameNode
   //! List of attributes.
   QVector<XmlAttribute*> attributes;
   //! The closer node
-  Node* closer;
+  Node* closer = nullptr;
+  //! The number of elements this one is nested in.
+  int depth = 0;
 };
 
 struct EndNode : NameNode
@@ -360,6 +686,9 @@ struct EndNode : NameNode
   EndNode(const QString& name);
 
   QString toString() override;
+
+  //! The start node this one closes.
+  StartNode* opener = nullptr;
 };
 
 struct TextNode : Node
@@ -379,7 +708,7 @@ struct TextNode : Node
    *
    * Equivalent of calling text().length().
    */
-  int textLength();
+  int textLength() const;
 
   /*!
    * \brief isIn method of all Tag types.
@@ -395,8 +724,8 @@ struct TextNode : Node
   //! space characters.
   bool isWhitespace();
 
-  //! The QTextCursor at the start position of the tag name.
-  QTextCursor textStartCursor;
+  //! The position at the start position of the tag name.
+  XmlTextPosition textStartCursor;
   /*!
    * \brief the text string
    */
@@ -408,16 +737,16 @@ struct CDataNode : Node
   CDataNode();
   CDataNode(const QString& data);
 
-  int dataStart();
+  int dataStart() const;
 
   QString toString() override;
 
   XmlEventParser::IsInNodeType isIn(int cursorPos) override;
 
-  int dataLength();
+  int dataLength() const;
 
-  //! The QTextCursor at the start position of the tag text.
-  QTextCursor dataStartCursor;
+  //! The position at the start position of the tag text.
+  XmlTextPosition dataStartCursor;
   QString data;
 };
 
@@ -426,14 +755,14 @@ struct CommentNode : Node
   CommentNode();
   CommentNode(const QString& text);
 
-  int commentStart();
+  int commentStart() const;
 
   /*!
    * \brief Returns the length of the text string.
    *
    * Equivalent of calling text().length().
    */
-  int commentLength();
+  int commentLength() const;
 
   QString toString() override;
 
@@ -445,8 +774,8 @@ struct CommentNode : Node
   //! space characters.
   bool isWhitespace() { return comment.trimmed().isEmpty(); }
 
-  //! The QTextCursor at the start position of the tag name.
-  QTextCursor commentStartCursor;
+  //! The position at the start position of the tag name.
+  XmlTextPosition commentStartCursor;
 
   /*!
    * \brief the text string
@@ -459,18 +788,18 @@ struct ProcessingInstruction : Node
   ProcessingInstruction();
   ProcessingInstruction(const QString target, const QString data);
 
-  int targetStart();
-  int targetLength();
+  int targetStart() const;
+  int targetLength() const;
 
-  int dataStart();
-  int dataLength();
+  int dataStart() const;
+  int dataLength() const;
 
   QString toString() override;
 
   XmlEventParser::IsInNodeType isIn(int cursorPos) override;
 
-  QTextCursor targetStartCursor;
-  QTextCursor dataStartCursor;
+  XmlTextPosition targetStartCursor;
+  XmlTextPosition dataStartCursor;
 
   QString target;
   QString data;
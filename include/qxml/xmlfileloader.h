@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+class XmlEventParser;
+
+/*!
+ * \ingroup widgets
+ * \class XmlFileLoader xmlfileloader.h "include/qxml/xmlfileloader.h"
+ * \brief Reads and parses a file in chunks on a worker thread.
+ *
+ * Move it to a QThread and call load() with a queued invocation. Each chunk
+ * is decoded from UTF-8 once, sent to the GUI thread through chunkLoaded()
+ * and fed, as the bytes read, to a chunked parse by parser(). The first
+ * chunk is small so that the start of the file shows quickly.
+ *
+ * With a long line threshold the chunks go through an XmlSoftReformatter
+ * first, and the parse is fed the text as shown, soft breaks included.
+ *
+ * When loaded() arrives the loader is idle until the next load(), and the
+ * tree can be taken over with XmlEventParser::adoptTree().
+ */
+class XmlFileLoader : public QObject
+{
+  Q_OBJECT
+public:
+  //! The size of the first chunk.
+  static const int FIRST_CHUNK_BYTES = 64 * 1024;
+  //! The size of the chunks after the first.
+  static const int CHUNK_BYTES = 512 * 1024;
+
+  explicit XmlFileLoader(QObject* parent = nullptr);
+
+  //! Reads and parses filename. generation is passed back with every signal
+  //! so that the chunks of a load that has been replaced can be told apart.
+  //! Once a line is longer than longLineThreshold the text is soft
+  //! reformatted, see XmlSoftReformatter, never if it is 0.
+  void load(const QString& filename,
+            int generation,
+            int longLineThreshold = 0);
+  //! Stops the current load at the next chunk, it emits no loaded(). May be
+  //! called from any thread.
+  void cancel();
+
+  //! Returns the parser that holds the tree of the last load.
+  XmlEventParser* parser() const;
+
+signals:
+  //! Emitted for each chunk of text, read of total bytes have been read.
+  //! softBreaks holds the breaks inserted into it, as positions in the
+  //! whole text shown.
+  void chunkLoaded(int generation,
+                   const QString& text,
+                   const QVector<int>& softBreaks,
+                   qint64 read,
+                   qint64 total);
+  //! Emitted when the whole file has been read and parsed.
+  void loaded(int generation, bool wellFormed);
+  //! Emitted if the file cannot be opened or read.
+  void loadFailed(int generation, const QString& message);
+
+private:
+  XmlEventParser* m_parser;
+  std::atomic<bool> m_cancel{ false };
+
+  static int completeLength(const QByteArray& bytes);
+};
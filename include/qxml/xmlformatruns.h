@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+class XmlSnapshot;
+class XmlSnapshotNode;
+
+/*!
+ * \brief The character formats used by XmlHighlighter.
+ *
+ * The highlighter keeps one QTextCharFormat for each id, runs only carry the
+ * id.
+ */
+enum class XmlFormatId : quint8
+{
+  Text,        //!< Tag brackets, element text and whitespace.
+  Declaration, //!< The xml name of the xml declaration.
+  Name,        //!< Start and end tag names.
+  Attribute,   //!< Attribute and xml declaration parameter names.
+  Value,       //!< Attribute and xml declaration parameter values.
+  Comment,     //!< Comments, including the delimiters.
+  CData,       //!< CDATA section data.
+  PiTarget,    //!< Processing instruction targets.
+  PiData,      //!< Processing instruction data.
+};
+
+/*!
+ * \brief A formatted span of the document, start is a document position.
+ *
+ * XmlFormatWorker makes these from the snapshot nodes in the order the
+ * highlighter has to apply them, a later span overrides an earlier one where
+ * they overlap.
+ */
+struct XmlFormatSpan
+{
+  int start = 0;
+  int length = 0;
+  XmlFormatId format = XmlFormatId::Text;
+};
+
+/*!
+ * \brief A formatted span within one block, start is relative to the block.
+ */
+struct XmlFormatRun
+{
+  int start = 0;
+  int length = 0;
+  XmlFormatId format = XmlFormatId::Text;
+};
+
+/*!
+ * \ingroup widgets
+ * \class XmlFormatRuns xmlformatruns.h "include/qxml/xmlformatruns.h"
+ * \brief The format runs of every block of a document revision.
+ *
+ * Built by XmlFormatWorker away from the GUI thread so that
+ * XmlHighlighter::highlightBlock only has to replay the runs of the block
+ * with setFormat().
+ */
+class XmlFormatRuns
+{
+public:
+  //! Splits spans into per block runs of text, blocks are separated as in
+  //! XmlEventParser::blockStarts().
+  static XmlFormatRuns build(const QString& text,
+                             const QVector<XmlFormatSpan>& spans,
+                             int revision);
+
+  //! Returns true if the runs were built for the document revision.
+  bool isValidFor(int revision) const;
+
+  //! Returns the document revision the runs were built for, -1 if empty.
+  int revision() const;
+
+  //! Returns the number of blocks.
+  int blockCount() const;
+
+  //! Returns the heap the runs take, in bytes.
+  qint64 memoryUsage() const;
+
+  //! Returns the first run of block number, the runs up to runsEnd(number)
+  //! are in the order they are applied.
+  const XmlFormatRun* runsBegin(int number) const;
+  //! Returns one past the last run of block number.
+  const XmlFormatRun* runsEnd(int number) const;
+
+private:
+  int m_revision = -1;
+  //! The runs of all blocks, block n owns m_runs[m_first[n]..m_first[n+1]).
+  QVector<XmlFormatRun> m_runs;
+  QVector<int> m_first;
+};
+
+Q_DECLARE_METATYPE(XmlFormatRuns)
+
+/*!
+ * \ingroup widgets
+ * \class XmlFormatWorker xmlformatruns.h "include/qxml/xmlformatruns.h"
+ * \brief Builds XmlFormatRuns on a worker thread.
+ *
+ * Move it to a QThread and call build() with a queued invocation, the result
+ * comes back through runsReady(). The spans are made from an XmlSnapshot,
+ * which holds only offsets and node kinds and may be read on any thread, so
+ * nothing of the formatting is left to the GUI thread.
+ */
+class XmlFormatWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit XmlFormatWorker(QObject* parent = nullptr);
+
+  //! Returns the formatted spans of the nodes of snapshot, in the order they
+  //! are applied.
+  static QVector<XmlFormatSpan> spansOf(const XmlSnapshot& snapshot);
+
+  //! Builds the runs for text, the text of snapshot, and emits runsReady().
+  void build(const QString& text,
+             const std::shared_ptr<const XmlSnapshot>& snapshot);
+
+signals:
+  void runsReady(const XmlFormatRuns& runs);
+
+private:
+  static void appendSpans(const XmlSnapshotNode& node,
+                          int start,
+                          QVector<XmlFormatSpan>& spans);
+};
@@ -3,6 +3,8 @@
 #include <QSyntaxHighlighter>
 #include <QTextDocument>
 
+#include "qxml/xmlformatruns.h"
+
 class XmlEventParser;
 
 class XmlHighlighter : public QSyntaxHighlighter
@@ -12,6 +14,16 @@ class XmlHighlighter : public QSyntaxHighlighter
   {
     NodeComplete = 0,
     NodeIncomplete,
+    // lexical mode, the construct a block ends inside.
+    InTag,
+    InTagDoubleQuote,
+    InTagSingleQuote,
+    InDeclaration,
+    InDeclarationDoubleQuote,
+    InDeclarationSingleQuote,
+    InComment,
+    InCData,
+    InProcessingInstruction,
   };
   struct FormatSize
   {
@@ -20,9 +32,43 @@ class XmlHighlighter : public QSyntaxHighlighter
   };
 
 public:
+  /*!
+   * \enum XmlHighlighter::Mode
+   *
+   * How blocks are formatted.
+   */
+  enum Mode
+  {
+    //! From the parser nodes, lexically while the parser has no nodes.
+    TreeMode,
+    //! Lexically from the text and the state of the previous block only.
+    LexicalMode,
+  };
+
+  /*!
+   * \brief An estimate of the heap the highlighting takes, see
+   * memoryUsage().
+   */
+  struct MemoryUsage
+  {
+    //! The format runs, see setFormatRuns().
+    qint64 formatRuns = 0;
+    //! The formats of the blocks and the per block data.
+    qint64 blockFormats = 0;
+
+    //! Returns the sum of the categories.
+    qint64 total() const;
+  };
 
   explicit XmlHighlighter(XmlEventParser* parser,
                           QTextDocument* parent = nullptr);
+  ~XmlHighlighter() override;
+
+  //! Returns the highlight mode, TreeMode by default.
+  Mode mode() const;
+  //! Sets the highlight mode. Call rehighlight() to apply it to formatted
+  //! text.
+  void setMode(Mode mode);
 
   //! Returns the text colour.
   QColor textColor();
@@ -40,6 +86,8 @@ public:
   //! Sets the foreground and, optionally, the background colour for
   //! tag start (<) / tag end (>) and bracket matching
   void setMatchColor(const QColor& color);
+  //! Returns the format of matching tags, see XmlEdit.
+  const QTextCharFormat& matchFormat() const;
 
   //! Gets the colour for bracket tag/matching
   QColor nameColor();
@@ -87,12 +135,53 @@ public:
   QColor xmlolor() const;
   void setXmlolor(const QColor& Xmlolor);
 
+  //! Reformats only the blocks that hold text between from and to.
+  void rehighlightRange(int from, int to);
+
+  //! \brief Sets the precomputed format runs.
+  //!
+  //! While the runs match the document revision highlightBlock() replays
+  //! them, otherwise it formats the block from the parser nodes.
+  void setFormatRuns(const XmlFormatRuns& runs);
+
+  //! \brief Defers the formatting of blocks that have not been formatted.
+  //!
+  //! While deferred highlightBlock() leaves a block that has not been
+  //! formatted since setDeferred(true) alone when QSyntaxHighlighter reaches
+  //! it on its own, so setting a huge text costs no formatting. Such blocks
+  //! are formatted by formatDeferred() or rehighlightRange().
+  void setDeferred(bool deferred);
+  //! Returns true if formatting is deferred.
+  bool isDeferred() const;
+  //! Formats block if it has not been formatted while deferred. Returns true
+  //! if the block was formatted.
+  bool formatDeferred(const QTextBlock& block);
+  //! Marks every block as not formatted, so that formatDeferred() formats it
+  //! again. For when the nodes arrive for text that was formatted lexically.
+  void markUnformatted();
+
+  //! \brief Returns an estimate of the heap the highlighting takes, by
+  //! category.
+  //!
+  //! The blocks are tallied as they are formatted and deleted, the format
+  //! ranges of a block counted by the setFormat() calls that made them, so
+  //! it is cheap enough to poll.
+  MemoryUsage memoryUsage() const;
+
 protected:
   //! \reimplements{QSyntaxHighlighter::highlightBlock}
   void highlightBlock(const QString& text);
 
 private:
   XmlEventParser* m_parser;
+  XmlFormatRuns m_runs;
+  Mode m_mode = TreeMode;
+  bool m_deferred = false;
+  bool m_forced = false;
+  //! The tally of the block data, kept by the data itself.
+  qint64 m_blockFormatsBytes = 0;
+  //! The setFormat() calls for the block being formatted.
+  int m_formatCalls = 0;
 
   QColor m_xmlColor;
   QColor m_textColor;
@@ -125,4 +214,9 @@ private:
   QTextCharFormat m_piDataFormat;
 
   bool isFormatable(int start, int length, int blockStart, int textLength, FormatSize &result);
+  const QTextCharFormat& formatFor(XmlFormatId id) const;
+  void highlightLexically(const QString& text);
+  void formatBlock(const QString& text);
+  //! Hides QSyntaxHighlighter::setFormat() to count the calls.
+  void setFormat(int start, int count, const QTextCharFormat& format);
 };
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+/*!
+ * \ingroup widgets
+ * \class XmlMappedDocument xmlmappeddocument.h
+ * "include/qxml/xmlmappeddocument.h" \brief A read only, memory mapped XML
+ * file of any size.
+ *
+ * The file is never read as a whole. Text is decoded from the mapping only
+ * for the byte range asked for, which is what XmlMappedView shows.
+ *
+ * buildIndex() makes one streaming pass over the file. It records a sparse
+ * line index, the offset of every LINE_STRIDE'th line, and a structure
+ * checkpoint every CHECKPOINT_BYTES bytes. A checkpoint holds the offsets of
+ * the elements open at that point. Line numbers and element paths are then
+ * answered by scanning forward from the nearest checkpoint, so memory stays
+ * a small fraction of the file size however large it is.
+ *
+ * All const methods may be called from any thread. buildIndex() is meant to
+ * run on a worker thread and publishes the index when it completes.
+ */
+class XmlMappedDocument
+{
+public:
+  //! An element on the path to a position.
+  struct Element
+  {
+    //! The byte offset of the < of the start tag.
+    qint64 offset = 0;
+    //! The element name.
+    QString name;
+  };
+
+  //! Every LINE_STRIDE'th line start is kept in the line index.
+  static const qint64 LINE_STRIDE = 4096;
+  //! The distance between structure checkpoints.
+  static const qint64 CHECKPOINT_BYTES = 64 * 1024;
+
+  XmlMappedDocument();
+  ~XmlMappedDocument();
+
+  //! Maps filename. Returns false if the file cannot be opened or mapped.
+  bool open(const QString& filename);
+  //! Unmaps the file and drops the index.
+  void close();
+  //! Returns true if a file is mapped.
+  bool isOpen() const;
+  //! Returns the file name.
+  QString filename() const;
+
+  //! Returns the file size in bytes.
+  qint64 size() const;
+
+  //! Returns offset moved back to the first byte of its UTF-8 sequence.
+  qint64 charStart(qint64 offset) const;
+  //! Returns the offset of the start of the line holding offset, searching
+  //! back no further than from. Returns from if there is no line start
+  //! between the two.
+  qint64 lineStart(qint64 offset, qint64 from = 0) const;
+  //! Returns the offset of the start of the line after the one holding
+  //! offset, searching no further than to, or to the end of the file if to is
+  //! negative. Returns to, or size(), if there is no line start between the
+  //! two.
+  qint64 nextLineStart(qint64 offset, qint64 to = -1) const;
+  //! Returns the start of every line that starts in from..to, from first.
+  //! The range is meant for a window of the file and has to be under 4 GB.
+  QVector<qint64> lineStarts(qint64 from, qint64 to) const;
+
+  //! Decodes the UTF-8 bytes from..to. Both should be line starts, or size().
+  QString text(qint64 from, qint64 to) const;
+
+  //! \brief Builds the line and structure index in one pass.
+  //!
+  //! Returns early, without an index, if cancel becomes true.
+  void buildIndex(const std::atomic<bool>& cancel);
+  //! Returns true once buildIndex() has completed.
+  bool isIndexed() const;
+
+  //! Returns the number of lines, -1 until the file is indexed.
+  qint64 lineCount() const;
+  //! Returns the zero based line number of offset, -1 until the file is
+  //! indexed.
+  qint64 lineNumber(qint64 offset) const;
+  //! Returns the offset of the start of line, -1 until the file is indexed.
+  qint64 lineOffset(qint64 line) const;
+
+  //! Returns the elements enclosing offset, outermost first. Empty until the
+  //! file is indexed.
+  QVector<Element> elementPath(qint64 offset) const;
+
+private:
+  struct Checkpoint
+  {
+    qint64 offset = 0;
+    QVector<qint64> open;
+  };
+
+  QFile m_file;
+  const char* m_data = nullptr;
+  qint64 m_size = 0;
+
+  mutable QMutex m_mutex;
+  bool m_indexed = false;
+  qint64 m_lineCount = 0;
+  QVector<qint64> m_lineIndex;
+  QVector<Checkpoint> m_checkpoints;
+
+  QString elementName(qint64 offset) const;
+};
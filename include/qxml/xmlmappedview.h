@@ -0,0 +1,101 @@
+#pragma once
+
+#include "qxml/xmlmappeddocument.h"
+
+#include <QPlainTextEdit>
+#include <QScrollBar>
+#include <QStringList>
+#include <QThread>
+#include <QWidget>
+
+#include <atomic>
+
+class XmlHighlighter;
+
+/*!
+ * \ingroup widgets
+ * \class XmlMappedView xmlmappedview.h "include/qxml/xmlmappedview.h"
+ * \brief A read only viewer for XML files too large to load into XmlEdit.
+ *
+ * The file is memory mapped by an XmlMappedDocument and only a window of
+ * about WINDOW_BYTES around the visible lines is decoded into the editor
+ * document. Scrolling near either end of the window moves it, the scroll bar
+ * beside the editor covers the whole file.
+ *
+ * The window is highlighted lexically, without a parse. The line and element
+ * path of a position are served from the document index, which is built on a
+ * worker thread as soon as the file is opened. indexed() is emitted when it
+ * is ready, until then currentLine() is -1 and currentPath() is empty.
+ */
+class XmlMappedView : public QWidget
+{
+  Q_OBJECT
+public:
+  //! The approximate number of bytes decoded into the editor.
+  static const qint64 WINDOW_BYTES = 256 * 1024;
+
+  explicit XmlMappedView(QWidget* parent = nullptr);
+  ~XmlMappedView();
+
+  //! Maps filename and shows its start. Returns false if it cannot be mapped.
+  bool openFile(const QString& filename);
+  //! Closes the file and clears the view.
+  void closeFile();
+
+  //! Returns the mapped document.
+  const XmlMappedDocument* mappedDocument() const;
+  //! Returns the editor that shows the window.
+  QPlainTextEdit* editor() const;
+  //! Returns the highlighter of the window.
+  XmlHighlighter* highlighter() const;
+
+  //! Returns the file offset of the first byte in the window.
+  qint64 windowStart() const;
+  //! Returns the file offset one past the last byte in the window.
+  qint64 windowEnd() const;
+
+  //! Returns the file offset of the text cursor.
+  qint64 cursorOffset() const;
+  //! Returns the zero based line of the text cursor, -1 until indexed.
+  qint64 currentLine() const;
+  //! Returns the names of the elements enclosing the text cursor, outermost
+  //! first. Empty until indexed.
+  QStringList currentPath() const;
+
+  //! Shows the line holding offset and moves the text cursor to it.
+  void scrollToOffset(qint64 offset);
+  //! Shows the zero based line. Returns false until the file is indexed.
+  bool gotoLine(qint64 line);
+
+signals:
+  //! Emitted when the line and element index of the file is ready.
+  void indexed();
+  //! Emitted when the text cursor moves, offset is a file offset.
+  void cursorOffsetChanged(qint64 offset);
+
+private:
+  XmlMappedDocument* m_mapped;
+  QPlainTextEdit* m_editor;
+  XmlHighlighter* m_highlighter;
+  QScrollBar* m_fileScrollBar;
+  QThread* m_indexThread = nullptr;
+  std::atomic<bool> m_cancelIndex{ false };
+
+  qint64 m_windowStart = 0;
+  qint64 m_windowEnd = 0;
+  //! The file offset of every block of the window.
+  QVector<qint64> m_blockOffsets;
+  bool m_moving = false;
+
+  static const int SCROLL_STEPS = 1 << 20;
+
+  void loadWindow(qint64 around);
+  void editorScrolled(int value);
+  void fileScrolled(int value);
+  void updateFileScrollBar();
+  qint64 offsetAt(int position) const;
+  int positionAt(qint64 offset) const;
+  qint64 topOffset() const;
+  void showOffsetAtTop(qint64 offset);
+  void stopIndexing();
+};
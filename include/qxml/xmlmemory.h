@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QString>
+#include <QTextCursor>
+#include <QVector>
+
+/*
+ * The estimates behind the memoryUsage() functions of the parser, the
+ * highlighter, the format runs and the document. The heap is not hooked,
+ * the sizes are worked out from the capacities of the containers and these
+ * rough overheads, the same everywhere.
+ */
+namespace XmlMemory {
+
+//! What the allocator adds to every block.
+constexpr qint64 ALLOCATION_BYTES = 16;
+//! The header of the shared data of a QString or a QVector.
+constexpr qint64 ARRAY_HEADER_BYTES = 24;
+//! A std::make_shared control block, the counts and the vtable.
+constexpr qint64 CONTROL_BYTES = 16;
+//! A positioned QTextCursor, its private data and the pointer the document
+//! keeps to it.
+constexpr qint64 CURSOR_BYTES = 96;
+
+//! Returns the heap taken by the data of an array of capacity elements of
+//! size bytes, nothing for none.
+inline qint64
+arrayBytes(qint64 capacity, qint64 size)
+{
+  if (capacity <= 0)
+    return 0;
+  return capacity * size + ARRAY_HEADER_BYTES + ALLOCATION_BYTES;
+}
+
+//! Returns the heap taken by a QString of length UTF-16 code units.
+inline qint64
+stringBytes(qint64 length)
+{
+  return arrayBytes(length, qint64(sizeof(QChar)));
+}
+
+//! Returns the heap taken by string.
+inline qint64
+stringBytes(const QString& string)
+{
+  return stringBytes(qint64(string.capacity()));
+}
+
+//! Returns the heap taken by the elements of vector, not by what they point
+//! to.
+template<typename T>
+qint64
+vectorBytes(const QVector<T>& vector)
+{
+  return arrayBytes(qint64(vector.capacity()), qint64(sizeof(T)));
+}
+
+//! Returns the heap taken by cursor, nothing until it is positioned.
+inline qint64
+cursorBytes(const QTextCursor& cursor)
+{
+  return cursor.isNull() ? 0 : CURSOR_BYTES;
+}
+
+} // namespace XmlMemory
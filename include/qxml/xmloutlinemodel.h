@@ -0,0 +1,103 @@
+#pragma once
+
+#include <QAbstractItemModel>
+#include <QStringList>
+
+#include <memory>
+#include <vector>
+
+#include "qxml/xmlsnapshot.h"
+
+class XmlDocument;
+
+/*!
+ * \ingroup widgets
+ * \class XmlOutlineModel xmloutlinemodel.h "include/qxml/xmloutlinemodel.h"
+ * \brief A lazily populated outline of the elements of a document.
+ *
+ * The model shows one row per element, labelled with its name and key
+ * attributes, see setKeyAttributes(). It is built from XmlSnapshot versions
+ * of the tree. Rows are created only when a view expands their parent, see
+ * canFetchMore() and fetchMore(), and then in batches of FETCH_BATCH.
+ *
+ * When a new snapshot arrives only the subtrees that changed are visited,
+ * those the snapshots share are skipped. Rows of elements that are still
+ * there keep their indexes, and changed rows are removed or inserted one
+ * range at a time. The model is never reset.
+ */
+class XmlOutlineModel : public QAbstractItemModel
+{
+  Q_OBJECT
+public:
+  //! The number of rows fetchMore() adds at a time.
+  static const int FETCH_BATCH = 1000;
+
+  //! The roles the model provides beside Qt::DisplayRole and
+  //! Qt::ToolTipRole.
+  enum Roles
+  {
+    //! The text position of the start of the element.
+    PositionRole = Qt::UserRole,
+    //! The element name.
+    NameRole,
+  };
+
+  explicit XmlOutlineModel(QObject* parent = nullptr);
+  ~XmlOutlineModel();
+
+  //! Follows the snapshots document publishes, null stops following.
+  void setDocument(XmlDocument* document);
+  //! Updates the model to snapshot, null removes every row.
+  void setSnapshot(const XmlSnapshot::Ptr& snapshot);
+
+  //! Returns the names of the attributes shown beside element names.
+  const QStringList& keyAttributes() const;
+  //! Sets the names of the attributes shown beside element names.
+  void setKeyAttributes(const QStringList& names);
+
+  //! Returns the text position of the start of the element at index, -1 for
+  //! an invalid index.
+  int position(const QModelIndex& index) const;
+
+  QModelIndex index(int row,
+                    int column,
+                    const QModelIndex& parent = QModelIndex()) const override;
+  QModelIndex parent(const QModelIndex& index) const override;
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+  bool hasChildren(const QModelIndex& parent = QModelIndex()) const override;
+  bool canFetchMore(const QModelIndex& parent) const override;
+  void fetchMore(const QModelIndex& parent) override;
+  QVariant data(const QModelIndex& index,
+                int role = Qt::DisplayRole) const override;
+
+private:
+  struct Item
+  {
+    Item* parent = nullptr;
+    int row = 0;
+    //! The offset from the start of the parent element.
+    int offset = 0;
+    XmlSnapshotNode::Ptr node;
+    //! The indexes in node->children of the element children, built when
+    //! first needed.
+    std::vector<int> elements;
+    bool indexed = false;
+    //! The rows fetched so far, the first of the element children.
+    std::vector<std::unique_ptr<Item>> children;
+  };
+
+  Item m_root;
+  QStringList m_keyAttributes;
+  QMetaObject::Connection m_documentConnection;
+
+  Item* itemFor(const QModelIndex& index) const;
+  QModelIndex indexFor(Item* item) const;
+  static void indexElements(Item* item);
+  QString label(const XmlSnapshotNode& node) const;
+  void labelsChanged(Item* item);
+  void update(Item* item, const XmlSnapshotNode::Ptr& node);
+  void updateChild(Item* item, int row, int element);
+  void insertItems(Item* item, int row, int count, int firstElement);
+  void removeItems(Item* item, int row, int count);
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace XmlScannerTables {
+
+enum Class : uint8_t
+{
+  NameStart = 0x1,
+  Name = 0x2,
+};
+
+constexpr uint8_t
+asciiClass(char32_t c)
+{
+  uint8_t result = 0;
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+      c == ':')
+    result |= NameStart | Name;
+  if ((c >= '0' && c <= '9') || c == '-' || c == '.')
+    result |= Name;
+  return result;
+}
+
+struct Table
+{
+  uint8_t classes[128];
+
+  constexpr uint8_t operator[](char32_t c) const { return classes[c]; }
+};
+
+constexpr Table
+makeTable()
+{
+  Table table{};
+  for (char32_t c = 0; c < 128; ++c)
+    table.classes[c] = asciiClass(c);
+  return table;
+}
+
+//! The character classes of ASCII, generated at compile time.
+inline constexpr Table ASCII = makeTable();
+
+} // namespace XmlScannerTables
+
+/*!
+ * \ingroup widgets
+ * \class XmlScanner xmlscanner.h "include/qxml/xmlscanner.h"
+ * \brief Finds markup characters in UTF-16 or UTF-8 text a vector at a time.
+ *
+ * A scanner looks for a set of up to eight ASCII characters, by default the
+ * XML structural characters < > & " ' and newline. The ends of ]]> and -->
+ * are found through their >. Every character of the set is compared against
+ * 8 to 32 code units per instruction with SSE2 or AVX2 on x86 and NEON on
+ * ARM. The instruction set is chosen once at runtime, with a scalar loop
+ * where none is available. ASCII never occurs inside a multi byte UTF-8
+ * sequence or a UTF-16 surrogate, so no decoding is needed.
+ *
+ * \code
+ *  static const XmlScanner newlines("\n");
+ *  std::vector<uint32_t> offsets;
+ *  newlines.scan(reinterpret_cast<const char16_t*>(text.utf16()),
+ *                text.length(), offsets);
+ * \endcode
+ *
+ * The class has no Qt dependency.
+ */
+class XmlScanner
+{
+public:
+  /*!
+   * \enum XmlScanner::Isa
+   *
+   * The instruction sets the scanner can use.
+   */
+  enum Isa
+  {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+  };
+
+  //! The XML structural characters.
+  static constexpr const char* STRUCTURAL = "<>&\"'\n";
+
+  //! Creates a scanner for the ASCII characters in chars, at most eight.
+  explicit XmlScanner(const char* chars = STRUCTURAL);
+
+  //! Appends the offset plus base of every matching code unit in data to
+  //! offsets, in ascending order.
+  void scan(const char16_t* data,
+            size_t length,
+            std::vector<uint32_t>& offsets,
+            uint32_t base = 0) const;
+  //! Appends the offset plus base of every matching byte in data to offsets,
+  //! in ascending order.
+  void scan(const char* data,
+            size_t length,
+            std::vector<uint32_t>& offsets,
+            uint32_t base = 0) const;
+
+  //! Returns the offset of the first match at or after from, or length if
+  //! there is none.
+  size_t find(const char16_t* data, size_t length, size_t from = 0) const;
+  //! Returns the offset of the first match at or after from, or length if
+  //! there is none.
+  size_t find(const char* data, size_t length, size_t from = 0) const;
+
+  //! Returns the instruction set in use.
+  static Isa isa();
+  //! Returns the name of isa, "scalar", "sse2", "avx2" or "neon".
+  static const char* isaName(Isa isa);
+  //! Forces the instruction set, for benchmarks and checks. An instruction
+  //! set the processor does not have falls back to the best it has.
+  static void setIsa(Isa isa);
+
+  //! Returns true if c is an XML NameStartChar.
+  static constexpr bool isNameStartChar(char32_t c)
+  {
+    using namespace XmlScannerTables;
+    return c < 0x80 ? (ASCII[c] & NameStart) != 0
+                    : (c >= 0xC0 && c <= 0xD6) || (c >= 0xD8 && c <= 0xF6) ||
+                        (c >= 0xF8 && c <= 0x2FF) ||
+                        (c >= 0x370 && c <= 0x37D) ||
+                        (c >= 0x37F && c <= 0x1FFF) ||
+                        (c >= 0x200C && c <= 0x200D) ||
+                        (c >= 0x2070 && c <= 0x218F) ||
+                        (c >= 0x2C00 && c <= 0x2FEF) ||
+                        (c >= 0x3001 && c <= 0xD7FF) ||
+                        (c >= 0xF900 && c <= 0xFDCF) ||
+                        (c >= 0xFDF0 && c <= 0xFFFD) ||
+                        (c >= 0x10000 && c <= 0xEFFFF);
+  }
+
+  //! Returns true if c is an XML NameChar.
+  static constexpr bool isNameChar(char32_t c)
+  {
+    using namespace XmlScannerTables;
+    return c < 0x80 ? (ASCII[c] & Name) != 0
+                    : isNameStartChar(c) || c == 0xB7 ||
+                        (c >= 0x300 && c <= 0x36F) ||
+                        (c >= 0x203F && c <= 0x2040);
+  }
+
+private:
+  char m_chars[8] = {};
+  int m_count = 0;
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+#include "qxml/xmleventparser.h"
+
+/*!
+ * \brief An attribute of an XmlSnapshotNode, offsets are relative to the
+ * start of the node.
+ */
+struct XmlSnapshotAttribute
+{
+  QString name;
+  QString value;
+  int nameOffset = -1;
+  //! -1 if the attribute has no value.
+  int valueOffset = -1;
+};
+
+class XmlSnapshotNode;
+
+/*!
+ * \ingroup widgets
+ * \class XmlSnapshotChildren xmlsnapshot.h "include/qxml/xmlsnapshot.h"
+ * \brief The children of an XmlSnapshotNode, ordered by offset.
+ *
+ * The children are kept in chunks of up to CHUNK that snapshots share. A
+ * chunk holds the offsets of its children from a base kept in the table, so
+ * the chunks before and after an edit are taken over as they are, those
+ * after it with their base moved. Building the ancestors of a change then
+ * takes a pass over their chunks rather than over their children.
+ */
+class XmlSnapshotChildren
+{
+public:
+  //! The most children a chunk is filled with.
+  static const int CHUNK = 64;
+
+  using NodePtr = std::shared_ptr<const XmlSnapshotNode>;
+
+  //! A child and its offset from the start of the parent, valid for as
+  //! long as the table it was read from.
+  struct Entry
+  {
+    int offset;
+    const NodePtr& node;
+  };
+
+private:
+  struct Child
+  {
+    int offset = 0;
+    NodePtr node;
+  };
+  struct Chunk
+  {
+    std::vector<Child> children;
+    //! The end of the last child, from the base.
+    int end = 0;
+    //! The nodes and the heap of the subtrees of the children.
+    int nodeCount = 0;
+    qint64 bytes = 0;
+  };
+  struct Piece
+  {
+    int base = 0;
+    //! The index of the first child of the chunk in the table.
+    size_t first = 0;
+    std::shared_ptr<const Chunk> chunk;
+  };
+
+public:
+  class const_iterator
+  {
+  public:
+    Entry operator*() const;
+    const_iterator& operator++();
+    bool operator==(const const_iterator& other) const;
+    bool operator!=(const const_iterator& other) const;
+
+  private:
+    friend class XmlSnapshotChildren;
+    const std::vector<Piece>* m_pieces = nullptr;
+    size_t m_piece = 0;
+    size_t m_index = 0;
+  };
+
+  size_t size() const;
+  bool empty() const;
+  Entry operator[](size_t index) const;
+  const_iterator begin() const;
+  const_iterator end() const;
+  //! Returns the index of the first child whose offset is greater than
+  //! offset, size() if there is none.
+  size_t upperBound(int offset) const;
+  //! Returns true if the children are the same nodes at the same offsets.
+  bool isSameAs(const XmlSnapshotChildren& other) const;
+
+  //! Returns the number of nodes in the subtrees of the children.
+  int nodeCount() const;
+  //! Returns the heap the subtrees of the children take, see
+  //! XmlSnapshotNode::bytes.
+  qint64 subtreeBytes() const;
+  //! Returns the heap the table and its chunks take.
+  qint64 tableBytes() const;
+
+  //! Appends a child, for building the table.
+  void append(int offset, const NodePtr& node);
+  //! Returns the number of chunks.
+  size_t chunkCount() const;
+  //! Returns the index in the table of the first child of chunk.
+  size_t chunkFirst(size_t chunk) const;
+  //! Returns the offset of the first child of chunk.
+  int chunkStart(size_t chunk) const;
+  //! Returns the end of the last child of chunk.
+  int chunkEnd(size_t chunk) const;
+  //! \brief Appends the chunks of other from first up to last, with their
+  //! offsets moved by shift, for building the table.
+  //!
+  //! A large chunk is shared, the children of a small one are copied so that
+  //! edits do not leave the table in ever smaller pieces.
+  void appendChunks(const XmlSnapshotChildren& other,
+                    size_t first,
+                    size_t last,
+                    int shift);
+
+private:
+  std::vector<Piece> m_pieces;
+  //! The chunk being filled by append(), also that of the last piece.
+  std::shared_ptr<Chunk> m_open;
+  size_t m_size = 0;
+  int m_nodeCount = 0;
+  qint64 m_subtreeBytes = 0;
+
+  size_t pieceOf(size_t index) const;
+};
+
+/*!
+ * \ingroup widgets
+ * \class XmlSnapshotNode xmlsnapshot.h "include/qxml/xmlsnapshot.h"
+ * \brief An immutable node of an XmlSnapshot.
+ *
+ * A node holds no absolute position. Every offset in it is relative to its
+ * own start, and the offset of each child is kept by the parent. A subtree
+ * that an edit only moves is therefore unchanged and is shared by the
+ * snapshots before and after the edit.
+ */
+class XmlSnapshotNode
+{
+public:
+  using Ptr = std::shared_ptr<const XmlSnapshotNode>;
+
+  /*!
+   * \enum XmlSnapshotNode::Kind
+   *
+   * The kinds of snapshot node.
+   */
+  enum Kind
+  {
+    Document,    //!< The whole text, the top level nodes are its children.
+    Declaration, //!< The xml declaration.
+    Element,     //!< An element, from its start tag to its end tag.
+    Text,        //!< Element text.
+    CData,       //!< A CDATA section.
+    Comment,     //!< A comment.
+    Instruction, //!< A processing instruction.
+  };
+
+  //! A child and its offset from the start of the parent.
+  using Child = XmlSnapshotChildren::Entry;
+
+  Kind kind = Document;
+  //! The element name, the processing instruction target or "xml".
+  QString name;
+  //! The text, comment, CDATA or processing instruction data.
+  QString content;
+  //! The length of the node in the text.
+  int length = 0;
+  //! The offset of the name, -1 if the node has none.
+  int nameOffset = -1;
+  //! The offset of the content, -1 if the node has none.
+  int contentOffset = -1;
+  //! The length of the start tag of an element.
+  int startTagLength = 0;
+  //! The offset of the end tag of an element, -1 if it has none.
+  int endTagOffset = -1;
+  //! The number of nodes in this subtree, this one included.
+  int size = 1;
+  //! An estimate of the heap this subtree takes, this node included. A
+  //! subtree shared with other snapshots counts in each.
+  qint64 bytes = 0;
+  //! The structural hash of the subtree, see Node::hash. That of the
+  //! Document node covers the top level nodes.
+  quint64 hash = 0;
+  std::vector<XmlSnapshotAttribute> attributes;
+  XmlSnapshotChildren children;
+};
+
+/*!
+ * \ingroup widgets
+ * \class XmlSnapshot xmlsnapshot.h "include/qxml/xmlsnapshot.h"
+ * \brief An immutable, reference counted version of the node tree.
+ *
+ * XmlDocument builds a snapshot after every successful parse. Any thread can
+ * then take it with XmlDocument::snapshot() and read it without locking for
+ * as long as it holds the pointer, while the editor goes on parsing.
+ *
+ * A snapshot is built from the previous one. Subtrees outside the text that
+ * changed are taken over from it, so building a version allocates only the
+ * nodes that changed and their ancestors. Subtrees inside the changed text
+ * whose hash, content and layout match are taken over as well, so after
+ * the text has been replaced by a slightly different one the unchanged
+ * subtrees are still the same nodes.
+ *
+ * The ancestors of a change take over the chunks of their child tables
+ * that lie outside it, see XmlSnapshotChildren. An edit in one of a million
+ * records under the root element builds that record, the chunk it is in
+ * and a table of the root's chunks, not a table of a million children.
+ */
+class XmlSnapshot
+{
+public:
+  using Ptr = std::shared_ptr<const XmlSnapshot>;
+
+  //! A node and its position in the text.
+  struct Located
+  {
+    const XmlSnapshotNode* node = nullptr;
+    int start = -1;
+  };
+
+  //! \brief Builds the snapshot of the last successful parse of parser.
+  //!
+  //! length is the text length and revision the document revision. Where
+  //! previous is given, changed has to hold every text position whose text
+  //! or nodes differ from previous, in positions of the new text, and have a
+  //! from of -1 if none do. Nodes wholly outside it are shared with previous.
+  static Ptr build(const XmlEventParser& parser,
+                   int length,
+                   int revision,
+                   const Ptr& previous = Ptr(),
+                   XmlEventParser::TextRange changed = {});
+
+  //! Returns the Document node.
+  const XmlSnapshotNode& root() const;
+  //! Returns the Document node, for sharing it.
+  const XmlSnapshotNode::Ptr& rootPtr() const;
+  //! Returns the text length.
+  int length() const;
+  //! Returns the document revision the snapshot was built from.
+  int revision() const;
+  //! Returns the version, which increases with every snapshot built.
+  quint64 version() const;
+  //! Returns the number of nodes, the Document node excluded.
+  int nodeCount() const;
+
+  //! Returns the innermost node that holds position, the Document node if
+  //! no other does.
+  Located nodeAt(int position) const;
+  //! Returns the nodes that hold position, outermost first, the Document
+  //! node excluded.
+  std::vector<Located> pathAt(int position) const;
+
+private:
+  XmlSnapshotNode::Ptr m_root;
+  int m_revision = -1;
+  quint64 m_version = 0;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+/*!
+ * \ingroup widgets
+ * \class XmlSoftReformatter xmlsoftreformatter.h "include/qxml/xmlsoftreformatter.h"
+ * \brief Inserts soft line breaks into text with long lines, a chunk at a
+ * time.
+ *
+ * A minified document is a single block, which QTextLayout has to lay out
+ * and the highlighter has to format as a whole on every change. Once a line
+ * longer than the threshold has been seen, a break is inserted between tags
+ * every few hundred characters. A break only goes where whitespace does not
+ * count: right after the > of a tag, before the < of the next markup, in an
+ * element without xml:space="preserve" that has had no text so far. The
+ * lexical state is followed as in XmlHighlighter::LexicalMode so that a > in
+ * an attribute value, a comment, a CDATA section or an instruction is not
+ * taken for one.
+ *
+ * XmlEdit::setText() gives it the whole text at once with breaking on from
+ * the start, XmlFileLoader gives it each chunk as it is read.
+ */
+class XmlSoftReformatter
+{
+public:
+  //! The column from which a break is inserted.
+  static const int SOFT_WIDTH = 200;
+
+  //! Breaks lines once one is longer than threshold, never if it is 0.
+  explicit XmlSoftReformatter(int threshold);
+
+  //! Inserts breaks from the start of the text, whatever its lines.
+  void setBreaking(bool breaking);
+
+  //! \brief Returns the next part of the text shown with its breaks.
+  //!
+  //! The last few characters of text are held back until the next chunk,
+  //! the markup they start cannot be told yet. last gives them back.
+  QString reformat(QStringView text, bool last);
+
+  //! Returns the positions of the breaks in the shown text, ascending.
+  const QVector<int>& softBreaks() const;
+
+private:
+  //! The construct the text is inside.
+  enum State
+  {
+    InContent,
+    InTag,
+    InTagDoubleQuote,
+    InTagSingleQuote,
+    InDoctype,
+    InComment,
+    InCData,
+    InProcessingInstruction,
+  };
+
+  //! An open element.
+  struct Element
+  {
+    //! xml:space="preserve" is in effect.
+    bool preserve = false;
+    //! Text other than whitespace has been seen in it, so it may be mixed
+    //! content where whitespace counts.
+    bool mixed = false;
+  };
+
+  //! The longest markup start, <![CDATA[.
+  static const int LOOKAHEAD = 9;
+
+  int m_threshold;
+  bool m_breaking = false;
+  QString m_pending;
+  QVector<int> m_softBreaks;
+  // the prolog and epilog are outside any element.
+  QVector<Element> m_elements{ Element() };
+  State m_state = InContent;
+  //! The start tag or end tag being read.
+  QString m_tag;
+  //! The length of the markup read so far and its last two characters.
+  int m_markupLength = 0;
+  QChar m_previous[2];
+  int m_doctypeDepth = 0;
+  int m_column = 0;
+  int m_shownLength = 0;
+
+  static int xmlSpaceOf(QStringView tag);
+};
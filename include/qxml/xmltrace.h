@@ -0,0 +1,124 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+/*!
+ * \ingroup widgets
+ * \class XmlTrace xmltrace.h "include/qxml/xmltrace.h"
+ * \brief Collects scoped timing events in the Chrome trace-event format.
+ *
+ * The parser and editor hot paths are wrapped in QXML_TRACE_SCOPE(name)
+ * markers. These are compiled out completely unless the library is built with
+ * the QXML_TRACE CMake option, which defines QXML_TRACE_ENABLED.
+ *
+ * Collection is also switched off at runtime by default. Call
+ * setEnabled(true) before the work you want to examine and write(filename)
+ * afterwards, then load the file into chrome://tracing or
+ * https://ui.perfetto.dev to see every stage on a per-thread timeline.
+ *
+ * \code
+ *  XmlTrace::instance()->setEnabled(true);
+ *  editor->loadFile("big.xml");
+ *  XmlTrace::instance()->write("big.trace.json");
+ * \endcode
+ */
+class XmlTrace
+{
+public:
+  //! A single complete ("ph":"X") trace event.
+  struct Event
+  {
+    //! The event name. Must be a string literal or otherwise outlive the
+    //! trace.
+    const char* name = nullptr;
+    //! Start time in nanoseconds since the trace clock was started.
+    qint64 start = 0;
+    //! Duration in nanoseconds.
+    qint64 duration = 0;
+    //! Small sequential id of the recording thread.
+    int threadId = 0;
+  };
+
+  //! Returns the process wide trace collector.
+  static XmlTrace* instance();
+
+  //! Returns true if events are currently being recorded.
+  bool isEnabled() const;
+  //! Starts or stops recording events.
+  void setEnabled(bool enabled);
+
+  //! Removes all recorded events.
+  void clear();
+
+  //! Returns the number of recorded events.
+  int count() const;
+
+  //! Returns the nanoseconds elapsed on the trace clock.
+  qint64 now() const;
+
+  //! Records a complete event. Normally called by XmlTraceScope.
+  void addEvent(const char* name, qint64 start, qint64 duration);
+
+  //! Returns the recorded events as a Chrome trace-event JSON document.
+  QByteArray toJson() const;
+
+  //! Writes the recorded events to filename in the Chrome trace-event JSON
+  //! format. Returns true if the file was written.
+  bool write(const QString& filename) const;
+
+private:
+  XmlTrace();
+
+  struct ThreadName
+  {
+    int threadId;
+    QString name;
+  };
+
+  QElapsedTimer m_clock;
+  std::atomic<bool> m_enabled;
+  mutable QMutex m_mutex;
+  QVector<Event> m_events;
+  QVector<ThreadName> m_threadNames;
+
+  int currentThreadId();
+};
+
+/*!
+ * \class XmlTraceScope xmltrace.h "include/qxml/xmltrace.h"
+ * \brief Records the lifetime of the scope as a single trace event.
+ *
+ * Use the QXML_TRACE_SCOPE(name) macro rather than this class directly so that
+ * the marker disappears when tracing is not compiled in.
+ */
+class XmlTraceScope
+{
+public:
+  explicit XmlTraceScope(const char* name);
+  ~XmlTraceScope();
+
+  XmlTraceScope(const XmlTraceScope&) = delete;
+  XmlTraceScope& operator=(const XmlTraceScope&) = delete;
+
+private:
+  const char* m_name;
+  qint64 m_start;
+};
+
+#define QXML_TRACE_CONCAT_(a, b) a##b
+#define QXML_TRACE_CONCAT(a, b) QXML_TRACE_CONCAT_(a, b)
+
+#if defined(QXML_TRACE_ENABLED)
+#define QXML_TRACE_SCOPE(name)                                                 \
+  XmlTraceScope QXML_TRACE_CONCAT(qxmlTraceScope, __LINE__)(name)
+#else
+#define QXML_TRACE_SCOPE(name)                                                 \
+  do {                                                                         \
+  } while (false)
+#endif
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <QDateTime>
+#include <QHash>
+#include <QMetaType>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+#include "qxml/xmlsnapshot.h"
+
+struct _xmlDtd;
+struct _xmlSchema;
+
+/*!
+ * \brief A validation error, placed on the node it is about.
+ */
+struct XmlValidationError
+{
+  //! The start tag or end tag the error is on, -1 if it cannot be placed.
+  int position = -1;
+  int length = 0;
+  //! The line and column in the text given to XmlValidator::validateText(),
+  //! 1 based, 0 if libxml gave none or for a snapshot.
+  int line = 0;
+  int column = 0;
+  bool warning = false;
+  QString message;
+};
+using XmlValidationErrors = QVector<XmlValidationError>;
+
+Q_DECLARE_METATYPE(XmlValidationError)
+
+/*!
+ * \ingroup widgets
+ * \class XmlSchema xmlvalidator.h "include/qxml/xmlvalidator.h"
+ * \brief A compiled XML Schema or DTD, see XmlSchemaCache.
+ *
+ * A compiled schema is never changed once built, so any number of
+ * validations on any threads can share it.
+ */
+class XmlSchema
+{
+public:
+  using Ptr = std::shared_ptr<const XmlSchema>;
+
+  /*!
+   * \enum XmlSchema::Type
+   *
+   * The kinds of schema.
+   */
+  enum Type
+  {
+    Xsd, //!< A W3C XML Schema.
+    Dtd, //!< An external DTD.
+  };
+
+  ~XmlSchema();
+
+  //! Returns Dtd for a location ending in .dtd, Xsd otherwise.
+  static Type typeOf(const QString& location);
+
+  Type type() const;
+  //! Returns the path or URL the schema was compiled from.
+  const QString& location() const;
+  //! Returns the modification time of the file when it was compiled,
+  //! invalid for a URL.
+  const QDateTime& modified() const;
+
+private:
+  friend class XmlSchemaCache;
+  friend class XmlValidator;
+
+  XmlSchema() = default;
+
+  Type m_type = Xsd;
+  QString m_location;
+  QDateTime m_modified;
+  _xmlSchema* m_schema = nullptr;
+  _xmlDtd* m_dtd = nullptr;
+  //! libxml does not promise that a DTD can be validated against by two
+  //! threads at once, compiled XML Schemas it does.
+  mutable QMutex m_dtdMutex;
+};
+
+/*!
+ * \ingroup widgets
+ * \class XmlSchemaCache xmlvalidator.h "include/qxml/xmlvalidator.h"
+ * \brief The process wide cache of compiled schemas.
+ *
+ * Schemas are compiled once and shared by every document, editor and
+ * thread that validates against them. They are keyed by type and location,
+ * canonical for a file, and a file is compiled again if it has been
+ * modified since. A URL is kept until clear().
+ *
+ * All of it may be called from any thread.
+ */
+class XmlSchemaCache
+{
+public:
+  //! Returns the cache.
+  static XmlSchemaCache& instance();
+
+  //! \brief Returns the schema at location, compiling it if it is not in
+  //! the cache or has been modified.
+  //!
+  //! Returns null and sets error, if given, if it cannot be compiled.
+  XmlSchema::Ptr schema(const QString& location,
+                        XmlSchema::Type type,
+                        QString* error = nullptr);
+  //! Returns the schema at location, of the type XmlSchema::typeOf() gives.
+  XmlSchema::Ptr schema(const QString& location, QString* error = nullptr);
+
+  //! Returns the number of schemas in the cache.
+  int size() const;
+  //! Drops every schema, those still used live on until they are done with.
+  void clear();
+
+private:
+  XmlSchemaCache();
+
+  mutable QMutex m_mutex;
+  QHash<QString, XmlSchema::Ptr> m_schemas;
+
+  static XmlSchema::Ptr compile(const QString& location,
+                                XmlSchema::Type type,
+                                const QDateTime& modified,
+                                QString* error);
+};
+
+/*!
+ * \ingroup widgets
+ * \class XmlValidator xmlvalidator.h "include/qxml/xmlvalidator.h"
+ * \brief Validates snapshots and texts against a schema, on a worker
+ * thread.
+ *
+ * Move it to a QThread and call validate() with a queued invocation, the
+ * errors come back through validated(). The validation only reads the
+ * snapshot, so the text can be edited meanwhile, and cancel() stops it at
+ * the next chunk that libxml reads.
+ *
+ * A snapshot is written out as UTF-8 with a line break inside every tag,
+ * so that the line libxml reports identifies the tag and the error can be
+ * placed on the node. The XML declaration is left out, the text is always
+ * UTF-8. XML Schema validation streams the text, DTD validation has to
+ * build the libxml tree first.
+ *
+ * validateSnapshot() and validateText() validate on the calling thread, for
+ * batches that run their own threads.
+ */
+class XmlValidator : public QObject
+{
+  Q_OBJECT
+public:
+  explicit XmlValidator(QObject* parent = nullptr);
+
+  //! Validates snapshot against the schema at location, from the cache, and
+  //! emits validated() with generation. A schema that cannot be compiled is
+  //! reported as a single error.
+  void validate(const XmlSnapshot::Ptr& snapshot,
+                const QString& location,
+                int generation);
+  //! Stops the current validation at the next chunk, it emits nothing. May
+  //! be called from any thread.
+  void cancel();
+
+  //! Returns the errors of snapshot against schema, positions are in the
+  //! text of the snapshot.
+  static XmlValidationErrors validateSnapshot(
+    const XmlSnapshot& snapshot,
+    const XmlSchema& schema,
+    const std::atomic<bool>* cancel = nullptr);
+  //! Returns the errors of text against schema, positions are in text.
+  static XmlValidationErrors validateText(
+    const QString& text,
+    const XmlSchema& schema,
+    const std::atomic<bool>* cancel = nullptr);
+
+signals:
+  //! Emitted when a validation has finished, revision is that of the text
+  //! of the snapshot.
+  void validated(int generation,
+                 int revision,
+                 const XmlValidationErrors& errors);
+
+private:
+  std::atomic<bool> m_cancel{ false };
+};
@@ -0,0 +1,488 @@
+#include "qxml/xmldiff.h"
+#include "qxml/xmleventparser.h"
+#include "qxml/xmltrace.h"
+
+#include <QFile>
+#include <QHash>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Operation = XmlDiff::Operation;
+
+bool
+isWhitespace(const XmlSnapshotNode& node)
+{
+  return node.kind == XmlSnapshotNode::Text && node.content.trimmed().isEmpty();
+}
+
+//! Returns text with its line ends as a QTextDocument holds them: CR LF, CR
+//! and the paragraph separator each make one LF.
+QString
+documentText(const QString& text)
+{
+  QString plain;
+  plain.reserve(text.length());
+  auto length = int(text.length());
+  for (auto i = 0; i < length; ++i) {
+    auto c = text.at(i);
+    if (c == '\r') {
+      if (i + 1 < length && text.at(i + 1) == '\n')
+        ++i;
+      c = '\n';
+    } else if (c == QChar::ParagraphSeparator) {
+      c = '\n';
+    }
+    plain += c;
+  }
+  return plain;
+}
+
+//! Returns the positions in documentText() of text before which it has
+//! dropped the CR of a CR LF pair, ascending.
+std::vector<int>
+droppedCarriageReturns(const QString& text)
+{
+  std::vector<int> dropped;
+  auto length = int(text.length());
+  for (auto i = 0; i + 1 < length; ++i) {
+    if (text.at(i) == '\r' && text.at(i + 1) == '\n')
+      dropped.push_back(i - int(dropped.size()));
+  }
+  return dropped;
+}
+
+//! Maps position and length in the document text back to the file text.
+void
+toFilePosition(const std::vector<int>& dropped, int& position, int& length)
+{
+  if (position < 0 || dropped.empty())
+    return;
+  auto before = [&dropped](int p) {
+    return int(std::lower_bound(dropped.cbegin(), dropped.cend(), p) -
+               dropped.cbegin());
+  };
+  auto end = position + length;
+  end += before(end);
+  position += before(position);
+  length = end - position;
+}
+
+/*
+ * Builds the edit script of one comparison. Node edits record the subtree
+ * hash so that a deletion and an insertion of the same subtree can be
+ * turned into a move at the end.
+ */
+class Differ
+{
+public:
+  XmlDiff::Script script;
+
+  void compareNodes(const XmlSnapshotNode& a,
+                    int aStart,
+                    const XmlSnapshotNode& b,
+                    int bStart,
+                    const QString& path);
+  void finishMoves();
+
+private:
+  //! The hash of the subtree of each node edit, 0 for the others.
+  std::vector<quint64> m_hashes;
+
+  void compareAttributes(const XmlSnapshotNode& a,
+                         int aStart,
+                         const XmlSnapshotNode& b,
+                         int bStart,
+                         const QString& path);
+  void compareChildren(const XmlSnapshotNode& a,
+                       int aStart,
+                       const XmlSnapshotNode& b,
+                       int bStart,
+                       const QString& path);
+  void addNode(Operation::Type type,
+               const XmlSnapshotNode& node,
+               int start,
+               const QString& path);
+  void addMove(const XmlSnapshotNode& node,
+               int aStart,
+               int bStart,
+               const QString& path);
+  Operation& add(Operation::Type type,
+                 XmlSnapshotNode::Kind kind,
+                 const QString& name,
+                 const QString& path,
+                 quint64 hash = 0);
+  static std::vector<bool> longestIncreasing(const std::vector<int>& values);
+};
+
+Operation&
+Differ::add(Operation::Type type,
+            XmlSnapshotNode::Kind kind,
+            const QString& name,
+            const QString& path,
+            quint64 hash)
+{
+  Operation operation;
+  operation.type = type;
+  operation.kind = kind;
+  operation.name = name;
+  operation.path = path;
+  script.append(operation);
+  m_hashes.push_back(hash);
+  return script.last();
+}
+
+void
+Differ::addNode(Operation::Type type,
+                const XmlSnapshotNode& node,
+                int start,
+                const QString& path)
+{
+  auto& operation = add(type, node.kind, node.name, path, node.hash);
+  if (type == Operation::Deleted) {
+    operation.oldPosition = start;
+    operation.oldLength = node.length;
+    operation.oldValue = node.content;
+  } else {
+    operation.newPosition = start;
+    operation.newLength = node.length;
+    operation.newValue = node.content;
+  }
+}
+
+void
+Differ::addMove(const XmlSnapshotNode& node,
+                int aStart,
+                int bStart,
+                const QString& path)
+{
+  auto& operation = add(Operation::Moved, node.kind, node.name, path);
+  operation.oldPosition = aStart;
+  operation.oldLength = node.length;
+  operation.newPosition = bStart;
+  operation.newLength = node.length;
+}
+
+void
+Differ::compareNodes(const XmlSnapshotNode& a,
+                     int aStart,
+                     const XmlSnapshotNode& b,
+                     int bStart,
+                     const QString& path)
+{
+  // equal subtrees, however large, are done with here.
+  if (a.hash == b.hash)
+    return;
+
+  switch (a.kind) {
+    case XmlSnapshotNode::Document:
+      compareChildren(a, aStart, b, bStart, path);
+      break;
+    case XmlSnapshotNode::Declaration:
+      compareAttributes(a, aStart, b, bStart, path);
+      break;
+    case XmlSnapshotNode::Element: {
+      compareAttributes(a, aStart, b, bStart, path);
+      compareChildren(a, aStart, b, bStart, path + '/' + a.name);
+      break;
+    }
+    default: {
+      if (a.content == b.content)
+        break;
+      auto& operation = add(Operation::TextChanged, a.kind, a.name, path);
+      operation.oldValue = a.content;
+      operation.oldPosition = aStart + qMax(0, a.contentOffset);
+      operation.oldLength = int(a.content.length());
+      operation.newValue = b.content;
+      operation.newPosition = bStart + qMax(0, b.contentOffset);
+      operation.newLength = int(b.content.length());
+      break;
+    }
+  }
+}
+
+void
+Differ::compareAttributes(const XmlSnapshotNode& a,
+                          int aStart,
+                          const XmlSnapshotNode& b,
+                          int bStart,
+                          const QString& path)
+{
+  auto extent = [](const XmlSnapshotAttribute& attribute) {
+    // to the closing quote of the value.
+    return attribute.valueOffset >= 0
+             ? attribute.valueOffset + int(attribute.value.length()) + 1 -
+                 attribute.nameOffset
+             : int(attribute.name.length());
+  };
+
+  QHash<QString, const XmlSnapshotAttribute*> remaining;
+  for (const auto& attribute : b.attributes)
+    remaining.insert(attribute.name, &attribute);
+
+  for (const auto& attribute : a.attributes) {
+    auto other = remaining.take(attribute.name);
+    if (!other) {
+      auto& operation =
+        add(Operation::AttributeRemoved, a.kind, attribute.name, path);
+      operation.oldValue = attribute.value;
+      operation.oldPosition = aStart + attribute.nameOffset;
+      operation.oldLength = extent(attribute);
+    } else if (other->value != attribute.value) {
+      auto& operation =
+        add(Operation::AttributeChanged, a.kind, attribute.name, path);
+      operation.oldValue = attribute.value;
+      operation.oldPosition =
+        aStart + qMax(attribute.nameOffset, attribute.valueOffset);
+      operation.oldLength = int(attribute.value.length());
+      operation.newValue = other->value;
+      operation.newPosition =
+        bStart + qMax(other->nameOffset, other->valueOffset);
+      operation.newLength = int(other->value.length());
+    }
+  }
+  // the added ones in their order in the new element.
+  for (const auto& attribute : b.attributes) {
+    if (!remaining.contains(attribute.name))
+      continue;
+    auto& operation =
+      add(Operation::AttributeAdded, b.kind, attribute.name, path);
+    operation.newValue = attribute.value;
+    operation.newPosition = bStart + attribute.nameOffset;
+    operation.newLength = extent(attribute);
+  }
+}
+
+void
+Differ::compareChildren(const XmlSnapshotNode& a,
+                        int aStart,
+                        const XmlSnapshotNode& b,
+                        int bStart,
+                        const QString& path)
+{
+  // whitespace between elements is layout, not content.
+  std::vector<int> x;
+  std::vector<int> y;
+  for (size_t i = 0; i < a.children.size(); ++i) {
+    if (!isWhitespace(*a.children[i].node))
+      x.push_back(int(i));
+  }
+  for (size_t i = 0; i < b.children.size(); ++i) {
+    if (!isWhitespace(*b.children[i].node))
+      y.push_back(int(i));
+  }
+  auto oldChild = [&a, &x](int i) -> XmlSnapshotNode::Child {
+    return a.children[size_t(x[size_t(i)])];
+  };
+  auto newChild = [&b, &y](int j) -> XmlSnapshotNode::Child {
+    return b.children[size_t(y[size_t(j)])];
+  };
+  auto xn = int(x.size());
+  auto yn = int(y.size());
+
+  // most edits leave the ends of a child list alone.
+  auto prefix = 0;
+  while (prefix < xn && prefix < yn &&
+         oldChild(prefix).node->hash == newChild(prefix).node->hash)
+    ++prefix;
+  auto suffix = 0;
+  while (suffix < xn - prefix && suffix < yn - prefix &&
+         oldChild(xn - 1 - suffix).node->hash ==
+           newChild(yn - 1 - suffix).node->hash)
+    ++suffix;
+  auto oldEnd = xn - suffix;
+  auto newEnd = yn - suffix;
+
+  // equal subtrees in between are matched by hash, earliest first.
+  std::vector<int> oldMatch(size_t(xn), -1);
+  std::vector<int> newMatch(size_t(yn), -1);
+  std::unordered_map<quint64, std::vector<int>> byHash;
+  for (auto i = oldEnd - 1; i >= prefix; --i)
+    byHash[oldChild(i).node->hash].push_back(i);
+  std::vector<int> matched;
+  std::vector<int> matchedOld;
+  for (auto j = prefix; j < newEnd; ++j) {
+    auto it = byHash.find(newChild(j).node->hash);
+    if (it == byHash.end() || it->second.empty())
+      continue;
+    auto i = it->second.back();
+    it->second.pop_back();
+    oldMatch[size_t(i)] = j;
+    newMatch[size_t(j)] = i;
+    matched.push_back(j);
+    matchedOld.push_back(i);
+  }
+  // those in the longest run that keeps its order stay, the others moved.
+  auto stays = longestIncreasing(matchedOld);
+  for (size_t k = 0; k < matched.size(); ++k) {
+    if (stays[k])
+      continue;
+    const auto& from = oldChild(matchedOld[k]);
+    const auto& to = newChild(matched[k]);
+    addMove(*to.node, aStart + from.offset, bStart + to.offset, path);
+  }
+
+  // the others are paired by kind and name, in order, and compared.
+  QHash<QString, std::vector<int>> byName;
+  auto key = [](const XmlSnapshotNode& node) {
+    return QString::number(node.kind) + ':' + node.name;
+  };
+  for (auto i = oldEnd - 1; i >= prefix; --i) {
+    if (oldMatch[size_t(i)] < 0)
+      byName[key(*oldChild(i).node)].push_back(i);
+  }
+  for (auto j = prefix; j < newEnd; ++j) {
+    if (newMatch[size_t(j)] >= 0)
+      continue;
+    const auto& to = newChild(j);
+    auto it = byName.find(key(*to.node));
+    if (it == byName.end() || it->empty()) {
+      addNode(Operation::Inserted, *to.node, bStart + to.offset, path);
+      continue;
+    }
+    auto i = it->back();
+    it->pop_back();
+    oldMatch[size_t(i)] = j;
+    const auto& from = oldChild(i);
+    compareNodes(
+      *from.node, aStart + from.offset, *to.node, bStart + to.offset, path);
+  }
+  for (auto i = prefix; i < oldEnd; ++i) {
+    if (oldMatch[size_t(i)] >= 0)
+      continue;
+    const auto& from = oldChild(i);
+    addNode(Operation::Deleted, *from.node, aStart + from.offset, path);
+  }
+}
+
+std::vector<bool>
+Differ::longestIncreasing(const std::vector<int>& values)
+{
+  // patience sorting, tails holds the index of the smallest last value of
+  // a run of each length.
+  std::vector<bool> result(values.size(), false);
+  std::vector<int> tails;
+  std::vector<int> previous(values.size(), -1);
+  for (size_t k = 0; k < values.size(); ++k) {
+    auto it = std::lower_bound(
+      tails.begin(), tails.end(), values[k], [&values](int index, int value) {
+        return values[size_t(index)] < value;
+      });
+    if (it != tails.begin())
+      previous[k] = *(it - 1);
+    if (it == tails.end())
+      tails.push_back(int(k));
+    else
+      *it = int(k);
+  }
+  for (auto k = tails.empty() ? -1 : tails.back(); k >= 0;
+       k = previous[size_t(k)])
+    result[size_t(k)] = true;
+  return result;
+}
+
+void
+Differ::finishMoves()
+{
+  // a subtree deleted in one place and inserted unchanged in another has
+  // moved, whatever its parents.
+  std::unordered_map<quint64, std::vector<int>> deleted;
+  for (auto i = script.size() - 1; i >= 0; --i) {
+    const auto& operation = script.at(i);
+    if (operation.type == Operation::Deleted &&
+        operation.kind != XmlSnapshotNode::Text)
+      deleted[m_hashes[size_t(i)]].push_back(i);
+  }
+  if (deleted.empty())
+    return;
+
+  std::vector<bool> removed(size_t(script.size()), false);
+  for (auto i = 0; i < script.size(); ++i) {
+    auto& operation = script[i];
+    if (operation.type != Operation::Inserted)
+      continue;
+    auto it = deleted.find(m_hashes[size_t(i)]);
+    if (it == deleted.end() || it->second.empty())
+      continue;
+    const auto& from = script.at(it->second.back());
+    removed[size_t(it->second.back())] = true;
+    it->second.pop_back();
+    operation.type = Operation::Moved;
+    operation.oldPosition = from.oldPosition;
+    operation.oldLength = from.oldLength;
+    operation.newValue.clear();
+  }
+
+  XmlDiff::Script kept;
+  kept.reserve(script.size());
+  for (auto i = 0; i < script.size(); ++i) {
+    if (!removed[size_t(i)])
+      kept.append(script.at(i));
+  }
+  script = kept;
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlDiff
+//====================================================================
+XmlDiff::Script
+XmlDiff::compare(const XmlSnapshot& from, const XmlSnapshot& to)
+{
+  QXML_TRACE_SCOPE("XmlDiff::compare");
+  Differ differ;
+  differ.compareNodes(from.root(), 0, to.root(), 0, QString());
+  differ.finishMoves();
+  return differ.script;
+}
+
+XmlDiff::Script
+XmlDiff::compareFiles(const QString& from, const QString& to, QString* error)
+{
+  XmlSnapshot::Ptr snapshots[2];
+  std::vector<int> dropped[2];
+  const QString* filenames[2] = { &from, &to };
+  for (auto i = 0; i < 2; ++i) {
+    QFile file(*filenames[i]);
+    if (!file.open(QIODevice::ReadOnly)) {
+      if (error)
+        *error =
+          QStringLiteral("%1: %2").arg(*filenames[i], file.errorString());
+      return {};
+    }
+    QString message;
+    auto text = QString::fromUtf8(file.readAll());
+    snapshots[i] = snapshotOf(text, &message);
+    if (!snapshots[i]) {
+      if (error)
+        *error = QStringLiteral("%1: %2").arg(*filenames[i], message);
+      return {};
+    }
+    dropped[i] = droppedCarriageReturns(text);
+  }
+  auto script = compare(*snapshots[0], *snapshots[1]);
+  for (auto& operation : script) {
+    toFilePosition(dropped[0], operation.oldPosition, operation.oldLength);
+    toFilePosition(dropped[1], operation.newPosition, operation.newLength);
+  }
+  return script;
+}
+
+XmlSnapshot::Ptr
+XmlDiff::snapshotOf(const QString& text, QString* error)
+{
+  QXML_TRACE_SCOPE("XmlDiff::snapshotOf");
+  // without a document the node positions are offsets in plain.
+  auto plain = documentText(text);
+  XmlEventParser parser(nullptr);
+  if (!parser.parseString(plain)) {
+    if (error)
+      *error = parser.errorMessage();
+    return {};
+  }
+  return XmlSnapshot::build(parser, int(plain.length()), 0);
+}
@@ -0,0 +1,730 @@
+#include "qxml/xmldocument.h"
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlformatruns.h"
+#include "qxml/xmlhighlighter.h"
+#include "qxml/xmlmemory.h"
+#include "qxml/xmlsnapshot.h"
+#include "qxml/xmltrace.h"
+
+#include <QElapsedTimer>
+#include <QPlainTextDocumentLayout>
+
+namespace {
+
+//! A QTextBlock is a fragment in the piece table plus its layout and user
+//! state, a rough figure.
+const qint64 BLOCK_BYTES = 192;
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlDocument
+//====================================================================
+XmlDocument::XmlDocument(QObject* parent)
+  : QObject(parent)
+  , m_document(new QTextDocument(this))
+  , m_parser(new XmlEventParser(m_document, this))
+  , m_highlighter(new XmlHighlighter(m_parser, m_document))
+  , m_reparseTimer(new QTimer(this))
+  , m_formatThread(new QThread(this))
+  , m_formatWorker(new XmlFormatWorker())
+  , m_backfillTimer(new QTimer(this))
+  , m_validateTimer(new QTimer(this))
+{
+  // QPlainTextEdit only shows documents with a plain text layout.
+  m_document->setDocumentLayout(new QPlainTextDocumentLayout(m_document));
+
+  // a zero interval fires once the current batch of edits has been
+  // processed, a paste or an undo step is parsed once.
+  m_reparseTimer->setSingleShot(true);
+  m_reparseTimer->setInterval(0);
+  connect(m_reparseTimer, &QTimer::timeout, this, &XmlDocument::reparse);
+  m_backfillTimer->setInterval(0);
+  connect(m_backfillTimer,
+          &QTimer::timeout,
+          this,
+          &XmlDocument::backfillHighlighting);
+  watchEdits();
+
+  // The per block format runs are built away from the GUI thread, the
+  // highlighter formats from the nodes until they arrive.
+  m_formatWorker->moveToThread(m_formatThread);
+  connect(m_formatThread,
+          &QThread::finished,
+          m_formatWorker,
+          &QObject::deleteLater);
+  connect(m_formatWorker,
+          &XmlFormatWorker::runsReady,
+          this,
+          &XmlDocument::formatRunsReady);
+  m_formatThread->start();
+
+  m_validateTimer->setSingleShot(true);
+  m_validateTimer->setInterval(VALIDATE_DELAY);
+  connect(m_validateTimer, &QTimer::timeout, this, &XmlDocument::validate);
+  connect(this, &XmlDocument::snapshotPublished, this, [this]() {
+    if (!m_schemaLocation.isEmpty())
+      m_validateTimer->start();
+  });
+}
+
+XmlDocument::~XmlDocument()
+{
+  m_formatThread->quit();
+  m_formatThread->wait();
+  if (m_validateThread) {
+    m_validator->cancel();
+    m_validateThread->quit();
+    m_validateThread->wait();
+  }
+}
+
+QTextDocument*
+XmlDocument::textDocument() const
+{
+  return m_document;
+}
+
+XmlEventParser*
+XmlDocument::parser() const
+{
+  return m_parser;
+}
+
+XmlHighlighter*
+XmlDocument::highlighter() const
+{
+  return m_highlighter;
+}
+
+std::shared_ptr<const XmlSnapshot>
+XmlDocument::snapshot() const
+{
+  return std::atomic_load(&m_snapshot);
+}
+
+const QString&
+XmlDocument::schemaLocation() const
+{
+  return m_schemaLocation;
+}
+
+void
+XmlDocument::setSchemaLocation(const QString& location)
+{
+  if (location == m_schemaLocation)
+    return;
+  m_schemaLocation = location;
+  m_validateTimer->stop();
+  if (m_validator) {
+    // what is running validates against the old schema.
+    ++m_validateGeneration;
+    m_validator->cancel();
+  }
+  m_validationErrors.clear();
+  m_validatedRevision = -1;
+  emit validationFinished();
+  if (location.isEmpty())
+    return;
+
+  if (!m_validateThread) {
+    // validation can take seconds, so it has a thread of its own rather
+    // than holding up the format runs.
+    m_validateThread = new QThread(this);
+    m_validator = new XmlValidator();
+    m_validator->moveToThread(m_validateThread);
+    connect(m_validateThread,
+            &QThread::finished,
+            m_validator,
+            &QObject::deleteLater);
+    connect(m_validator,
+            &XmlValidator::validated,
+            this,
+            &XmlDocument::validationReady);
+    m_validateThread->start(QThread::LowPriority);
+  }
+  validate();
+}
+
+void
+XmlDocument::validate()
+{
+  m_validateTimer->stop();
+  auto snapshot = this->snapshot();
+  if (m_schemaLocation.isEmpty() || !snapshot)
+    return;
+  auto generation = ++m_validateGeneration;
+  // the validation under way is of an older snapshot.
+  m_validator->cancel();
+  auto validator = m_validator;
+  auto location = m_schemaLocation;
+  QMetaObject::invokeMethod(
+    validator,
+    [this, validator, snapshot, location, generation]() {
+      // a newer request is already queued behind this one.
+      if (generation != m_validateGeneration)
+        return;
+      validator->validate(snapshot, location, generation);
+    },
+    Qt::QueuedConnection);
+}
+
+const XmlValidationErrors&
+XmlDocument::validationErrors() const
+{
+  return m_validationErrors;
+}
+
+int
+XmlDocument::validatedRevision() const
+{
+  return m_validatedRevision;
+}
+
+qint64
+XmlDocument::MemoryUsage::total() const
+{
+  return document + parser + highlighter + snapshot + caches;
+}
+
+XmlDocument::MemoryUsage
+XmlDocument::memoryUsage() const
+{
+  using namespace XmlMemory;
+  MemoryUsage usage;
+  // QTextDocument keeps the text in a piece table of UTF-16, with the
+  // undo stack on top of it, which is not counted.
+  usage.document =
+    qint64(m_document->characterCount()) * qint64(sizeof(QChar)) +
+    qint64(m_document->blockCount()) * BLOCK_BYTES;
+  usage.parser = m_parser->memoryUsage().total();
+  usage.highlighter = m_highlighter->memoryUsage().total();
+
+  // the snapshot sizes its nodes as it builds them.
+  auto snapshot = std::atomic_load(&m_snapshot);
+  if (snapshot)
+    usage.snapshot = qint64(sizeof(XmlSnapshot)) + CONTROL_BYTES +
+                     ALLOCATION_BYTES + snapshot->root().bytes;
+
+  // a hash node holds the key, the hash value and the next link.
+  usage.caches = vectorBytes(m_foldEnds) + vectorBytes(m_folds) +
+                 vectorBytes(m_softBreaks) + vectorBytes(m_validationErrors) +
+                 qint64(m_folds.size()) * CURSOR_BYTES +
+                 qint64(m_foldedBlocks.capacity()) * qint64(sizeof(void*)) +
+                 qint64(m_foldedBlocks.size()) *
+                   (qint64(sizeof(int)) + 2 * qint64(sizeof(void*)) +
+                    ALLOCATION_BYTES);
+  for (const auto& error : m_validationErrors)
+    usage.caches += stringBytes(error.message);
+  return usage;
+}
+
+void
+XmlDocument::validationReady(int generation,
+                             int revision,
+                             const XmlValidationErrors& errors)
+{
+  if (generation != m_validateGeneration)
+    return;
+  m_validationErrors = errors;
+  m_validatedRevision = revision;
+  emit validationFinished();
+}
+
+bool
+XmlDocument::isModified() const
+{
+  return m_modified;
+}
+
+bool
+XmlDocument::isReadOnly() const
+{
+  return m_readOnly;
+}
+
+void
+XmlDocument::setReadOnly(bool readOnly)
+{
+  if (readOnly == m_readOnly)
+    return;
+  m_readOnly = readOnly;
+  emit readOnlyChanged(readOnly);
+}
+
+const QVector<int>&
+XmlDocument::softBreaks() const
+{
+  return m_softBreaks;
+}
+
+bool
+XmlDocument::isSoftReformatted() const
+{
+  return !m_softBreaks.isEmpty();
+}
+
+void
+XmlDocument::setSoftBreaks(const QVector<int>& softBreaks)
+{
+  m_softBreaks = softBreaks;
+  if (!m_softBreaks.isEmpty())
+    setReadOnly(true);
+}
+
+void
+XmlDocument::beginText()
+{
+  disconnect(m_document,
+             &QTextDocument::contentsChange,
+             this,
+             &XmlDocument::textHasChanged);
+  // the nodes of the previous text would only be walked for nothing while
+  // the new text is set, and none of the new blocks is formatted until it is
+  // scrolled to or the backfill reaches it.
+  m_parser->clear();
+  if (!m_softBreaks.isEmpty()) {
+    m_softBreaks.clear();
+    setReadOnly(false);
+  }
+  m_backfillTimer->stop();
+  m_backfillPosition = 0;
+  m_highlighter->setDeferred(true);
+  m_reparseTimer->stop();
+  m_editFrom = m_editTo = -1;
+  m_folds.clear();
+  m_foldedBlocks.clear();
+  m_foldEnds.clear();
+  // the snapshot of the old text is kept, the one of the new text takes
+  // over its unchanged subtrees.
+  m_textReplaced = true;
+}
+
+void
+XmlDocument::endText(const QString& text)
+{
+  watchEdits();
+  if (m_highlighter->mode() == XmlHighlighter::LexicalMode) {
+    // lexical highlighting needs no tree, so the text is shown straight away
+    // and parsed once control returns to the event loop.
+    m_backfillTimer->start();
+    m_reparseTimer->start();
+    return;
+  }
+
+  if (m_parser->parseString(text)) {
+    publishSnapshot();
+    requestFormatRuns(text);
+    updateFoldRanges();
+  } else {
+    // with no nodes the text is highlighted lexically, that needs no runs.
+    m_backfillTimer->start();
+    dropSnapshot();
+  }
+  emit treeUpdated();
+}
+
+void
+XmlDocument::endText(XmlEventParser& other, bool wellFormed)
+{
+  watchEdits();
+  if (wellFormed) {
+    auto text = m_document->toPlainText();
+    m_parser->adoptTree(other, text);
+    publishSnapshot();
+    updateFoldRanges();
+    if (m_highlighter->mode() == XmlHighlighter::TreeMode) {
+      // the blocks shown so far were formatted lexically.
+      m_highlighter->markUnformatted();
+      requestFormatRuns(text);
+    } else {
+      m_backfillTimer->start();
+    }
+  } else {
+    m_backfillTimer->start();
+    dropSnapshot();
+  }
+  emit treeUpdated();
+}
+
+void
+XmlDocument::replaceText(const QString& text)
+{
+  QXML_TRACE_SCOPE("XmlDocument::replaceText");
+  // the document makes a block separator of CR LF, CR and LF alike.
+  auto replacement = text;
+  replacement.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+  replacement.replace(QLatin1Char('\r'), QLatin1Char('\n'));
+  auto old = m_document->toPlainText();
+
+  auto oldLength = int(old.length());
+  auto length = int(replacement.length());
+  auto shorter = qMin(oldLength, length);
+  auto prefix = 0;
+  while (prefix < shorter && old.at(prefix) == replacement.at(prefix))
+    ++prefix;
+  auto suffix = 0;
+  while (suffix < shorter - prefix &&
+         old.at(oldLength - 1 - suffix) == replacement.at(length - 1 - suffix))
+    ++suffix;
+  if (prefix == oldLength && prefix == length)
+    return;
+
+  // textHasChanged() records the edit, as for any other.
+  QTextCursor cursor(m_document);
+  cursor.setPosition(prefix);
+  cursor.setPosition(oldLength - suffix, QTextCursor::KeepAnchor);
+  cursor.insertText(replacement.mid(prefix, length - prefix - suffix));
+  reparse();
+  m_modified = false;
+}
+
+void
+XmlDocument::watchEdits()
+{
+  connect(m_document,
+          &QTextDocument::contentsChange,
+          this,
+          &XmlDocument::textHasChanged,
+          Qt::UniqueConnection);
+}
+
+void
+XmlDocument::scheduleReparse()
+{
+  m_reparseTimer->start();
+}
+
+void
+XmlDocument::requestFormatRuns(const QString& text)
+{
+  // the spans are made on the worker from the snapshot just published.
+  auto snapshot = this->snapshot();
+  if (!snapshot)
+    return;
+  auto generation = ++m_formatGeneration;
+  auto worker = m_formatWorker;
+  QMetaObject::invokeMethod(
+    worker,
+    [this, worker, text, snapshot, generation]() {
+      // a newer request is already queued behind this one.
+      if (generation != m_formatGeneration)
+        return;
+      worker->build(text, snapshot);
+    },
+    Qt::QueuedConnection);
+}
+
+void
+XmlDocument::formatRunsReady(const XmlFormatRuns& runs)
+{
+  // runs for text that has since been edited are dropped, the reparse that
+  // follows the edit asks for new ones.
+  if (!runs.isValidFor(m_document->revision()))
+    return;
+  m_highlighter->setFormatRuns(runs);
+  // the rest of a newly set text is formatted from the runs.
+  if (m_highlighter->isDeferred())
+    m_backfillTimer->start();
+}
+
+void
+XmlDocument::formatBlocks(QTextBlock block, int count)
+{
+  if (!m_highlighter->isDeferred())
+    return;
+  m_rehighlighting = true;
+  for (auto i = 0; i < count && block.isValid(); ++i) {
+    m_highlighter->formatDeferred(block);
+    block = block.next();
+  }
+  m_rehighlighting = false;
+}
+
+void
+XmlDocument::startBackfill()
+{
+  if (m_highlighter->isDeferred())
+    m_backfillTimer->start();
+}
+
+void
+XmlDocument::backfillHighlighting()
+{
+  QXML_TRACE_SCOPE("XmlDocument::backfillHighlighting");
+  // a short slice per event loop pass keeps typing and scrolling responsive.
+  const int SLICE_MS = 4;
+  QElapsedTimer slice;
+  slice.start();
+
+  auto block = m_document->findBlock(m_backfillPosition);
+  m_rehighlighting = true;
+  while (block.isValid() && slice.elapsed() < SLICE_MS) {
+    m_highlighter->formatDeferred(block);
+    block = block.next();
+  }
+  m_rehighlighting = false;
+
+  if (block.isValid()) {
+    m_backfillPosition = block.position();
+  } else {
+    m_backfillTimer->stop();
+    m_highlighter->setDeferred(false);
+  }
+}
+
+void
+XmlDocument::reparse()
+{
+  QXML_TRACE_SCOPE("XmlDocument::reparse");
+  m_reparseTimer->stop();
+  auto text = m_document->toPlainText();
+  if (m_parser->parseString(text)) {
+    auto lexical = (m_highlighter->mode() == XmlHighlighter::LexicalMode);
+    // a failed parse keeps the previous tree, the edits are then carried
+    // over to the next parse.
+    auto editFrom = m_editFrom;
+    auto editTo = m_editTo;
+    m_editFrom = m_editTo = -1;
+    // only the edited blocks and those whose nodes moved are reformatted,
+    // if no node boundary moved this is just the edited block.
+    auto changed = m_parser->changedRange();
+    auto changedFrom = editFrom;
+    auto changedTo = editTo;
+    if (!changed.isEmpty()) {
+      changedFrom =
+        (editFrom < 0 ? changed.from : qMin(editFrom, changed.from));
+      changedTo = qMax(editTo, changed.to);
+    }
+    publishSnapshot(changedFrom, changedTo);
+    if (!lexical)
+      requestFormatRuns(text);
+    updateFoldRanges();
+    if (!lexical) {
+      editFrom = changedFrom;
+      editTo = changedTo;
+    }
+    if (editFrom >= 0)
+      updateHighlighting(editFrom, editTo);
+  } else {
+    dropSnapshot();
+  }
+  emit treeUpdated();
+}
+
+void
+XmlDocument::publishSnapshot(int from, int to)
+{
+  // the nodes outside from to are shared with the previous snapshot, after
+  // a new text all of it may have changed.
+  auto length = m_document->characterCount() - 1;
+  XmlEventParser::TextRange changed;
+  changed.from = (m_textReplaced ? 0 : from);
+  changed.to = (m_textReplaced ? length : to);
+  m_textReplaced = false;
+  auto next = XmlSnapshot::build(*m_parser,
+                                 length,
+                                 m_document->revision(),
+                                 m_snapshot,
+                                 changed);
+  // the only synchronisation with the readers, the old version lives on
+  // until the last of them lets it go.
+  std::atomic_store(&m_snapshot, next);
+  emit snapshotPublished();
+}
+
+int
+XmlDocument::foldEnd(int blockNumber) const
+{
+  if (blockNumber < 0 || blockNumber >= m_foldEnds.size())
+    return -1;
+  return m_foldEnds.at(blockNumber);
+}
+
+bool
+XmlDocument::isFolded(int blockNumber) const
+{
+  return m_foldedBlocks.contains(blockNumber);
+}
+
+void
+XmlDocument::fold(int blockNumber)
+{
+  if (foldEnd(blockNumber) < 0 || isFolded(blockNumber))
+    return;
+  m_folds.append(QTextCursor(m_document->findBlockByNumber(blockNumber)));
+  applyFolds();
+}
+
+void
+XmlDocument::unfold(int blockNumber)
+{
+  auto removed = false;
+  for (auto i = m_folds.size() - 1; i >= 0; --i) {
+    if (m_folds.at(i).blockNumber() == blockNumber) {
+      m_folds.remove(i);
+      removed = true;
+    }
+  }
+  if (removed)
+    applyFolds();
+}
+
+void
+XmlDocument::toggleFold(int blockNumber)
+{
+  if (isFolded(blockNumber))
+    unfold(blockNumber);
+  else
+    fold(blockNumber);
+}
+
+void
+XmlDocument::unfoldAll()
+{
+  if (m_folds.isEmpty())
+    return;
+  m_folds.clear();
+  applyFolds();
+}
+
+void
+XmlDocument::dropSnapshot()
+{
+  // a new text that does not parse has no snapshot, an edited one keeps
+  // that of its last successful parse.
+  if (!m_textReplaced || !m_snapshot)
+    return;
+  std::atomic_store(&m_snapshot, std::shared_ptr<const XmlSnapshot>());
+  emit snapshotPublished();
+}
+
+void
+XmlDocument::updateFoldRanges()
+{
+  QXML_TRACE_SCOPE("XmlDocument::updateFoldRanges");
+  m_foldEnds.fill(-1, m_document->blockCount());
+  // the nodes are in document order so their first blocks are found by
+  // walking forward, only a node that spans lines has its last block looked
+  // up.
+  auto block = m_document->begin();
+  for (auto node : m_parser->nodes()) {
+    auto end = -1;
+    switch (node->type) {
+      case Node::Start: {
+        auto closer = static_cast<StartNode*>(node)->closer;
+        if (closer && closer->length() > 0)
+          end = closer->end();
+        break;
+      }
+      case Node::Comment:
+      case Node::CData:
+        end = node->end();
+        break;
+      default:
+        break;
+    }
+    if (end < 0)
+      continue;
+
+    auto start = node->start();
+    while (block.isValid() && block.position() + block.length() <= start)
+      block = block.next();
+    if (!block.isValid())
+      break;
+    if (end < block.position() + block.length())
+      continue;
+    auto last = m_document->findBlock(end - 1).blockNumber();
+    auto& foldEnd = m_foldEnds[block.blockNumber()];
+    foldEnd = qMax(foldEnd, last);
+  }
+  applyFolds();
+}
+
+void
+XmlDocument::applyFolds()
+{
+  auto from = -1;
+  auto to = -1;
+  auto touch = [&from, &to](const QTextBlock& block) {
+    if (from < 0 || block.position() < from)
+      from = block.position();
+    to = qMax(to, block.position() + block.length());
+  };
+
+  // the blocks hidden so far are shown, then those of the folds that are
+  // still there are hidden again. Nested folds are hidden by both.
+  for (const auto& cursor : m_folds) {
+    auto block = cursor.block().next();
+    while (block.isValid() && !block.isVisible()) {
+      block.setVisible(true);
+      block.setLineCount(1);
+      touch(block);
+      block = block.next();
+    }
+  }
+  m_foldedBlocks.clear();
+  for (auto i = m_folds.size() - 1; i >= 0; --i) {
+    auto start = m_folds.at(i).block();
+    auto last = foldEnd(start.blockNumber());
+    if (last < 0 || m_foldedBlocks.contains(start.blockNumber())) {
+      // the fold has been edited away.
+      m_folds.remove(i);
+      continue;
+    }
+    m_foldedBlocks.insert(start.blockNumber());
+    auto block = start.next();
+    while (block.isValid() && block.blockNumber() <= last) {
+      block.setVisible(false);
+      block.setLineCount(0);
+      touch(block);
+      block = block.next();
+    }
+  }
+
+  if (from >= 0) {
+    // the layout drops the hidden blocks, that is no edit.
+    m_rehighlighting = true;
+    m_document->markContentsDirty(from, to - from);
+    m_rehighlighting = false;
+  }
+  emit foldsChanged();
+}
+
+void
+XmlDocument::updateHighlighting()
+{
+  QXML_TRACE_SCOPE("XmlHighlighter::rehighlight");
+  // applying formats emits contentsChange as well, those are not edits.
+  m_rehighlighting = true;
+  m_highlighter->rehighlight();
+  m_rehighlighting = false;
+}
+
+void
+XmlDocument::updateHighlighting(int from, int to)
+{
+  QXML_TRACE_SCOPE("XmlHighlighter::rehighlightRange");
+  m_rehighlighting = true;
+  m_highlighter->rehighlightRange(from, to);
+  m_rehighlighting = false;
+}
+
+void
+XmlDocument::textHasChanged(int position, int charsRemoved, int charsAdded)
+{
+  if (m_rehighlighting)
+    return;
+  m_modified = true;
+  if (position < m_backfillPosition)
+    m_backfillPosition =
+      qMax(position, m_backfillPosition + charsAdded - charsRemoved);
+  // the union of the edits since the last parse, positions before an edit
+  // do not move so the earliest start stays valid.
+  if (m_editFrom < 0 || position < m_editFrom)
+    m_editFrom = position;
+  if (m_editTo >= 0 && m_editTo > position)
+    m_editTo += charsAdded - charsRemoved;
+  m_editTo = qMax(m_editTo, position + charsAdded);
+  m_reparseTimer->start();
+}
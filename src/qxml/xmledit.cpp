@@ -1,29 +1,310 @@
 ﻿#include "qxml/xmledit.h"
+#include "qxml/xmldocument.h"
 #include "qxml/xmleventparser.h"
+#include "qxml/xmlfileloader.h"
 #include "qxml/xmlhighlighter.h"
+#include "qxml/xmlscanner.h"
+#include "qxml/xmlsoftreformatter.h"
+#include "qxml/xmltrace.h"
 //#include "widgets/settingsdialog.h"
 
 #include <JlCompress.h>
 
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+//! Marks the extra selections that show a matching tag pair.
+const int MatchedTagProperty = QTextFormat::UserProperty + 0x100;
+
+} // end of anonymous namespace
+
 //====================================================================
 //=== XmlEdit
 //====================================================================
 XmlEdit::XmlEdit(QWidget* parent)
-  : LNPlainTextEdit(this)
-  , m_parser(new XmlEventParser(LNPlainTextEdit::document(), this))
-  , m_highlighter(new XmlHighlighter(m_parser, LNPlainTextEdit::document()))
+  : LNPlainTextEdit(parent)
   , m_parent(parent)
 {
-  initSettings(new XmlEditSettings(m_highlighter, parent));
+  initXmlDocument();
 }
 
 XmlEdit::XmlEdit(BaseConfig* config, QWidget* parent)
   : LNPlainTextEdit(config, parent)
-  , m_parser(new XmlEventParser(LNPlainTextEdit::document(), this))
-  , m_highlighter(new XmlHighlighter(m_parser, LNPlainTextEdit::document()))
   , m_parent(parent)
 {
-  initSettings(new XmlEditSettings(m_highlighter, parent));
+  initXmlDocument();
+}
+
+void
+XmlEdit::initXmlDocument()
+{
+  m_xmlDocument = QSharedPointer<XmlDocument>::create();
+  attachXmlDocument();
+  m_xmlSettings = new XmlEditSettings(m_highlighter, m_parent);
+  initSettings(m_xmlSettings);
+  connect(verticalScrollBar(),
+          &QScrollBar::valueChanged,
+          this,
+          &XmlEdit::highlightVisibleBlocks);
+  // queued so that the layout has taken the edit in first.
+  connect(this,
+          &QPlainTextEdit::textChanged,
+          this,
+          &XmlEdit::highlightVisibleBlocks,
+          Qt::QueuedConnection);
+  connect(
+    this, &QPlainTextEdit::cursorPositionChanged, this, &XmlEdit::matchTags);
+
+  // connected after the line number area, whose width is set first.
+  m_foldArea = new XmlFoldArea(this);
+  connect(this,
+          &QPlainTextEdit::blockCountChanged,
+          this,
+          &XmlEdit::updateFoldAreaGeometry);
+  connect(
+    this, &QPlainTextEdit::updateRequest, this, &XmlEdit::updateFoldArea);
+  updateFoldAreaGeometry();
+}
+
+XmlEdit::~XmlEdit()
+{
+  if (m_loadThread) {
+    m_loader->cancel();
+    m_loadThread->quit();
+    m_loadThread->wait();
+  }
+  // the shared document may be deleted with this view, the editor is moved
+  // off it first.
+  disconnect(m_xmlDocument.data(), nullptr, this, nullptr);
+  QPlainTextEdit::setDocument(nullptr);
+}
+
+QSharedPointer<XmlDocument>
+XmlEdit::xmlDocument() const
+{
+  return m_xmlDocument;
+}
+
+void
+XmlEdit::setXmlDocument(QSharedPointer<XmlDocument> document)
+{
+  if (!document || document == m_xmlDocument)
+    return;
+  cancelLoad();
+  disconnect(m_xmlDocument.data(), nullptr, this, nullptr);
+  disconnect(m_parser, nullptr, this, nullptr);
+  // dropping the last reference deletes the previous document, after this
+  // view has moved off it.
+  auto previous = m_xmlDocument;
+  m_xmlDocument = document;
+  attachXmlDocument();
+  m_xmlSettings->setHighlighter(m_highlighter);
+  connect(m_parser, &XmlEventParser::sendWarning, this, &XmlEdit::sendWarning);
+  connect(m_parser, &XmlEventParser::sendError, this, &XmlEdit::sendError);
+}
+
+void
+XmlEdit::attachXmlDocument()
+{
+  m_parser = m_xmlDocument->parser();
+  m_highlighter = m_xmlDocument->highlighter();
+  QPlainTextEdit::setDocument(m_xmlDocument->textDocument());
+  setReadOnly(m_xmlDocument->isReadOnly());
+  connect(m_xmlDocument.data(),
+          &XmlDocument::treeUpdated,
+          this,
+          &XmlEdit::treeUpdated);
+  connect(m_xmlDocument.data(),
+          &XmlDocument::treeUpdated,
+          this,
+          &XmlEdit::matchTags);
+  connect(m_xmlDocument.data(), &XmlDocument::foldsChanged, this, [this]() {
+    // a fold may have hidden the cursor.
+    auto cursor = textCursor();
+    if (!cursor.block().isVisible()) {
+      auto block = cursor.block();
+      while (block.isValid() && !block.isVisible())
+        block = block.previous();
+      if (block.isValid()) {
+        cursor.setPosition(block.position());
+        setTextCursor(cursor);
+      }
+    }
+    if (m_foldArea)
+      m_foldArea->update();
+    // unfolding shows blocks that may not have been formatted.
+    highlightVisibleBlocks();
+    viewport()->update();
+  });
+  connect(m_xmlDocument.data(),
+          &XmlDocument::readOnlyChanged,
+          this,
+          &XmlEdit::setReadOnly);
+}
+
+void
+XmlEdit::highlightVisibleBlocks()
+{
+  if (!m_highlighter->isDeferred())
+    return;
+  QXML_TRACE_SCOPE("XmlEdit::highlightVisibleBlocks");
+
+  // the visible blocks and a page either side, so that scrolling a page
+  // shows no unformatted text.
+  auto first = firstVisibleBlock();
+  auto offset = contentOffset();
+  auto height = viewport()->height();
+  auto visible = 0;
+  auto block = first;
+  while (block.isValid() &&
+         blockBoundingGeometry(block).translated(offset).top() < height * 2) {
+    ++visible;
+    block = block.next();
+  }
+
+  block = first;
+  for (auto i = 0; i < visible && block.previous().isValid(); ++i)
+    block = block.previous();
+  m_xmlDocument->formatBlocks(block, visible * 3);
+}
+
+void
+XmlEdit::matchTags()
+{
+  // only the extra selections change, the text is not rehighlighted.
+  auto selections = extraSelections();
+  auto count = selections.size();
+  selections.erase(std::remove_if(selections.begin(),
+                                  selections.end(),
+                                  [](const QTextEdit::ExtraSelection& s) {
+                                    return s.format.hasProperty(
+                                      MatchedTagProperty);
+                                  }),
+                   selections.end());
+  auto hadMatch = (selections.size() != count);
+
+  // a tag is also matched with the cursor just after its closing bracket.
+  auto position = textCursor().position();
+  auto context = m_parser->contextAt(position);
+  auto isTag = [](Node* node) {
+    return node && (node->type == Node::Start || node->type == Node::End);
+  };
+  if (!isTag(context.node) && position > 0)
+    context = m_parser->contextAt(position - 1);
+
+  Node* tag = context.node;
+  Node* partner = nullptr;
+  if (tag && tag->type == Node::Start)
+    partner = static_cast<StartNode*>(tag)->closer;
+  else if (tag && tag->type == Node::End)
+    partner = static_cast<EndNode*>(tag)->opener;
+
+  // an empty element tag is its own partner.
+  if (partner && partner->length() > 0 && tag->length() > 0) {
+    auto format = m_highlighter->matchFormat();
+    format.setProperty(MatchedTagProperty, true);
+    for (auto node : { tag, partner }) {
+      auto named = static_cast<NameNode*>(node);
+      QTextEdit::ExtraSelection selection;
+      selection.format = format;
+      selection.cursor = QTextCursor(document());
+      selection.cursor.setPosition(named->nameStart());
+      selection.cursor.setPosition(named->nameStart() + named->nameLength(),
+                                   QTextCursor::KeepAnchor);
+      selections.append(selection);
+    }
+  } else if (!hadMatch) {
+    // plain cursor movement away from tags costs no repaint.
+    return;
+  }
+  setExtraSelections(selections);
+}
+
+void
+XmlEdit::updateFoldArea(const QRect& rect, int dy)
+{
+  if (dy)
+    m_foldArea->scroll(0, dy);
+  else
+    m_foldArea->update(0, rect.y(), m_foldArea->width(), rect.height());
+}
+
+void
+XmlEdit::updateFoldAreaGeometry()
+{
+  // the line number area sets the left margin to its own width, the fold
+  // column is added after it whenever it does.
+  auto margins = viewportMargins();
+  if (margins.left() != m_foldMargin) {
+    m_foldMargin = margins.left() + XmlFoldArea::WIDTH;
+    setViewportMargins(
+      m_foldMargin, margins.top(), margins.right(), margins.bottom());
+  }
+  auto rect = contentsRect();
+  m_foldArea->setGeometry(rect.left() + m_foldMargin - XmlFoldArea::WIDTH,
+                          rect.top(),
+                          XmlFoldArea::WIDTH,
+                          rect.height());
+}
+
+void
+XmlEdit::paintFoldArea(QPaintEvent* event)
+{
+  QPainter painter(m_foldArea);
+  painter.fillRect(event->rect(), m_highlighter->background());
+  painter.setRenderHint(QPainter::Antialiasing);
+  painter.setPen(Qt::NoPen);
+  painter.setBrush(m_highlighter->textColor());
+
+  // the markers come from the fold ranges cached per block, the tree is not
+  // walked. Folded blocks are not visible and take no height.
+  auto block = firstVisibleBlock();
+  auto top = blockBoundingGeometry(block).translated(contentOffset()).top();
+  auto size = qMin(XmlFoldArea::WIDTH, fontMetrics().height()) / 2.0;
+  while (block.isValid() && top <= event->rect().bottom()) {
+    auto height = blockBoundingRect(block).height();
+    auto number = block.blockNumber();
+    if (block.isVisible() && top + height >= event->rect().top() &&
+        m_xmlDocument->foldEnd(number) >= 0) {
+      auto centre = QPointF(XmlFoldArea::WIDTH / 2.0,
+                            top + fontMetrics().height() / 2.0);
+      QPolygonF marker;
+      if (m_xmlDocument->isFolded(number)) {
+        marker << centre + QPointF(-size / 2, -size / 2)
+               << centre + QPointF(size / 2, 0)
+               << centre + QPointF(-size / 2, size / 2);
+      } else {
+        marker << centre + QPointF(-size / 2, -size / 2)
+               << centre + QPointF(size / 2, -size / 2)
+               << centre + QPointF(0, size / 2);
+      }
+      painter.drawPolygon(marker);
+    }
+    top += height;
+    block = block.next();
+  }
+}
+
+void
+XmlEdit::foldAreaClicked(const QPoint& position)
+{
+  auto block = cursorForPosition(QPoint(0, position.y())).block();
+  if (m_xmlDocument->foldEnd(block.blockNumber()) >= 0)
+    m_xmlDocument->toggleFold(block.blockNumber());
+}
+
+void
+XmlEdit::resizeEvent(QResizeEvent* event)
+{
+  LNPlainTextEdit::resizeEvent(event);
+  updateFoldAreaGeometry();
+  highlightVisibleBlocks();
 }
 
 void
@@ -70,7 +351,7 @@ XmlEdit::initialise()
 bool
 XmlEdit::isModified() const
 {
-  return m_modified;
+  return m_xmlDocument->isModified();
 }
 
 const QString
@@ -83,11 +364,7 @@ void
 XmlEdit::loadFile(const QString& filename)
 {
   m_filename = filename;
-  QFile file(m_filename);
-  if (file.open(QIODevice::ReadOnly)) {
-    auto text = file.readAll();
-    setText(text);
-  }
+  readFile(m_filename);
 }
 
 void
@@ -96,7 +373,19 @@ XmlEdit::loadFromZip(const QString& zipFile, const QString& href)
   m_filename = href;
   m_zipFile = zipFile;
   auto fileName = JlCompress::extractFile(zipFile, href);
-  QFile file(fileName);
+  readFile(fileName);
+}
+
+void
+XmlEdit::readFile(const QString& filename)
+{
+  cancelLoad();
+  QFile file(filename);
+  if (m_progressiveLoadThreshold > 0 &&
+      file.size() >= m_progressiveLoadThreshold) {
+    loadProgressively(filename);
+    return;
+  }
   if (file.open(QIODevice::ReadOnly)) {
     auto text = file.readAll();
     setText(text);
@@ -106,17 +395,287 @@ XmlEdit::loadFromZip(const QString& zipFile, const QString& href)
 void
 XmlEdit::setText(const QString& text)
 {
-  disconnect(LNPlainTextEdit::document(),
-             &QTextDocument::contentsChange,
-             this,
-             &XmlEdit::textHasChanged);
-  QPlainTextEdit::setPlainText(text);
-  m_parser->parseString(text);
-  connect(LNPlainTextEdit::document(),
-          &QTextDocument::contentsChange,
+  QXML_TRACE_SCOPE("XmlEdit::setText");
+  cancelLoad();
+  m_xmlDocument->beginText();
+  auto shown = softReformat(text);
+  {
+    QXML_TRACE_SCOPE("QPlainTextEdit::setPlainText");
+    QPlainTextEdit::setPlainText(shown);
+  }
+  m_xmlDocument->endText(shown);
+  highlightVisibleBlocks();
+}
+
+void
+XmlEdit::replaceText(const QString& text)
+{
+  cancelLoad();
+  if (m_xmlDocument->isSoftReformatted() || hasLongLines(text)) {
+    setText(text);
+    return;
+  }
+  m_xmlDocument->replaceText(text);
+  highlightVisibleBlocks();
+}
+
+qint64
+XmlEdit::progressiveLoadThreshold() const
+{
+  return m_progressiveLoadThreshold;
+}
+
+void
+XmlEdit::setProgressiveLoadThreshold(qint64 threshold)
+{
+  m_progressiveLoadThreshold = qMax(qint64(0), threshold);
+}
+
+bool
+XmlEdit::isLoading() const
+{
+  return m_loading;
+}
+
+void
+XmlEdit::cancelLoad()
+{
+  if (!m_loading)
+    return;
+  m_loader->cancel();
+  ++m_loadGeneration;
+  finishLoading();
+  // what has been loaded is parsed like any other text.
+  m_xmlDocument->setSoftBreaks(m_loadSoftBreaks);
+  m_xmlDocument->endText(LNPlainTextEdit::document()->toPlainText());
+}
+
+void
+XmlEdit::initLoader()
+{
+  if (m_loadThread)
+    return;
+  m_loadThread = new QThread(this);
+  m_loader = new XmlFileLoader();
+  m_loader->moveToThread(m_loadThread);
+  connect(
+    m_loadThread, &QThread::finished, m_loader, &QObject::deleteLater);
+  connect(m_loader, &XmlFileLoader::chunkLoaded, this, &XmlEdit::chunkLoaded);
+  connect(m_loader, &XmlFileLoader::loaded, this, &XmlEdit::fileLoaded);
+  connect(
+    m_loader, &XmlFileLoader::loadFailed, this, &XmlEdit::fileLoadFailed);
+  connect(m_loader->parser(),
+          &XmlEventParser::sendError,
+          this,
+          &XmlEdit::sendError);
+  connect(m_loader->parser(),
+          &XmlEventParser::sendWarning,
           this,
-          &XmlEdit::textHasChanged);
-  m_highlighter->rehighlight();
+          &XmlEdit::sendWarning);
+  m_loadThread->start();
+}
+
+void
+XmlEdit::loadProgressively(const QString& filename)
+{
+  QXML_TRACE_SCOPE("XmlEdit::loadProgressively");
+  initLoader();
+  m_xmlDocument->beginText();
+  // the chunks are appended as they arrive, none of them is an edit and
+  // none of them can be undone.
+  LNPlainTextEdit::document()->setUndoRedoEnabled(false);
+  QPlainTextEdit::setPlainText(QString());
+  m_xmlDocument->setReadOnly(true);
+  m_loading = true;
+
+  m_loadSoftBreaks.clear();
+
+  auto generation = ++m_loadGeneration;
+  auto loader = m_loader;
+  auto threshold = m_longLineThreshold;
+  QMetaObject::invokeMethod(
+    loader,
+    [loader, filename, generation, threshold]() {
+      loader->load(filename, generation, threshold);
+    },
+    Qt::QueuedConnection);
+}
+
+void
+XmlEdit::chunkLoaded(int generation,
+                     const QString& text,
+                     const QVector<int>& softBreaks,
+                     qint64 read,
+                     qint64 total)
+{
+  if (generation != m_loadGeneration)
+    return;
+  QXML_TRACE_SCOPE("XmlEdit::chunkLoaded");
+  m_loadSoftBreaks += softBreaks;
+  // the user's cursor and scroll position stay where they are.
+  QTextCursor cursor(LNPlainTextEdit::document());
+  cursor.movePosition(QTextCursor::End);
+  cursor.insertText(text);
+  emit loadProgress(read, total);
+}
+
+void
+XmlEdit::fileLoaded(int generation, bool wellFormed)
+{
+  if (generation != m_loadGeneration)
+    return;
+  QXML_TRACE_SCOPE("XmlEdit::fileLoaded");
+  finishLoading();
+  // the tree was built on the loader thread from the text as shown, only
+  // the positions are left to find.
+  m_xmlDocument->setSoftBreaks(m_loadSoftBreaks);
+  m_xmlDocument->endText(*m_loader->parser(), wellFormed);
+  highlightVisibleBlocks();
+  emit loadFinished();
+}
+
+void
+XmlEdit::fileLoadFailed(int generation, const QString& message)
+{
+  if (generation != m_loadGeneration)
+    return;
+  finishLoading();
+  // whatever part of the file arrived is dropped with the load.
+  QPlainTextEdit::setPlainText(QString());
+  m_xmlDocument->endText(QString());
+  emit sendError(message);
+  emit loadFinished();
+}
+
+void
+XmlEdit::finishLoading()
+{
+  m_loading = false;
+  LNPlainTextEdit::document()->setUndoRedoEnabled(true);
+  m_xmlDocument->setReadOnly(false);
+}
+
+bool
+XmlEdit::hasLongLines(const QString& text) const
+{
+  if (m_longLineThreshold <= 0)
+    return false;
+
+  static const XmlScanner newlineScanner("\n");
+  std::vector<uint32_t> newlines;
+  auto data = reinterpret_cast<const char16_t*>(text.utf16());
+  auto length = int(text.length());
+  newlineScanner.scan(data, size_t(length), newlines);
+  auto longest = 0;
+  auto lineStart = 0;
+  for (auto newline : newlines) {
+    longest = qMax(longest, int(newline) - lineStart);
+    lineStart = int(newline) + 1;
+  }
+  longest = qMax(longest, length - lineStart);
+  return longest > m_longLineThreshold;
+}
+
+QString
+XmlEdit::softReformat(const QString& text)
+{
+  if (!hasLongLines(text))
+    return text;
+
+  QXML_TRACE_SCOPE("XmlEdit::softReformat");
+  XmlSoftReformatter reformatter(m_longLineThreshold);
+  reformatter.setBreaking(true);
+  auto shown = reformatter.reformat(text, true);
+  m_xmlDocument->setSoftBreaks(reformatter.softBreaks());
+  return shown;
+}
+
+int
+XmlEdit::longLineThreshold() const
+{
+  return m_longLineThreshold;
+}
+
+void
+XmlEdit::setLongLineThreshold(int threshold)
+{
+  m_longLineThreshold = qMax(0, threshold);
+}
+
+bool
+XmlEdit::isSoftReformatted() const
+{
+  return m_xmlDocument->isSoftReformatted();
+}
+
+QString
+XmlEdit::sourceText() const
+{
+  auto shown = LNPlainTextEdit::document()->toPlainText();
+  if (!m_xmlDocument->isSoftReformatted())
+    return shown;
+  QString text;
+  text.reserve(shown.length());
+  auto from = 0;
+  for (auto softBreak : m_xmlDocument->softBreaks()) {
+    text.append(shown.constData() + from, softBreak - from);
+    from = softBreak + 1;
+  }
+  text.append(shown.constData() + from, shown.length() - from);
+  return text;
+}
+
+int
+XmlEdit::sourcePosition(int position) const
+{
+  // every soft break before position is one character the source lacks.
+  const auto& softBreaks = m_xmlDocument->softBreaks();
+  auto before =
+    std::lower_bound(softBreaks.cbegin(), softBreaks.cend(), position) -
+    softBreaks.cbegin();
+  return position - int(before);
+}
+
+int
+XmlEdit::viewPosition(int sourcePosition) const
+{
+  // break n sits at view position b, so source positions from b - n on are
+  // shifted by n + 1.
+  const auto& softBreaks = m_xmlDocument->softBreaks();
+  auto low = 0;
+  auto high = int(softBreaks.size());
+  while (low < high) {
+    auto middle = (low + high) / 2;
+    if (softBreaks.at(middle) - middle <= sourcePosition)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return sourcePosition + low;
+}
+
+XmlHighlighter::Mode
+XmlEdit::highlightMode() const
+{
+  return m_highlighter->mode();
+}
+
+void
+XmlEdit::setHighlightMode(XmlHighlighter::Mode mode)
+{
+  if (mode == m_highlighter->mode())
+    return;
+  m_highlighter->setMode(mode);
+  if (mode == XmlHighlighter::TreeMode)
+    m_xmlDocument->requestFormatRuns(
+      LNPlainTextEdit::document()->toPlainText());
+  m_xmlDocument->updateHighlighting();
+}
+
+void
+XmlEdit::reparse()
+{
+  m_xmlDocument->reparse();
 }
 
 Node*
@@ -205,12 +764,6 @@ XmlEdit::optionsDialog()
 //   }
 // }
 
-void
-XmlEdit::textHasChanged(int position, int charsRemoved, int charsAdded)
-{
-  // TODO
-}
-
 //====================================================================
 //=== XmlEditSettingsWidget
 //====================================================================
@@ -371,6 +924,12 @@ XmlEditSettings::load()
   return true;
 }
 
+void
+XmlEditSettings::setHighlighter(XmlHighlighter* highlighter)
+{
+  m_highlighter = highlighter;
+}
+
 QString
 XmlEditSettings::filename() const
 {
@@ -382,3 +941,30 @@ XmlEditSettings::setFilename(const QString& Filename)
 {
   m_filename = Filename;
 }
+
+//====================================================================
+//=== XmlFoldArea
+//====================================================================
+XmlFoldArea::XmlFoldArea(XmlEdit* editor)
+  : QWidget(editor)
+  , m_editor(editor)
+{
+}
+
+QSize
+XmlFoldArea::sizeHint() const
+{
+  return QSize(WIDTH, 0);
+}
+
+void
+XmlFoldArea::paintEvent(QPaintEvent* event)
+{
+  m_editor->paintFoldArea(event);
+}
+
+void
+XmlFoldArea::mousePressEvent(QMouseEvent* event)
+{
+  m_editor->foldAreaClicked(event->pos());
+}
@@ -1,11 +1,23 @@
 #include "qxml/xmleventparser.h"
+#include "qxml/xmlmemory.h"
+#include "qxml/xmlscanner.h"
+#include "qxml/xmltrace.h"
 #include "SMLibraries/utilities/characters.h"
 #include "SMLibraries/utilities/filedownloader.h"
 
+#include <QHash>
 #include <QRegularExpression>
 #include <QRegularExpressionMatch>
 #include <QThread>
 
+#include <libxml/parser.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
 //====================================================================
 //=== XmlEventParser
 //====================================================================
@@ -53,19 +65,218 @@ const QRegularExpression XmlEventParser::STANDALONE_VALUE_REGEX =
                      QRegularExpression::CaseInsensitiveOption |
                        QRegularExpression::MultilineOption);
 
+//! Estimates the heap taken by a node of size bytes with cursors positioned
+//! cursors and strings bytes of strings, and by its entries in nodes() and
+//! in the children of its parent.
+static XmlEventParser::MemoryUsage
+nodeUsage(size_t size, int cursors, qint64 strings)
+{
+  XmlEventParser::MemoryUsage usage;
+  usage.nodes = qint64(size) + XmlMemory::ALLOCATION_BYTES +
+                2 * qint64(sizeof(Node*));
+  usage.cursors = cursors * XmlMemory::CURSOR_BYTES;
+  usage.strings = strings;
+  return usage;
+}
+
+//====================================================================
+//=== XmlEventParser::Handler
+//====================================================================
+/*
+ * Drives a libxml push parser and forwards its SAX callbacks to the
+ * XmlEventParser, as xml::event_parser would. A libxml push parser can not be
+ * restarted once parse_finish() has been called so a new handler is created
+ * for every parse.
+ *
+ * The context is made here rather than by xmlwrapp, which offers no way to
+ * set its options. The text may come from anywhere, so nothing is fetched
+ * over the network, entities are not substituted and libxml keeps the caps
+ * it drops with XML_PARSE_HUGE. As with xmlwrapp, the entities a document
+ * declares are not looked up, a reference to one fails the parse before
+ * anything is expanded. The predefined ones and character references are
+ * still delivered.
+ */
+class XmlEventParser::Handler
+{
+public:
+  explicit Handler(XmlEventParser* parser)
+    : m_parser(parser)
+  {
+    std::memset(&m_sax, 0, sizeof(m_sax));
+    m_sax.startElement = startElement;
+    m_sax.endElement = endElement;
+    m_sax.characters = characters;
+    m_sax.ignorableWhitespace = characters;
+    m_sax.cdataBlock = cdataBlock;
+    m_sax.processingInstruction = processingInstruction;
+    m_sax.comment = comment;
+    m_sax.warning = warning;
+    m_sax.error = error;
+    m_sax.fatalError = error;
+    m_context = xmlCreatePushParserCtxt(&m_sax, this, nullptr, 0, nullptr);
+    if (m_context)
+      xmlCtxtUseOptions(m_context, XML_PARSE_NONET);
+    else
+      m_success = false;
+  }
+  ~Handler()
+  {
+    if (!m_context)
+      return;
+    // libxml keeps the declared entities in a document of its own.
+    if (m_context->myDoc)
+      xmlFreeDoc(m_context->myDoc);
+    xmlFreeParserCtxt(m_context);
+  }
+
+  bool parse_chunk(const char* data, size_t length)
+  {
+    if (!m_success)
+      return false;
+    xmlParseChunk(m_context, data, int(length), 0);
+    return m_success = m_success && m_context->wellFormed;
+  }
+  bool parse_finish()
+  {
+    if (!m_success)
+      return false;
+    xmlParseChunk(m_context, nullptr, 0, 1);
+    return m_success = m_success && m_context->wellFormed;
+  }
+  const std::string& get_error_message() const { return m_errorMessage; }
+
+private:
+  XmlEventParser* m_parser;
+  xmlSAXHandler m_sax;
+  xmlParserCtxtPtr m_context = nullptr;
+  bool m_success = true;
+  std::string m_errorMessage;
+
+  static Handler* handlerOf(void* context)
+  {
+    return static_cast<Handler*>(context);
+  }
+  static std::string stringOf(const xmlChar* text)
+  {
+    return text ? std::string(reinterpret_cast<const char*>(text))
+                : std::string();
+  }
+  //! Stops the parse if a callback refused what it was given.
+  void check(bool accepted)
+  {
+    if (accepted || !m_success)
+      return;
+    m_success = false;
+    xmlStopParser(m_context);
+  }
+
+  static void startElement(void* context,
+                           const xmlChar* name,
+                           const xmlChar** attributes)
+  {
+    xml::event_parser::attrs_type attrs;
+    for (auto i = 0; attributes && attributes[i]; i += 2) {
+      // without entity substitution libxml writes a literal & in a value as
+      // &#38; so that it can be told from an entity reference.
+      auto value = stringOf(attributes[i + 1]);
+      for (auto at = value.find("&#38;"); at != std::string::npos;
+           at = value.find("&#38;", at + 1))
+        value.replace(at, 5, "&");
+      attrs.emplace(stringOf(attributes[i]), std::move(value));
+    }
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->start_element(stringOf(name), attrs));
+  }
+  static void endElement(void* context, const xmlChar* name)
+  {
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->end_element(stringOf(name)));
+  }
+  static void characters(void* context, const xmlChar* text, int length)
+  {
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->text(
+      std::string(reinterpret_cast<const char*>(text), size_t(length))));
+  }
+  static void cdataBlock(void* context, const xmlChar* text, int length)
+  {
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->cdata(
+      std::string(reinterpret_cast<const char*>(text), size_t(length))));
+  }
+  static void processingInstruction(void* context,
+                                    const xmlChar* target,
+                                    const xmlChar* data)
+  {
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->processing_instruction(
+      stringOf(target), stringOf(data)));
+  }
+  static void comment(void* context, const xmlChar* text)
+  {
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->comment(stringOf(text)));
+  }
+  static std::string format(const char* message, va_list arguments)
+  {
+    char buffer[1024];
+    std::vsnprintf(buffer, sizeof(buffer), message, arguments);
+    return buffer;
+  }
+  static void warning(void* context, const char* message, ...)
+  {
+    va_list arguments;
+    va_start(arguments, message);
+    auto text = format(message, arguments);
+    va_end(arguments);
+    auto handler = handlerOf(context);
+    handler->check(handler->m_parser->warning(text));
+  }
+  static void error(void* context, const char* message, ...)
+  {
+    va_list arguments;
+    va_start(arguments, message);
+    auto text = format(message, arguments);
+    va_end(arguments);
+    auto handler = handlerOf(context);
+    handler->m_errorMessage += text;
+    handler->check(false);
+  }
+};
+
 //====================================================================
 
 XmlEventParser::XmlEventParser(QTextDocument* document, QObject* parent)
   : QObject{ parent }
   , m_document(document)
 {
+  // connected before any highlighter of the document, so the index has
+  // moved by the time the edited block is highlighted.
+  if (m_document)
+    connect(m_document,
+            &QTextDocument::contentsChange,
+            this,
+            &XmlEventParser::shiftBlockIndex);
 }
 
 XmlEventParser::~XmlEventParser()
 {
-  if (m_rootNode) {
-    delete (m_rootNode);
-  }
+  delete m_chunkHandler;
+  clear();
+}
+
+void
+XmlEventParser::clear()
+{
+  // every node, including the root, is in m_nodes.
+  qDeleteAll(m_nodes);
+  m_nodes.clear();
+  m_errors.clear();
+  m_blockIndex.clear();
+  m_blockIndexRevision = -1;
+  m_rootNode = nullptr;
+  m_parentNode = nullptr;
+  m_treeUsage = MemoryUsage();
 }
 
 bool
@@ -99,19 +310,373 @@ XmlEventParser::parseFile(const QString& filename)
 bool
 XmlEventParser::parseString(const QString& text)
 {
-  parse_chunk(text.toStdString().c_str(), text.length());
-  auto success = parse_finish();
-  auto error = get_error_message();
+  QXML_TRACE_SCOPE("XmlEventParser::parseString");
+  // The previous tree is kept until the new one is known to be good, so that
+  // a half typed tag does not take the highlighting away and so that the
+  // change can be measured against it. Only text that exceeded a bound
+  // drops it.
+  auto previous = takeTree();
+  // libxml is handed bytes, text.length() counts UTF-16 code units.
+  auto bytes = text.toUtf8();
+  startLimits();
+  m_inputBytes = bytes.size();
+  Handler handler(this);
+  {
+    QXML_TRACE_SCOPE("xml::event_parser::parse_chunk");
+    handler.parse_chunk(bytes.constData(), bytes.size());
+  }
+  bool success;
+  {
+    QXML_TRACE_SCOPE("xml::event_parser::parse_finish");
+    success = handler.parse_finish();
+  }
+  m_errorMessage = QString::fromStdString(handler.get_error_message());
   if (!success) {
     // OK not well formed so work through it.
+    finishLimits();
+    clear();
+    m_changedRange = TextRange();
+    // input that exceeded a bound leaves no tree at all, the caller must
+    // not mistake the previous one for it.
+    if (m_limitError.limit != NoLimitExceeded)
+      qDeleteAll(previous.nodes);
+    else
+      restoreTree(previous);
     return false;
   }
   // detect xml declaration if any
   getXmlDeclaration(text);
   calculateNodePositions(text);
+  m_changedRange = changedRange(previous.nodes, m_nodes);
+  qDeleteAll(previous.nodes);
+  return true;
+}
+
+void
+XmlEventParser::beginChunks()
+{
+  QXML_TRACE_SCOPE("XmlEventParser::beginChunks");
+  delete m_chunkHandler;
+  clear();
+  m_errorMessage.clear();
+  m_changedRange = TextRange();
+  startLimits();
+  m_chunkHandler = new Handler(this);
+  m_chunksWellFormed = true;
+}
+
+bool
+XmlEventParser::parseChunk(const char* data, int length)
+{
+  if (!m_chunkHandler || !m_chunksWellFormed)
+    return false;
+  QXML_TRACE_SCOPE("xml::event_parser::parse_chunk");
+  m_inputBytes += length;
+  m_chunksWellFormed = m_chunkHandler->parse_chunk(data, size_t(length));
+  return m_chunksWellFormed;
+}
+
+bool
+XmlEventParser::finishChunks()
+{
+  if (!m_chunkHandler)
+    return false;
+  QXML_TRACE_SCOPE("xml::event_parser::parse_finish");
+  // parse_finish() reports a document that ends early, such as an unclosed
+  // root element, which no chunk on its own can.
+  auto success = m_chunkHandler->parse_finish() && m_chunksWellFormed;
+  m_errorMessage = QString::fromStdString(m_chunkHandler->get_error_message());
+  delete m_chunkHandler;
+  m_chunkHandler = nullptr;
+  if (!success) {
+    finishLimits();
+    clear();
+  }
+  return success;
+}
+
+XmlEventParser::Limits
+XmlEventParser::Limits::untrusted()
+{
+  Limits limits;
+  limits.maxDepth = 256;
+  limits.maxNodes = 1000000;
+  limits.maxAttributes = 256;
+  limits.maxNameLength = 1024;
+  limits.maxTextLength = 10 * 1024 * 1024;
+  limits.maxTreeBytes = qint64(256) * 1024 * 1024;
+  limits.maxExpansion = 10;
+  return limits;
+}
+
+const XmlEventParser::Limits&
+XmlEventParser::limits() const
+{
+  return m_limits;
+}
+
+void
+XmlEventParser::setLimits(const Limits& limits)
+{
+  m_limits = limits;
+}
+
+const XmlEventParser::LimitError&
+XmlEventParser::limitError() const
+{
+  return m_limitError;
+}
+
+void
+XmlEventParser::startLimits()
+{
+  m_limitError = LimitError();
+  m_inputBytes = 0;
+  m_deliveredBytes = 0;
+  m_treeBytes = 0;
+  m_textRunBytes = 0;
+}
+
+void
+XmlEventParser::finishLimits()
+{
+  // libxml only knows that a callback stopped the parse.
+  QString message;
+  switch (m_limitError.limit) {
+    case NoLimitExceeded:
+      return;
+    case DepthLimit:
+      message = tr("Elements are nested deeper than %1");
+      break;
+    case NodeLimit:
+      message = tr("There are more than %1 nodes");
+      break;
+    case AttributeLimit:
+      message = tr("An element has more than %1 attributes");
+      break;
+    case NameLengthLimit:
+      message = tr("A name is longer than %1 bytes");
+      break;
+    case TextLengthLimit:
+      message = tr("Text is longer than %1 bytes");
+      break;
+    case TreeBytesLimit:
+      message = tr("The tree takes more than %1 bytes");
+      break;
+    case EntityExpansionLimit:
+      message = tr("Entities expand the text beyond %1 bytes");
+      break;
+  }
+  m_errorMessage = message.arg(m_limitError.maximum);
+  if (!m_limitError.name.isEmpty())
+    m_errorMessage += QStringLiteral(": %1").arg(m_limitError.name);
+}
+
+bool
+XmlEventParser::exceeds(LimitType limit,
+                        qint64 maximum,
+                        qint64 value,
+                        const std::string& name)
+{
+  if (maximum <= 0 || value <= maximum)
+    return false;
+  m_limitError.limit = limit;
+  m_limitError.maximum = maximum;
+  m_limitError.value = value;
+  m_limitError.name = QString::fromStdString(name);
+  m_limitError.depth =
+    m_parentNode ? static_cast<StartNode*>(m_parentNode)->depth + 1 : 0;
+  m_limitError.nodeCount = int(m_nodes.size());
   return true;
 }
 
+bool
+XmlEventParser::admit(qint64 delivered,
+                      const MemoryUsage& added,
+                      const std::string& name)
+{
+  // entities are the only way to deliver more than the input holds. Short
+  // inputs get some slack.
+  m_deliveredBytes += delivered;
+  m_treeBytes += added.total();
+  m_treeUsage.nodes += added.nodes;
+  m_treeUsage.attributes += added.attributes;
+  m_treeUsage.strings += added.strings;
+  m_treeUsage.cursors += added.cursors;
+  auto input = qMax<qint64>(m_inputBytes, 1024);
+  return !exceeds(NodeLimit, m_limits.maxNodes, m_nodes.size() + 1, name) &&
+         !exceeds(TreeBytesLimit, m_limits.maxTreeBytes, m_treeBytes, name) &&
+         !exceeds(EntityExpansionLimit,
+                  m_limits.maxExpansion * input,
+                  m_deliveredBytes,
+                  name);
+}
+
+void
+XmlEventParser::adoptTree(XmlEventParser& other, const QString& text)
+{
+  QXML_TRACE_SCOPE("XmlEventParser::adoptTree");
+  auto previous = takeTree();
+  auto tree = other.takeTree();
+  restoreTree(tree);
+  m_errorMessage = other.m_errorMessage;
+  getXmlDeclaration(text);
+  calculateNodePositions(text);
+  m_changedRange = changedRange(previous.nodes, m_nodes);
+  qDeleteAll(previous.nodes);
+}
+
+XmlEventParser::Tree
+XmlEventParser::takeTree()
+{
+  Tree tree;
+  tree.nodes.swap(m_nodes);
+  tree.errors.swap(m_errors);
+  tree.blockIndex.swap(m_blockIndex);
+  tree.blockIndexRevision = m_blockIndexRevision;
+  tree.root = m_rootNode;
+  m_blockIndexRevision = -1;
+  m_rootNode = nullptr;
+  m_parentNode = nullptr;
+  tree.usage = m_treeUsage;
+  m_treeUsage = MemoryUsage();
+  return tree;
+}
+
+void
+XmlEventParser::restoreTree(Tree& tree)
+{
+  m_nodes.swap(tree.nodes);
+  m_errors.swap(tree.errors);
+  m_blockIndex.swap(tree.blockIndex);
+  m_blockIndexRevision = tree.blockIndexRevision;
+  m_rootNode = tree.root;
+  m_parentNode = nullptr;
+  m_treeUsage = tree.usage;
+}
+
+/*
+ * True if the two nodes would be formatted identically, the same type, extent
+ * and inner positions.
+ */
+static bool
+sameLayout(Node* a, Node* b)
+{
+  if (a->type != b->type || a->start() != b->start() || a->end() != b->end())
+    return false;
+
+  switch (a->type) {
+    case Node::Start: {
+      auto x = static_cast<StartNode*>(a);
+      auto y = static_cast<StartNode*>(b);
+      if (x->nameStart() != y->nameStart() ||
+          x->nameLength() != y->nameLength() ||
+          x->attributes.size() != y->attributes.size())
+        return false;
+      for (auto i = 0; i < x->attributes.size(); ++i) {
+        auto p = x->attributes.at(i);
+        auto q = y->attributes.at(i);
+        if (p->nameStart() != q->nameStart() ||
+            p->nameLength() != q->nameLength() ||
+            p->hasValue() != q->hasValue() ||
+            (p->hasValue() && (p->valueStart() != q->valueStart() ||
+                               p->valueLength() != q->valueLength())))
+          return false;
+      }
+      return true;
+    }
+    case Node::End: {
+      auto x = static_cast<EndNode*>(a);
+      auto y = static_cast<EndNode*>(b);
+      return x->nameStart() == y->nameStart() &&
+             x->nameLength() == y->nameLength();
+    }
+    case Node::Comment: {
+      auto x = static_cast<CommentNode*>(a);
+      auto y = static_cast<CommentNode*>(b);
+      return x->commentStart() == y->commentStart() &&
+             x->commentLength() == y->commentLength();
+    }
+    case Node::CData: {
+      auto x = static_cast<CDataNode*>(a);
+      auto y = static_cast<CDataNode*>(b);
+      return x->dataStart() == y->dataStart() &&
+             x->dataLength() == y->dataLength();
+    }
+    case Node::Instruction: {
+      auto x = static_cast<ProcessingInstruction*>(a);
+      auto y = static_cast<ProcessingInstruction*>(b);
+      return x->targetStart() == y->targetStart() &&
+             x->targetLength() == y->targetLength() &&
+             x->dataStart() == y->dataStart() &&
+             x->dataLength() == y->dataLength();
+    }
+    case Node::XmlDeclaration: {
+      auto x = static_cast<XmlDeclarationNode*>(a);
+      auto y = static_cast<XmlDeclarationNode*>(b);
+      return x->versionStart() == y->versionStart() &&
+             x->versionValueStart() == y->versionValueStart() &&
+             x->version == y->version &&
+             x->encodingStart() == y->encodingStart() &&
+             x->encodingValueStart() == y->encodingValueStart() &&
+             x->encoding == y->encoding &&
+             x->standaloneStart() == y->standaloneStart() &&
+             x->standaloneValueStart() == y->standaloneValueStart() &&
+             x->standalone == y->standalone;
+    }
+    default:
+      return true;
+  }
+}
+
+XmlEventParser::TextRange
+XmlEventParser::changedRange(const QVector<Node*>& before,
+                             const QVector<Node*>& after)
+{
+  // The positions of the previous nodes have moved with the edits, so the
+  // nodes either side of the edit match and only the middle differs.
+  auto beforeCount = before.size();
+  auto afterCount = after.size();
+  auto common = qMin(beforeCount, afterCount);
+
+  auto head = 0;
+  while (head < common && sameLayout(before.at(head), after.at(head)))
+    ++head;
+  if (head == beforeCount && head == afterCount)
+    return TextRange();
+
+  auto tail = 0;
+  while (tail < common - head &&
+         sameLayout(before.at(beforeCount - 1 - tail),
+                    after.at(afterCount - 1 - tail)))
+    ++tail;
+
+  TextRange range;
+  auto extend = [&range](Node* node) {
+    if (node->start() < 0)
+      return;
+    range.from = (range.from < 0 ? node->start() : qMin(range.from, node->start()));
+    range.to = qMax(range.to, node->end());
+  };
+  for (auto i = head; i < beforeCount - tail; ++i)
+    extend(before.at(i));
+  for (auto i = head; i < afterCount - tail; ++i)
+    extend(after.at(i));
+  return range;
+}
+
+XmlEventParser::TextRange
+XmlEventParser::changedRange() const
+{
+  return m_changedRange;
+}
+
+const QString&
+XmlEventParser::errorMessage() const
+{
+  return m_errorMessage;
+}
+
 bool
 XmlEventParser::parseUrl(QUrl& url)
 {
@@ -198,68 +763,124 @@ XmlEventParser::getXmlDeclaration(const QString& text)
       xml->standaloneValueCursor = createCursor(pos + match.capturedStart(0));
       xml->standalone = match.captured(0);
     }
+    auto hash = Node::combineHash(Node::XmlDeclaration, xml->version);
+    hash = Node::combineHash(hash, xml->encoding);
+    xml->hash = Node::combineHash(hash, xml->standalone);
     m_nodes.prepend(xml);
+    using namespace XmlMemory;
+    m_treeUsage.nodes += qint64(sizeof(XmlDeclarationNode)) +
+                         ALLOCATION_BYTES + qint64(sizeof(Node*));
+    m_treeUsage.strings += stringBytes(xml->name) +
+                           stringBytes(xml->version) +
+                           stringBytes(xml->encoding) +
+                           stringBytes(xml->standalone);
+    for (const auto* cursor :
+         { &xml->startCursor, &xml->endCursor, &xml->nameStartCursor,
+           &xml->versionCursor, &xml->versionAssign, &xml->versionValueCursor,
+           &xml->encodingCursor, &xml->encodingAssign,
+           &xml->encodingValueCursor, &xml->standaloneCursor,
+           &xml->standaloneAssign, &xml->standaloneValueCursor })
+      m_treeUsage.cursors += cursorBytes(cursor->cursor());
   }
 }
 
 void
 XmlEventParser::calculateNodePositions(const QString& text)
 {
+  QXML_TRACE_SCOPE("XmlEventParser::calculateNodePositions");
+  m_blockIndex.clear();
+  m_blockIndexRevision = -1;
   if (text.isEmpty())
     return;
 
+  // The block starts are found in one vectorized scan. The block index is
+  // built in the same forward pass, line(p) is the number of blocks that
+  // start at or before p, less one, and both only ever move forward.
+  auto starts = blockStarts(text);
+  auto blocks = int(starts.size());
+
+  auto line = 0;
+  m_blockIndex.reserve(blocks);
+  m_blockIndex.append(NodeRange());
+  auto advanceTo = [&](int position) {
+    while (line + 1 < blocks && starts[size_t(line + 1)] <= position) {
+      ++line;
+      m_blockIndex.append(NodeRange());
+    }
+  };
+  // the separator ends a block, so a node holds it if it holds the start of
+  // the next block or ends there.
+  auto collectNewLines = [this, &starts](Node* node) {
+    auto first =
+      std::upper_bound(starts.cbegin() + 1, starts.cend(), node->start());
+    auto last = std::upper_bound(first, starts.cend(), node->end());
+    for (auto it = first; it != last; ++it)
+      node->newLines.append(*it - 1);
+    m_treeUsage.nodes += qint64(last - first) * qint64(sizeof(void*));
+  };
+
+  // The < and > of the tags are found by vector scans as well. A tag name
+  // normally follows the next <, the text is only searched for it when
+  // something else, such as a DOCTYPE, comes first.
+  static const XmlScanner openScanner("<");
+  static const XmlScanner closeScanner(">");
+  auto data = reinterpret_cast<const char16_t*>(text.utf16());
+  auto length = size_t(text.length());
+  auto find = [data, length](const XmlScanner& scanner, int from) {
+    if (from < 0 || size_t(from) >= length)
+      return -1;
+    auto at = scanner.find(data, length, size_t(from));
+    return at >= length ? -1 : int(at);
+  };
+  auto findName = [&](const QString& name, int from, int skip) {
+    auto open = find(openScanner, from);
+    if (open >= 0 && open + skip <= int(length) &&
+        QStringView(text).mid(open + skip).startsWith(name) &&
+        (skip == 1 || text.at(open + 1) == '/'))
+      return open + skip;
+    return int(text.indexOf(name, from));
+  };
+
   auto pos = 0;
-  for (auto node : m_nodes) {
+  for (auto index = 0; index < m_nodes.size(); ++index) {
+    auto node = m_nodes.at(index);
     switch (node->type) {
       case Node::Start: {
         auto start = dynamic_cast<StartNode*>(node);
-        pos = text.indexOf(start->name, pos);
+        pos = findName(start->name, pos, 1);
         start->nameStartCursor = createCursor(pos);
         start->startCursor = createCursor(reverseSearchForChar('<', text, pos));
         pos += start->nameLength();
 
-        for (auto& attribute : start->attributes) {
-          pos = text.indexOf(attribute->name, pos);
-          attribute->nameStartCursor = createCursor(pos);
-          pos += attribute->nameLength();
-          pos = text.indexOf('=', pos);
-          attribute->assignCursor = createCursor(pos);
-          if (attribute->hasValue()) {
-            pos = text.indexOf(attribute->value);
-            attribute->valueStartCursor = createCursor(pos);
-            pos += attribute->valueLength();
-          }
-        }
+        pos = calculateAttributePositions(start, text, pos);
 
-        pos = text.indexOf('>', pos);
+        pos = find(closeScanner, pos);
         start->endCursor = createCursor(++pos);
 
-        for (int i = start->startCursor.position();
-             i < start->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            start->newLines.append(i);
-          }
-        }
+        collectNewLines(start);
 
         break;
       }
       case Node::End: {
         auto end = dynamic_cast<EndNode*>(node);
-        pos = text.indexOf(end->name, pos);
+        if (end->opener && index > 0 && m_nodes.at(index - 1) == end->opener &&
+            pos >= 2 && text.at(pos - 2) == '/') {
+          // an empty element tag has no end tag, its end node is empty and
+          // sits at the end of the start tag.
+          end->nameStartCursor = createCursor(pos);
+          end->startCursor = createCursor(pos);
+          end->endCursor = createCursor(pos);
+          break;
+        }
+        pos = findName(end->name, pos, 2);
         end->nameStartCursor = createCursor(pos);
         end->startCursor = createCursor(reverseSearchForChar('<', text, pos));
         pos += end->nameLength();
 
-        pos = text.indexOf('>', pos);
+        pos = find(closeScanner, pos);
         end->endCursor = createCursor(++pos);
 
-        for (int i = end->startCursor.position(); i < end->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            end->newLines.append(i);
-          }
-        }
+        collectNewLines(end);
 
         break;
       }
@@ -270,12 +891,7 @@ XmlEventParser::calculateNodePositions(const QString& text)
         pos += txt->textLength();
         txt->endCursor = createCursor(pos);
 
-        for (int i = txt->startCursor.position(); i < txt->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            txt->newLines.append(i);
-          }
-        }
+        collectNewLines(txt);
 
         break;
       }
@@ -287,13 +903,7 @@ XmlEventParser::calculateNodePositions(const QString& text)
         pos += (comment->commentLength() + 3); // -->
         comment->endCursor = createCursor(pos);
 
-        for (int i = comment->startCursor.position();
-             i < comment->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            comment->newLines.append(i);
-          }
-        }
+        collectNewLines(comment);
 
         break;
       }
@@ -305,13 +915,7 @@ XmlEventParser::calculateNodePositions(const QString& text)
         pos += (comment->dataLength() + 4); // ]]>
         comment->endCursor = createCursor(pos);
 
-        for (int i = comment->startCursor.position();
-             i < comment->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            comment->newLines.append(i);
-          }
-        }
+        collectNewLines(comment);
 
         break;
       }
@@ -325,30 +929,224 @@ XmlEventParser::calculateNodePositions(const QString& text)
         pos = text.indexOf(instruction->data, pos);
         instruction->dataStartCursor = createCursor(pos);
         pos += instruction->dataLength();
-        pos = text.indexOf(">", pos);
+        pos = find(closeScanner, pos);
         instruction->endCursor = createCursor(pos + 1);
 
-        for (int i = instruction->startCursor.position();
-             i < instruction->endCursor.position();
-             ++i) {
-          if (text.at(i) == Characters::NEWLINE) {
-            instruction->newLines.append(i);
-          }
-        }
+        collectNewLines(instruction);
 
         break;
       }
       default:
         break;
     }
+
+    auto nodeStart = node->start();
+    auto nodeEnd = node->end();
+    if (nodeStart < 0 || nodeEnd <= nodeStart)
+      continue;
+    advanceTo(nodeStart);
+    auto firstLine = line;
+    advanceTo(nodeEnd - 1);
+    for (auto b = firstLine; b <= line; ++b) {
+      auto& range = m_blockIndex[b];
+      if (range.count == 0)
+        range.first = index;
+      range.count = index - range.first + 1;
+    }
+  }
+
+  advanceTo(int(text.length()));
+  // the index is only of use for the text of the document.
+  if (m_document && m_blockIndex.size() == m_document->blockCount())
+    m_blockIndexRevision = m_document->revision();
+}
+
+std::vector<int>
+XmlEventParser::blockStarts(const QString& text)
+{
+  // CR and LF are found by a vector scan, the paragraph separator is rare
+  // enough to be searched for on its own.
+  static const XmlScanner separatorScanner("\r\n");
+  std::vector<uint32_t> separators;
+  auto length = int(text.length());
+  separatorScanner.scan(reinterpret_cast<const char16_t*>(text.utf16()),
+                        size_t(length),
+                        separators);
+  std::vector<int> paragraphs;
+  for (auto at = text.indexOf(QChar::ParagraphSeparator); at >= 0;
+       at = text.indexOf(QChar::ParagraphSeparator, at + 1))
+    paragraphs.push_back(int(at));
+
+  std::vector<int> starts;
+  starts.reserve(separators.size() + paragraphs.size() + 1);
+  starts.push_back(0);
+  auto paragraph = paragraphs.cbegin();
+  for (auto separator : separators) {
+    auto at = int(separator);
+    for (; paragraph != paragraphs.cend() && *paragraph < at; ++paragraph)
+      starts.push_back(*paragraph + 1);
+    // the LF of a CR LF pair ends the same block as the CR.
+    if (text.at(at) == '\n' && at > 0 && text.at(at - 1) == '\r')
+      starts.back() = at + 1;
+    else
+      starts.push_back(at + 1);
   }
+  for (; paragraph != paragraphs.cend(); ++paragraph)
+    starts.push_back(*paragraph + 1);
+  return starts;
 }
 
-QTextCursor
+void
+XmlEventParser::shiftBlockIndex(int position,
+                                int charsRemoved,
+                                int charsAdded)
+{
+  Q_UNUSED(charsRemoved)
+  // a format change leaves the revision and the blocks as they were.
+  if (m_blockIndexRevision < 0 ||
+      m_blockIndexRevision == m_document->revision())
+    return;
+  auto oldCount = int(m_blockIndex.size());
+  auto newCount = m_document->blockCount();
+  auto end = qMin(position + charsAdded, m_document->characterCount() - 1);
+  auto first = m_document->findBlock(position).blockNumber();
+  auto last = m_document->findBlock(end).blockNumber();
+  // the blocks from first to last replace those from first to oldLast.
+  auto oldLast = last - (newCount - oldCount);
+  if (first < 0 || last < first || oldLast < first || oldLast >= oldCount) {
+    m_blockIndex.clear();
+    m_blockIndexRevision = -1;
+    return;
+  }
+
+  // the nodes keep their places in nodes() until the reparse, so the new
+  // blocks hold the nodes of the blocks they replace.
+  auto merged = m_blockIndex.at(first);
+  for (auto b = first + 1; b <= oldLast; ++b) {
+    const auto& range = m_blockIndex.at(b);
+    if (range.count == 0)
+      continue;
+    if (merged.count == 0) {
+      merged = range;
+      continue;
+    }
+    auto rangeEnd =
+      qMax(merged.first + merged.count, range.first + range.count);
+    merged.first = qMin(merged.first, range.first);
+    merged.count = rangeEnd - merged.first;
+  }
+  m_blockIndex.remove(first, oldLast - first + 1);
+  m_blockIndex.insert(first, last - first + 1, merged);
+  m_blockIndexRevision = m_document->revision();
+}
+
+XmlEventParser::NodeRange
+XmlEventParser::nodesInBlock(const QTextBlock& block) const
+{
+  auto number = block.blockNumber();
+  if (m_document && m_blockIndexRevision == m_document->revision() &&
+      number >= 0 && number < m_blockIndex.size()) {
+    return m_blockIndex.at(number);
+  }
+
+  // The text has been edited since the index was built, the reparse that
+  // follows will rebuild it. Until then the node positions, which move with
+  // the text, are binary searched.
+  NodeRange range;
+  auto blockStart = block.position();
+  auto blockEnd = blockStart + block.length();
+  auto first = std::partition_point(
+    m_nodes.cbegin(), m_nodes.cend(), [blockStart](Node* node) {
+      return node->end() <= blockStart;
+    });
+  range.first = int(first - m_nodes.cbegin());
+  for (auto it = first; it != m_nodes.cend() && (*it)->start() < blockEnd;
+       ++it) {
+    ++range.count;
+  }
+  return range;
+}
+
+int
+XmlEventParser::calculateAttributePositions(StartNode* start,
+                                            const QString& text,
+                                            int pos)
+{
+  if (start->attributes.isEmpty())
+    return pos;
+
+  // libxml hands the attributes over in a std::map, sorted by name rather
+  // than in document order, so they are read back from the tag text in a
+  // single forward pass. Values are delimited by their quotes as the value
+  // libxml reports has had its entities expanded.
+  QHash<QStringView, XmlAttribute*> byName;
+  byName.reserve(start->attributes.size());
+  for (auto attribute : start->attributes)
+    byName.insert(QStringView(attribute->name), attribute);
+
+  QVector<XmlAttribute*> ordered;
+  ordered.reserve(start->attributes.size());
+  auto length = text.length();
+
+  while (pos < length) {
+    while (pos < length && text.at(pos).isSpace())
+      ++pos;
+    if (pos >= length || text.at(pos) == '>' || text.at(pos) == '/')
+      break;
+
+    auto nameStart = pos;
+    while (pos < length && !text.at(pos).isSpace() && text.at(pos) != '=' &&
+           text.at(pos) != '>' && text.at(pos) != '/')
+      ++pos;
+    auto attribute =
+      byName.value(QStringView(text).mid(nameStart, pos - nameStart), nullptr);
+
+    while (pos < length && text.at(pos).isSpace())
+      ++pos;
+    auto assign = -1;
+    auto valueStart = -1;
+    if (pos < length && text.at(pos) == '=') {
+      assign = pos++;
+      while (pos < length && text.at(pos).isSpace())
+        ++pos;
+      if (pos < length && (text.at(pos) == '"' || text.at(pos) == '\'')) {
+        auto quote = text.at(pos);
+        valueStart = pos + 1;
+        pos = text.indexOf(quote, valueStart);
+        pos = (pos < 0 ? length : pos + 1);
+      }
+    }
+
+    if (attribute) {
+      attribute->nameStartCursor = createCursor(nameStart);
+      if (assign >= 0)
+        attribute->assignCursor = createCursor(assign);
+      if (valueStart >= 0)
+        attribute->valueStartCursor = createCursor(valueStart);
+      ordered.append(attribute);
+      byName.remove(QStringView(attribute->name));
+    }
+  }
+
+  // anything not found in the text, defaulted from a DTD for instance, keeps
+  // its place at the end.
+  for (auto attribute : start->attributes) {
+    if (byName.contains(QStringView(attribute->name)))
+      ordered.append(attribute);
+  }
+  start->attributes = ordered;
+  return pos;
+}
+
+XmlTextPosition
 XmlEventParser::createCursor(int position)
 {
+  if (!m_document)
+    return XmlTextPosition(position);
+  // setPosition is a piece table lookup, movePosition(Right, n) walked the
+  // document one character at a time.
   auto cursor = QTextCursor(m_document);
-  cursor.movePosition(QTextCursor::Right, QTextCursor::MoveAnchor, position);
+  cursor.setPosition(position);
   return cursor;
 }
 
@@ -363,6 +1161,27 @@ XmlEventParser::reverseSearchForChar(QChar c, QString text, int searchFrom)
   return -1;
 }
 
+qint64
+XmlEventParser::MemoryUsage::total() const
+{
+  return nodes + attributes + strings + cursors + errors + indices;
+}
+
+XmlEventParser::MemoryUsage
+XmlEventParser::memoryUsage() const
+{
+  // the tree is tallied as it is parsed, see admit().
+  using namespace XmlMemory;
+  auto usage = m_treeUsage;
+  // a map node holds the key, the value and three links.
+  usage.errors = stringBytes(m_errorMessage);
+  for (auto it = m_errors.cbegin(); it != m_errors.cend(); ++it)
+    usage.errors += stringBytes(it.key()) + qint64(sizeof(QString)) +
+                    4 * qint64(sizeof(void*)) + ALLOCATION_BYTES;
+  usage.indices = vectorBytes(m_nodes) + vectorBytes(m_blockIndex);
+  return usage;
+}
+
 bool
 XmlEventParser::isHaltOnError() const
 {
@@ -388,12 +1207,116 @@ XmlEventParser::rootNode() const
 }
 
 Node *XmlEventParser::nodeForPosition(int position) {
-  for (auto node:m_nodes) {
-    if (node->contains(position)) {
-      return node;
+  return contextAt(position).node;
+}
+
+XmlEventParser::Context
+XmlEventParser::contextAt(int position) const
+{
+  Context context;
+  // the nodes do not overlap and are in document order, the first that ends
+  // after position either holds it or follows it.
+  auto it = std::partition_point(
+    m_nodes.cbegin(), m_nodes.cend(), [position](Node* node) {
+      return node->end() <= position;
+    });
+  if (it == m_nodes.cend())
+    return context;
+
+  auto next = *it;
+  if (next->type == Node::End)
+    context.element = static_cast<EndNode*>(next)->opener;
+  else if (next->type == Node::Start && next->start() <= position)
+    context.element = static_cast<StartNode*>(next);
+  else
+    context.element = static_cast<StartNode*>(next->parent);
+  if (context.element)
+    context.depth = context.element->depth;
+  if (next->start() > position)
+    return context;
+
+  context.node = next;
+  context.region = IsInNode;
+  auto in = [position](int start, int length) {
+    return position >= start && position < start + length;
+  };
+  switch (next->type) {
+    case Node::Start: {
+      auto start = static_cast<StartNode*>(next);
+      if (in(start->nameStart(), start->nameLength())) {
+        context.region = IsInName;
+        break;
+      }
+      // the attributes are in document order, those defaulted from a DTD
+      // have no position and come last.
+      const auto& attributes = start->attributes;
+      auto after = std::partition_point(
+        attributes.cbegin(),
+        attributes.cend(),
+        [position](XmlAttribute* attribute) {
+          auto nameStart = attribute->nameStart();
+          return nameStart >= 0 && nameStart <= position;
+        });
+      if (after == attributes.cbegin())
+        break;
+      auto attribute = *(after - 1);
+      if (in(attribute->nameStart(), attribute->nameLength()))
+        context.region = IsInAttributeName;
+      else if (attribute->hasValue() &&
+               in(attribute->valueStart(), attribute->valueLength()))
+        context.region = IsInAttributeValue;
+      if (context.region != IsInNode)
+        context.attributeIndex = int(after - 1 - attributes.cbegin());
+      break;
+    }
+    case Node::End:
+    case Node::XmlDeclaration: {
+      auto named = static_cast<NameNode*>(next);
+      if (in(named->nameStart(), named->nameLength()))
+        context.region = IsInName;
+      break;
+    }
+    case Node::Text: {
+      auto text = static_cast<TextNode*>(next);
+      if (in(text->start(), text->textLength()))
+        context.region = IsInText;
+      break;
     }
+    case Node::CData: {
+      auto cdata = static_cast<CDataNode*>(next);
+      if (in(cdata->dataStart(), cdata->dataLength()))
+        context.region = IsInText;
+      break;
+    }
+    case Node::Comment: {
+      auto comment = static_cast<CommentNode*>(next);
+      if (in(comment->commentStart(), comment->commentLength()))
+        context.region = IsInComment;
+      break;
+    }
+    case Node::Instruction: {
+      auto instruction = static_cast<ProcessingInstruction*>(next);
+      if (in(instruction->targetStart(), instruction->targetLength()))
+        context.region = IsInPITarget;
+      else if (in(instruction->dataStart(), instruction->dataLength()))
+        context.region = IsInPIData;
+      break;
+    }
+    default:
+      break;
   }
-  return nullptr;
+  return context;
+}
+
+StartNode*
+XmlEventParser::Context::ancestor(int level) const
+{
+  if (level < 0 || level > depth)
+    return nullptr;
+  auto node = element;
+  for (auto d = depth; d > level; --d)
+    node = static_cast<StartNode*>(node->parent);
+  return node;
 }
 
 const QVector<Node*>&
@@ -403,8 +1326,43 @@ XmlEventParser::nodes() const
 }
 
 bool
-XmlEventParser::start_element(const std::string& name, const attrs_type& attrs)
-{
+XmlEventParser::start_element(const std::string& name,
+                              const xml::event_parser::attrs_type& attrs)
+{
+  // the limits are checked before anything is built.
+  m_textRunBytes = 0;
+  auto depth =
+    m_parentNode ? static_cast<StartNode*>(m_parentNode)->depth + 2 : 1;
+  if (exceeds(DepthLimit, m_limits.maxDepth, depth, name) ||
+      exceeds(
+        NameLengthLimit, m_limits.maxNameLength, qint64(name.size()), name) ||
+      exceeds(
+        AttributeLimit, m_limits.maxAttributes, qint64(attrs.size()), name))
+    return false;
+  auto delivered = qint64(name.size());
+  auto added = nodeUsage(
+    sizeof(StartNode), 3, XmlMemory::stringBytes(qint64(name.size())));
+  for (const auto& [key, value] : attrs) {
+    if (exceeds(NameLengthLimit,
+                m_limits.maxNameLength,
+                qint64(key.size()),
+                key) ||
+        exceeds(TextLengthLimit,
+                m_limits.maxTextLength,
+                qint64(value.size()),
+                key))
+      return false;
+    delivered += qint64(key.size() + value.size());
+    added.attributes += qint64(sizeof(XmlAttribute)) +
+                        XmlMemory::ALLOCATION_BYTES +
+                        qint64(sizeof(XmlAttribute*));
+    added.cursors += 3 * XmlMemory::CURSOR_BYTES;
+    added.strings += XmlMemory::stringBytes(qint64(key.size())) +
+                     XmlMemory::stringBytes(qint64(value.size()));
+  }
+  if (!admit(delivered, added, name))
+    return false;
+
   auto node = new StartNode(QString::fromStdString(name));
   for (const auto& [key, value] : attrs) {
     auto attr = new XmlAttribute(QString::fromStdString(key));
@@ -419,6 +1377,7 @@ XmlEventParser::start_element(const std::string& name, const attrs_type& attrs)
   } else {
     m_parentNode->children.append(node);
     node->parent = m_parentNode;
+    node->depth = static_cast<StartNode*>(m_parentNode)->depth + 1;
     m_parentNode = node;
   }
 
@@ -429,7 +1388,14 @@ XmlEventParser::start_element(const std::string& name, const attrs_type& attrs)
 bool
 XmlEventParser::end_element(const std::string& name)
 {
+  m_textRunBytes = 0;
   if (m_parentNode) {
+    if (!admit(qint64(name.size()),
+               nodeUsage(sizeof(EndNode),
+                         3,
+                         XmlMemory::stringBytes(qint64(name.size()))),
+               name))
+      return false;
     auto node = new EndNode(QString::fromStdString(name));
     auto parent = dynamic_cast<StartNode*>(m_parentNode);
     if (parent) {
@@ -445,6 +1411,20 @@ XmlEventParser::end_element(const std::string& name)
         return true;
       }
       parent->closer = node;
+      node->opener = parent;
+      // libxml hands the attributes over sorted by name, so their order in
+      // the text does not count, and neither does the indentation.
+      auto hash = Node::combineHash(Node::Start, parent->name);
+      for (auto attribute : parent->attributes) {
+        hash = Node::combineHash(hash, attribute->name);
+        hash = Node::combineHash(hash, attribute->value);
+      }
+      for (auto child : parent->children) {
+        if (child->type != Node::Text ||
+            !static_cast<TextNode*>(child)->isWhitespace())
+          hash = Node::combineHash(hash, child->hash);
+      }
+      parent->hash = hash;
     }
     m_parentNode = m_parentNode->parent;
     m_nodes.append(node);
@@ -455,7 +1435,17 @@ XmlEventParser::end_element(const std::string& name)
 bool
 XmlEventParser::text(const std::string& contents)
 {
+  // libxml may deliver one text in several pieces.
+  m_textRunBytes += qint64(contents.size());
+  if (exceeds(TextLengthLimit, m_limits.maxTextLength, m_textRunBytes) ||
+      !admit(qint64(contents.size()),
+             nodeUsage(sizeof(TextNode),
+                       3,
+                       XmlMemory::stringBytes(qint64(contents.size()))),
+             std::string()))
+    return false;
   auto node = new TextNode(QString::fromStdString(contents));
+  node->hash = Node::combineHash(Node::Text, node->text);
   node->parent = m_parentNode;
   if (m_parentNode) {
     m_parentNode->children.append(node);
@@ -467,7 +1457,18 @@ XmlEventParser::text(const std::string& contents)
 bool
 XmlEventParser::cdata(const std::string& contents)
 {
+  m_textRunBytes = 0;
+  if (exceeds(TextLengthLimit,
+              m_limits.maxTextLength,
+              qint64(contents.size())) ||
+      !admit(qint64(contents.size()),
+             nodeUsage(sizeof(CDataNode),
+                       3,
+                       XmlMemory::stringBytes(qint64(contents.size()))),
+             std::string()))
+    return false;
   auto node = new CDataNode(QString::fromStdString(contents));
+  node->hash = Node::combineHash(Node::CData, node->data);
   node->parent = m_parentNode;
   if (m_parentNode) {
     m_parentNode->children.append(node);
@@ -480,8 +1481,24 @@ bool
 XmlEventParser::processing_instruction(const std::string& target,
                                        const std::string& data)
 {
+  m_textRunBytes = 0;
+  if (exceeds(NameLengthLimit,
+              m_limits.maxNameLength,
+              qint64(target.size()),
+              target) ||
+      exceeds(
+        TextLengthLimit, m_limits.maxTextLength, qint64(data.size()), target) ||
+      !admit(qint64(target.size() + data.size()),
+             nodeUsage(sizeof(ProcessingInstruction),
+                       4,
+                       XmlMemory::stringBytes(qint64(target.size())) +
+                         XmlMemory::stringBytes(qint64(data.size()))),
+             target))
+    return false;
   auto node = new ProcessingInstruction(QString::fromStdString(target),
                                         QString::fromStdString(data));
+  node->hash = Node::combineHash(
+    Node::combineHash(Node::Instruction, node->target), node->data);
   node->parent = m_parentNode;
   // processing instruction before first valid xml node.
   // have no parent level.
@@ -495,7 +1512,18 @@ XmlEventParser::processing_instruction(const std::string& target,
 bool
 XmlEventParser::comment(const std::string& contents)
 {
+  m_textRunBytes = 0;
+  if (exceeds(TextLengthLimit,
+              m_limits.maxTextLength,
+              qint64(contents.size())) ||
+      !admit(qint64(contents.size()),
+             nodeUsage(sizeof(CommentNode),
+                       3,
+                       XmlMemory::stringBytes(qint64(contents.size()))),
+             std::string()))
+    return false;
   auto node = new CommentNode(QString::fromStdString(contents));
+  node->hash = Node::combineHash(Node::Comment, node->comment);
   node->parent = m_parentNode;
   if (m_parentNode) {
     // covers comment outside root.
@@ -532,6 +1560,42 @@ XmlEventParser::downloadComplete(const QByteArray& data)
   emit finished();
 }
 
+//====================================================================
+//=== XmlTextPosition
+//====================================================================
+XmlTextPosition::XmlTextPosition(const QTextCursor& cursor)
+  : m_cursor(cursor)
+{
+}
+
+XmlTextPosition::XmlTextPosition(int position)
+  : m_position(position)
+{
+}
+
+int
+XmlTextPosition::position() const
+{
+  return m_cursor.isNull() ? m_position : m_cursor.position();
+}
+
+bool
+XmlTextPosition::isNull() const
+{
+  return m_cursor.isNull() && m_position < 0;
+}
+
+const QTextCursor&
+XmlTextPosition::cursor() const
+{
+  return m_cursor;
+}
+
+XmlTextPosition::operator QTextCursor() const
+{
+  return m_cursor;
+}
+
 //====================================================================
 //=== Attribute
 //====================================================================
@@ -543,31 +1607,31 @@ XmlAttribute::XmlAttribute(const QString& name)
 }
 
 int
-XmlAttribute::nameStart()
+XmlAttribute::nameStart() const
 {
   return nameStartCursor.position();
 }
 
 int
-XmlAttribute::nameLength()
+XmlAttribute::nameLength() const
 {
   return name.length();
 }
 
 int
-XmlAttribute::valueStart()
+XmlAttribute::valueStart() const
 {
   return valueStartCursor.position();
 }
 
 int
-XmlAttribute::valueLength()
+XmlAttribute::valueLength() const
 {
   return value.length();
 }
 
 bool
-XmlAttribute::hasValue()
+XmlAttribute::hasValue() const
 {
   return !value.isEmpty();
 }
@@ -601,19 +1665,19 @@ Node::isIn(int cursorPos)
 }
 
 int
-Node::start()
+Node::start() const
 {
   return startCursor.position();
 }
 
 int
-Node::end()
+Node::end() const
 {
   return endCursor.position();
 }
 
 int
-Node::length()
+Node::length() const
 {
   return end() - start();
 }
@@ -626,7 +1690,32 @@ Node::addSpaces(int n, QString& s)
   }
 }
 
-bool Node::contains(int position) {
+quint64
+Node::combineHash(quint64 seed, quint64 value)
+{
+  // boost's hash_combine, followed by the splitmix64 finalizer.
+  auto x = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+quint64
+Node::combineHash(quint64 seed, const QString& value)
+{
+  // FNV-1a over the UTF-16 code units.
+  quint64 hash = 0xcbf29ce484222325ULL;
+  auto data = value.utf16();
+  for (auto i = 0; i < value.length(); ++i) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return combineHash(seed, hash);
+}
+
+bool Node::contains(int position) const {
   if (position >= start() && position < end()) return true;
   return false;
 }
@@ -642,13 +1731,13 @@ NameNode::NameNode(const QString& name)
 }
 
 int
-NameNode::nameStart()
+NameNode::nameStart() const
 {
   return nameStartCursor.position();
 }
 
 int
-NameNode::nameLength()
+NameNode::nameLength() const
 {
   return name.length();
 }
@@ -686,7 +1775,7 @@ TextNode::toString()
 }
 
 int
-TextNode::textLength()
+TextNode::textLength() const
 {
   return text.length();
 }
@@ -734,7 +1823,7 @@ EndNode::toString()
       s += name;
       continue;
     }
-    if (newLines.contains(i)) {
+    if (std::binary_search(newLines.cbegin(), newLines.cend(), i)) {
       s += Characters::NEWLINE;
       continue;
     }
@@ -788,47 +1877,32 @@ StartNode::isIn(int cursorPos)
 QString
 StartNode::toString()
 {
-  QString s = "<";
-  for (auto i = start() + 1; i < end() - 1; i++) {
-    if (i < s.length())
-      continue;
-
-    if (i == nameStart()) {
-      s += name;
-      i += name.length();
-      continue;
-    }
-
-    if (newLines.contains(i)) {
-      s += Characters::NEWLINE;
-      continue;
-    }
-
-    for (auto att : attributes) {
-      if (i == att->nameStart()) {
-        s += att->name;
-        i += att->name.length();
-        break;
-      }
-
-      if (i == att->assignCursor.position()) {
-        s += Characters::ASSIGNMENT;
-        break;
-      }
-
-      if (!att->value.isEmpty() && i == att->valueStart()) {
-        s += att->value;
-        i += att->value.length();
-        break;
-        ;
-      }
-    }
-
-    // fallback it's a space
-    s.append(Characters::SPACE);
+  // each part is written over the spaces at its offset in the tag, so the
+  // string is allocated once and the attributes are gone through once.
+  auto origin = start();
+  auto size = qMax(length(), 2);
+  QString s(size, QLatin1Char(' '));
+  auto put = [&s, origin, size](int position, const QString& part) {
+    auto at = position - origin;
+    if (position >= 0 && at > 0 && at + int(part.length()) < size)
+      s.replace(at, int(part.length()), part);
+  };
+  s[0] = QLatin1Char('<');
+  put(nameStart(), name);
+  for (auto newLine : newLines) {
+    auto at = newLine - origin;
+    if (at > 0 && at < size - 1)
+      s.replace(at, 1, Characters::NEWLINE);
   }
-  addSpaces(length() - s.length() - 1, s);
-  s += ">";
+  for (auto att : attributes) {
+    put(att->nameStart(), att->name);
+    auto assign = att->assignCursor.position() - origin;
+    if (att->assignCursor.position() >= 0 && assign > 0 && assign < size - 1)
+      s.replace(assign, 1, Characters::ASSIGNMENT);
+    if (!att->value.isEmpty())
+      put(att->valueStart(), att->value);
+  }
+  s[size - 1] = QLatin1Char('>');
   return s;
 }
 
@@ -847,7 +1921,7 @@ CommentNode::CommentNode(const QString& text)
 }
 
 int
-CommentNode::commentStart()
+CommentNode::commentStart() const
 {
   return commentStartCursor.position();
 }
@@ -877,7 +1951,7 @@ CommentNode::isIn(int cursorPos)
 }
 
 int
-CommentNode::commentLength()
+CommentNode::commentLength() const
 {
   return comment.length();
 }
@@ -899,25 +1973,25 @@ ProcessingInstruction::ProcessingInstruction(const QString target,
 }
 
 int
-ProcessingInstruction::targetStart()
+ProcessingInstruction::targetStart() const
 {
   return targetStartCursor.position();
 }
 
 int
-ProcessingInstruction::targetLength()
+ProcessingInstruction::targetLength() const
 {
   return target.length();
 }
 
 int
-ProcessingInstruction::dataStart()
+ProcessingInstruction::dataStart() const
 {
   return dataStartCursor.position();
 }
 
 int
-ProcessingInstruction::dataLength()
+ProcessingInstruction::dataLength() const
 {
   return data.length();
 }
@@ -967,7 +2041,7 @@ CDataNode::CDataNode(const QString& data)
 }
 
 int
-CDataNode::dataStart()
+CDataNode::dataStart() const
 {
   return dataStartCursor.position();
 }
@@ -996,7 +2070,7 @@ CDataNode::isIn(int cursorPos)
 }
 
 int
-CDataNode::dataLength()
+CDataNode::dataLength() const
 {
   return data.length();
 }
@@ -0,0 +1,116 @@
+#include "qxml/xmlfileloader.h"
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlsoftreformatter.h"
+#include "qxml/xmltrace.h"
+
+#include <QFile>
+
+//====================================================================
+//=== XmlFileLoader
+//====================================================================
+XmlFileLoader::XmlFileLoader(QObject* parent)
+  : QObject(parent)
+  , m_parser(new XmlEventParser(nullptr, this))
+{
+  // chunkLoaded() crosses to the GUI thread with the soft breaks.
+  qRegisterMetaType<QVector<int>>();
+}
+
+void
+XmlFileLoader::load(const QString& filename,
+                    int generation,
+                    int longLineThreshold)
+{
+  QXML_TRACE_SCOPE("XmlFileLoader::load");
+  m_cancel = false;
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    emit loadFailed(generation, file.errorString());
+    return;
+  }
+
+  auto total = file.size();
+  m_parser->beginChunks();
+  XmlSoftReformatter reformatter(longLineThreshold);
+  // the bytes of a character or of a CR LF pair split by a chunk boundary,
+  // carried over to the next chunk.
+  QByteArray carry;
+  auto chunkSize = FIRST_CHUNK_BYTES;
+  auto first = true;
+  while (!file.atEnd()) {
+    if (m_cancel) {
+      m_parser->finishChunks();
+      return;
+    }
+    auto bytes = file.read(chunkSize);
+    if (bytes.isEmpty()) {
+      m_parser->finishChunks();
+      emit loadFailed(generation, file.errorString());
+      return;
+    }
+    chunkSize = CHUNK_BYTES;
+    // without soft reformatting libxml is given the bytes as read, they are
+    // already UTF-8.
+    if (longLineThreshold <= 0)
+      m_parser->parseChunk(bytes.constData(), int(bytes.size()));
+
+    if (!carry.isEmpty()) {
+      bytes.prepend(carry);
+      carry.clear();
+    }
+    auto length = int(bytes.size());
+    if (!file.atEnd()) {
+      length = completeLength(bytes);
+      // the document makes a block separator of a lone CR and of a lone LF
+      // alike, a CR LF pair has to arrive in one chunk.
+      if (length > 0 && bytes.at(length - 1) == '\r')
+        --length;
+    }
+    auto from = 0;
+    if (first && bytes.startsWith("\xEF\xBB\xBF"))
+      from = 3;
+    first = false;
+    carry = bytes.mid(length);
+    auto text = QString::fromUtf8(bytes.constData() + from, length - from);
+    QVector<int> softBreaks;
+    if (longLineThreshold > 0) {
+      // the text shown, soft breaks and all, is the text parsed.
+      auto before = reformatter.softBreaks().size();
+      text = reformatter.reformat(text, file.atEnd());
+      softBreaks = reformatter.softBreaks().mid(before);
+      auto shown = text.toUtf8();
+      m_parser->parseChunk(shown.constData(), int(shown.size()));
+    }
+    emit chunkLoaded(generation, text, softBreaks, file.pos(), total);
+  }
+  emit loaded(generation, m_parser->finishChunks());
+}
+
+void
+XmlFileLoader::cancel()
+{
+  m_cancel = true;
+}
+
+XmlEventParser*
+XmlFileLoader::parser() const
+{
+  return m_parser;
+}
+
+int
+XmlFileLoader::completeLength(const QByteArray& bytes)
+{
+  // Back over at most three continuation bytes, 10xxxxxx, to the lead byte
+  // of the last character and keep it only if all of its bytes are here.
+  auto size = int(bytes.size());
+  auto lead = size - 1;
+  while (lead >= 0 && size - lead <= 3 &&
+         (uchar(bytes.at(lead)) & 0xC0) == 0x80)
+    --lead;
+  if (lead < 0)
+    return size;
+  auto c = uchar(bytes.at(lead));
+  auto needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+  return size - lead >= needed ? size : lead;
+}
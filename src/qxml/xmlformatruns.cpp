@@ -0,0 +1,213 @@
+#include "qxml/xmlformatruns.h"
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlmemory.h"
+#include "qxml/xmlsnapshot.h"
+#include "qxml/xmltrace.h"
+
+#include <algorithm>
+#include <vector>
+
+//====================================================================
+//=== XmlFormatRuns
+//====================================================================
+XmlFormatRuns
+XmlFormatRuns::build(const QString& text,
+                     const QVector<XmlFormatSpan>& spans,
+                     int revision)
+{
+  QXML_TRACE_SCOPE("XmlFormatRuns::build");
+  XmlFormatRuns result;
+  result.m_revision = revision;
+
+  // the blocks are split as the parser splits them for its block index.
+  auto length = int(text.length());
+  auto blockStarts = XmlEventParser::blockStarts(text);
+  auto blockCount = int(blockStarts.size());
+  auto blockEnd = [&](int block) {
+    if (block + 1 >= blockCount)
+      return length;
+    // a CR LF pair is a single separator.
+    auto next = blockStarts[size_t(block + 1)];
+    auto pair = next >= 2 && text.at(next - 1) == '\n' &&
+                text.at(next - 2) == '\r';
+    return next - (pair ? 2 : 1);
+  };
+
+  // Clip every span to the blocks it covers, then group the pieces by block
+  // with a stable counting sort so that each block keeps the span order.
+  QVector<int> pieceBlocks;
+  QVector<XmlFormatRun> pieces;
+  pieceBlocks.reserve(spans.size());
+  pieces.reserve(spans.size());
+  QVector<int> counts(blockCount + 1, 0);
+
+  for (const auto& span : spans) {
+    auto start = qMax(0, span.start);
+    auto end = qMin(length, span.start + span.length);
+    if (end <= start)
+      continue;
+    auto block = int(std::upper_bound(
+                       blockStarts.cbegin(), blockStarts.cend(), start) -
+                     blockStarts.cbegin()) -
+                 1;
+    for (; block < blockCount && blockStarts[size_t(block)] < end; ++block) {
+      auto blockStart = blockStarts[size_t(block)];
+      auto from = qMax(start, blockStart);
+      auto to = qMin(end, blockEnd(block));
+      if (to <= from)
+        continue;
+      pieceBlocks.append(block);
+      pieces.append({ from - blockStart, to - from, span.format });
+      ++counts[block + 1];
+    }
+  }
+
+  for (auto i = 1; i <= blockCount; ++i)
+    counts[i] += counts[i - 1];
+  result.m_first = counts;
+  result.m_runs.resize(pieces.size());
+  for (auto i = 0; i < pieces.size(); ++i)
+    result.m_runs[counts[pieceBlocks.at(i)]++] = pieces.at(i);
+
+  return result;
+}
+
+bool
+XmlFormatRuns::isValidFor(int revision) const
+{
+  return m_revision >= 0 && m_revision == revision;
+}
+
+int
+XmlFormatRuns::revision() const
+{
+  return m_revision;
+}
+
+int
+XmlFormatRuns::blockCount() const
+{
+  return m_first.isEmpty() ? 0 : int(m_first.size()) - 1;
+}
+
+const XmlFormatRun*
+XmlFormatRuns::runsBegin(int number) const
+{
+  if (number < 0 || number >= blockCount())
+    return nullptr;
+  return m_runs.constData() + m_first.at(number);
+}
+
+const XmlFormatRun*
+XmlFormatRuns::runsEnd(int number) const
+{
+  if (number < 0 || number >= blockCount())
+    return nullptr;
+  return m_runs.constData() + m_first.at(number + 1);
+}
+
+qint64
+XmlFormatRuns::memoryUsage() const
+{
+  return XmlMemory::vectorBytes(m_runs) + XmlMemory::vectorBytes(m_first);
+}
+
+//====================================================================
+//=== XmlFormatWorker
+//====================================================================
+XmlFormatWorker::XmlFormatWorker(QObject* parent)
+  : QObject(parent)
+{
+  // runsReady() crosses back to the GUI thread.
+  qRegisterMetaType<XmlFormatRuns>();
+}
+
+QVector<XmlFormatSpan>
+XmlFormatWorker::spansOf(const XmlSnapshot& snapshot)
+{
+  QXML_TRACE_SCOPE("XmlFormatWorker::spansOf");
+  QVector<XmlFormatSpan> spans;
+  spans.reserve(snapshot.nodeCount() * 2);
+  appendSpans(snapshot.root(), 0, spans);
+  return spans;
+}
+
+void
+XmlFormatWorker::appendSpans(const XmlSnapshotNode& node,
+                             int start,
+                             QVector<XmlFormatSpan>& spans)
+{
+  auto append = [&spans](int spanStart, int length, XmlFormatId format) {
+    if (spanStart >= 0 && length > 0)
+      spans.append({ spanStart, length, format });
+  };
+  auto at = [start](int offset) { return offset < 0 ? -1 : start + offset; };
+
+  switch (node.kind) {
+    case XmlSnapshotNode::Declaration:
+      append(at(node.nameOffset), 4, XmlFormatId::Declaration);
+      for (const auto& attribute : node.attributes) {
+        append(at(attribute.nameOffset),
+               int(attribute.name.length()),
+               XmlFormatId::Attribute);
+        append(at(attribute.valueOffset),
+               int(attribute.value.length()),
+               XmlFormatId::Value);
+      }
+      break;
+    case XmlSnapshotNode::Element: {
+      append(start, node.startTagLength, XmlFormatId::Text);
+      append(at(node.nameOffset), int(node.name.length()), XmlFormatId::Name);
+      for (const auto& attribute : node.attributes) {
+        append(at(attribute.nameOffset),
+               int(attribute.name.length()),
+               XmlFormatId::Attribute);
+        append(at(attribute.valueOffset),
+               int(attribute.value.length()),
+               XmlFormatId::Value);
+      }
+      for (const auto& child : node.children)
+        appendSpans(*child.node, start + child.offset, spans);
+      // the end tag follows the children, its name straight after the </.
+      if (node.endTagOffset >= 0) {
+        auto endStart = start + node.endTagOffset;
+        append(endStart, node.length - node.endTagOffset, XmlFormatId::Text);
+        append(endStart + 2, int(node.name.length()), XmlFormatId::Name);
+      }
+      break;
+    }
+    case XmlSnapshotNode::Text:
+      append(start, node.length, XmlFormatId::Text);
+      break;
+    case XmlSnapshotNode::CData:
+      append(start, node.length, XmlFormatId::Text);
+      append(at(node.contentOffset),
+             int(node.content.length()),
+             XmlFormatId::CData);
+      break;
+    case XmlSnapshotNode::Instruction:
+      append(start, node.length, XmlFormatId::Text);
+      append(at(node.nameOffset),
+             int(node.name.length()),
+             XmlFormatId::PiTarget);
+      append(at(node.contentOffset),
+             int(node.content.length()),
+             XmlFormatId::PiData);
+      break;
+    case XmlSnapshotNode::Comment:
+      append(start, node.length, XmlFormatId::Comment);
+      break;
+    case XmlSnapshotNode::Document:
+      for (const auto& child : node.children)
+        appendSpans(*child.node, start + child.offset, spans);
+      break;
+  }
+}
+
+void
+XmlFormatWorker::build(const QString& text,
+                       const std::shared_ptr<const XmlSnapshot>& snapshot)
+{
+  emit runsReady(XmlFormatRuns::build(
+    text, spansOf(*snapshot), snapshot->revision()));
+}
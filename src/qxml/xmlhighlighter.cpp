@@ -1,6 +1,78 @@
 #include "qxml/xmlhighlighter.h"
 #include "SMLibraries/utilities/x11colors.h"
 #include "qxml/xmleventparser.h"
+#include "qxml/xmlmemory.h"
+#include "qxml/xmlscanner.h"
+#include "qxml/xmltrace.h"
+
+#include <QTextBlockUserData>
+#include <QTextLayout>
+
+namespace {
+
+//! Marks a block that has been formatted while formatting is deferred and
+//! keeps the tally of the highlighter up to date with the formats of the
+//! block, the document deletes it with the block.
+class FormattedBlockData : public QTextBlockUserData
+{
+public:
+  explicit FormattedBlockData(qint64* tally)
+    : m_tally(tally)
+  {
+    *m_tally += bytes();
+  }
+  ~FormattedBlockData() override
+  {
+    if (m_tally)
+      *m_tally -= bytes();
+  }
+
+  //! Sets the number of format ranges of the block.
+  void setRanges(int ranges)
+  {
+    if (m_tally)
+      *m_tally += qint64(ranges - m_ranges) * RANGE_BYTES;
+    m_ranges = ranges;
+  }
+  //! Stops the tally, for when the highlighter goes first.
+  void detach() { m_tally = nullptr; }
+
+  bool formatted = false;
+
+private:
+  static constexpr qint64 RANGE_BYTES = sizeof(QTextLayout::FormatRange);
+  int m_ranges = 0;
+  qint64* m_tally;
+
+  qint64 bytes() const
+  {
+    return qint64(sizeof(FormattedBlockData)) +
+           XmlMemory::ALLOCATION_BYTES + m_ranges * RANGE_BYTES;
+  }
+};
+
+//! Returns the offset of the first character of text at or after from that
+//! scanner looks for, -1 if there is none.
+int
+findIn(const XmlScanner& scanner, const QString& text, int from)
+{
+  auto length = size_t(text.length());
+  if (from < 0 || size_t(from) >= length)
+    return -1;
+  auto at = scanner.find(
+    reinterpret_cast<const char16_t*>(text.utf16()), length, size_t(from));
+  return at >= length ? -1 : int(at);
+}
+
+//! Returns true if c may be part of a name. The surrogates of a name
+//! character outside the BMP are let through whole.
+bool
+isNameUnit(QChar c)
+{
+  return c.isSurrogate() || XmlScanner::isNameChar(c.unicode());
+}
+
+} // end of anonymous namespace
 
 XmlHighlighter::XmlHighlighter(XmlEventParser* parser, QTextDocument* parent)
   : QSyntaxHighlighter{ parent }
@@ -49,6 +121,18 @@ XmlHighlighter::XmlHighlighter(XmlEventParser* parser, QTextDocument* parent)
   setCurrentBlockState(NodeComplete);
 }
 
+XmlHighlighter::~XmlHighlighter()
+{
+  auto doc = document();
+  if (!doc)
+    return;
+  for (auto block = doc->begin(); block.isValid(); block = block.next()) {
+    auto data = static_cast<FormattedBlockData*>(block.userData());
+    if (data)
+      data->detach();
+  }
+}
+
 bool
 XmlHighlighter::isFormatable(int start,
                              int length,
@@ -81,14 +165,56 @@ XmlHighlighter::isFormatable(int start,
 void
 XmlHighlighter::highlightBlock(const QString& text)
 {
-  if (m_parser->nodes().isEmpty())
+  QXML_TRACE_SCOPE("XmlHighlighter::highlightBlock");
+  auto data = static_cast<FormattedBlockData*>(currentBlockUserData());
+  if (m_deferred && !(data && data->formatted) && !m_forced) {
+    // QSyntaxHighlighter clears the formats of the block.
+    if (data)
+      data->setRanges(0);
     return;
+  }
+  if (!data) {
+    data = new FormattedBlockData(&m_blockFormatsBytes);
+    setCurrentBlockUserData(data);
+  }
+  data->formatted = true;
+  m_formatCalls = 0;
+  formatBlock(text);
+  data->setRanges(m_formatCalls);
+}
+
+void
+XmlHighlighter::setFormat(int start, int count, const QTextCharFormat& format)
+{
+  // each call splits at most one range of the block in two.
+  ++m_formatCalls;
+  QSyntaxHighlighter::setFormat(start, count, format);
+}
 
+void
+XmlHighlighter::formatBlock(const QString& text)
+{
   auto block = currentBlock();
+  if (m_mode == LexicalMode || m_parser->nodes().isEmpty()) {
+    highlightLexically(text);
+    return;
+  }
+  setCurrentBlockState(NodeComplete);
+
+  if (m_runs.isValidFor(document()->revision())) {
+    auto end = m_runs.runsEnd(block.blockNumber());
+    for (auto run = m_runs.runsBegin(block.blockNumber()); run != end; ++run)
+      setFormat(run->start, run->length, formatFor(run->format));
+    return;
+  }
+
   auto blockStart = block.position();
   auto textLength = text.length();
+  const auto& nodes = m_parser->nodes();
+  auto range = m_parser->nodesInBlock(block);
 
-  for (auto node : m_parser->nodes()) {
+  for (auto index = range.first; index < range.first + range.count; ++index) {
+    auto node = nodes.at(index);
     auto nodeStart = node->start();
     auto nodeEnd = node->end();
 
@@ -208,7 +334,8 @@ XmlHighlighter::highlightBlock(const QString& text)
       }
       case Node::End: {
         auto n = dynamic_cast<EndNode*>(node);
-        if (n) {
+        // the end node of an empty element tag has no text.
+        if (n && n->length() > 0) {
           if (isFormatable(
                 n->start(), n->length(), blockStart, textLength, formatable)) {
             setFormat(formatable.start, formatable.length, m_textFormat);
@@ -280,6 +407,212 @@ XmlHighlighter::highlightBlock(const QString& text)
   }
 }
 
+void
+XmlHighlighter::setFormatRuns(const XmlFormatRuns& runs)
+{
+  m_runs = runs;
+}
+
+const QTextCharFormat&
+XmlHighlighter::formatFor(XmlFormatId id) const
+{
+  switch (id) {
+    case XmlFormatId::Declaration:
+      return m_xmlFormat;
+    case XmlFormatId::Name:
+      return m_nameFormat;
+    case XmlFormatId::Attribute:
+      return m_attrFormat;
+    case XmlFormatId::Value:
+      return m_valueFormat;
+    case XmlFormatId::Comment:
+      return m_commentFormat;
+    case XmlFormatId::CData:
+      return m_cdataFormat;
+    case XmlFormatId::PiTarget:
+      return m_piTargetFormat;
+    case XmlFormatId::PiData:
+      return m_piDataFormat;
+    case XmlFormatId::Text:
+    default:
+      return m_textFormat;
+  }
+}
+
+void
+XmlHighlighter::highlightLexically(const QString& text)
+{
+  // A single forward pass over the block. The state says which construct the
+  // previous block ended inside, QSyntaxHighlighter only moves on to the next
+  // block when the state at the end of this one changes.
+  auto state = previousBlockState();
+  if (state < InTag)
+    state = NodeComplete;
+
+  // the markup characters are found by vector scans, a name runs as far
+  // as the name characters of XmlScanner do.
+  static const XmlScanner openScanner("<");
+  static const XmlScanner closeScanner(">");
+  static const XmlScanner doubleQuoteScanner("\"");
+  static const XmlScanner singleQuoteScanner("'");
+  auto length = int(text.length());
+  auto nameEnd = [&](int from) {
+    while (from < length && isNameUnit(text.at(from)))
+      ++from;
+    return from;
+  };
+  // formats up to the terminator, then the terminator, returns the position
+  // after it or -1 if the construct carries on into the next block. The
+  // scanner finds the last character of the terminator.
+  auto until = [&](int from,
+                   const XmlScanner& scanner,
+                   QLatin1String terminator,
+                   const QTextCharFormat& format,
+                   const QTextCharFormat& terminatorFormat) {
+    auto last = int(terminator.size()) - 1;
+    auto end = -1;
+    for (auto at = findIn(scanner, text, from + last); at >= 0;
+         at = findIn(scanner, text, at + 1)) {
+      if (QStringView(text).mid(at - last, last) == terminator.left(last)) {
+        end = at - last;
+        break;
+      }
+    }
+    setFormat(from, (end < 0 ? length : end) - from, format);
+    if (end < 0)
+      return -1;
+    setFormat(end, last + 1, terminatorFormat);
+    return end + last + 1;
+  };
+
+  auto i = 0;
+  while (i < length) {
+    switch (state) {
+      case InComment: {
+        auto next = until(i, closeScanner, QLatin1String("-->"),
+                          m_commentFormat, m_commentFormat);
+        i = (next < 0 ? length : next);
+        state = (next < 0 ? InComment : NodeComplete);
+        break;
+      }
+      case InCData: {
+        auto next = until(i, closeScanner, QLatin1String("]]>"),
+                          m_cdataFormat, m_textFormat);
+        i = (next < 0 ? length : next);
+        state = (next < 0 ? InCData : NodeComplete);
+        break;
+      }
+      case InProcessingInstruction: {
+        auto next = until(i, closeScanner, QLatin1String("?>"),
+                          m_piDataFormat, m_textFormat);
+        i = (next < 0 ? length : next);
+        state = (next < 0 ? InProcessingInstruction : NodeComplete);
+        break;
+      }
+      case InTagDoubleQuote:
+      case InTagSingleQuote:
+      case InDeclarationDoubleQuote:
+      case InDeclarationSingleQuote: {
+        auto doubleQuote =
+          (state == InTagDoubleQuote || state == InDeclarationDoubleQuote);
+        auto tag = (state == InTagDoubleQuote || state == InTagSingleQuote);
+        auto next = until(i,
+                          doubleQuote ? doubleQuoteScanner
+                                      : singleQuoteScanner,
+                          doubleQuote ? QLatin1String("\"")
+                                      : QLatin1String("'"),
+                          m_valueFormat,
+                          m_textFormat);
+        i = (next < 0 ? length : next);
+        if (next >= 0)
+          state = (tag ? InTag : InDeclaration);
+        break;
+      }
+      case InTag:
+      case InDeclaration: {
+        auto c = text.at(i);
+        if (c == '>') {
+          setFormat(i++, 1, m_textFormat);
+          state = NodeComplete;
+        } else if (c == '"' || c == '\'') {
+          setFormat(i++, 1, m_textFormat);
+          if (state == InTag)
+            state = (c == '"' ? InTagDoubleQuote : InTagSingleQuote);
+          else
+            state = (c == '"' ? InDeclarationDoubleQuote
+                              : InDeclarationSingleQuote);
+        } else if (isNameUnit(c)) {
+          auto end = nameEnd(i);
+          setFormat(i, end - i, m_attrFormat);
+          i = end;
+        } else {
+          setFormat(i++, 1, m_textFormat);
+        }
+        break;
+      }
+      default: {
+        auto open = findIn(openScanner, text, i);
+        if (open < 0) {
+          setFormat(i, length - i, m_textFormat);
+          i = length;
+          break;
+        }
+        if (open > i)
+          setFormat(i, open - i, m_textFormat);
+        i = open;
+        auto rest = QStringView(text).mid(i);
+        if (rest.startsWith(QLatin1String("<!--"))) {
+          setFormat(i, 4, m_commentFormat);
+          i += 4;
+          state = InComment;
+        } else if (rest.startsWith(QLatin1String("<![CDATA["))) {
+          setFormat(i, 9, m_textFormat);
+          i += 9;
+          state = InCData;
+        } else if (rest.startsWith(QLatin1String("<?"))) {
+          setFormat(i, 2, m_textFormat);
+          i += 2;
+          auto end = nameEnd(i);
+          if (QStringView(text).mid(i, end - i) == QLatin1String("xml")) {
+            setFormat(i, end - i, m_xmlFormat);
+            state = InDeclaration;
+          } else {
+            setFormat(i, end - i, m_piTargetFormat);
+            state = InProcessingInstruction;
+          }
+          i = end;
+        } else {
+          // start and end tags, and <!DOCTYPE and the like.
+          auto nameStart = i + 1;
+          if (nameStart < length &&
+              (text.at(nameStart) == '/' || text.at(nameStart) == '!'))
+            ++nameStart;
+          setFormat(i, nameStart - i, m_textFormat);
+          auto end = nameEnd(nameStart);
+          setFormat(nameStart, end - nameStart, m_nameFormat);
+          i = end;
+          state = InTag;
+        }
+        break;
+      }
+    }
+  }
+
+  setCurrentBlockState(state);
+}
+
+XmlHighlighter::Mode
+XmlHighlighter::mode() const
+{
+  return m_mode;
+}
+
+void
+XmlHighlighter::setMode(Mode mode)
+{
+  m_mode = mode;
+}
+
 QColor
 XmlHighlighter::xmlolor() const
 {
@@ -362,6 +695,13 @@ void
 XmlHighlighter::setMatchColor(const QColor& color)
 {
   m_matchColor = color;
+  m_matchFormat.setForeground(m_matchColor);
+}
+
+const QTextCharFormat&
+XmlHighlighter::matchFormat() const
+{
+  return m_matchFormat;
 }
 
 QColor
@@ -435,3 +775,79 @@ XmlHighlighter::setCommentColor(const QColor& color)
 {
   m_commentColor = color;
 }
+
+void
+XmlHighlighter::setDeferred(bool deferred)
+{
+  m_deferred = deferred;
+}
+
+bool
+XmlHighlighter::isDeferred() const
+{
+  return m_deferred;
+}
+
+bool
+XmlHighlighter::formatDeferred(const QTextBlock& block)
+{
+  if (!m_deferred || !block.isValid())
+    return false;
+  auto data = static_cast<FormattedBlockData*>(block.userData());
+  if (data && data->formatted)
+    return false;
+  m_forced = true;
+  rehighlightBlock(block);
+  m_forced = false;
+  return true;
+}
+
+void
+XmlHighlighter::markUnformatted()
+{
+  auto doc = document();
+  if (!doc)
+    return;
+  // the data stays, it still counts the formats of the block.
+  for (auto block = doc->begin(); block.isValid(); block = block.next()) {
+    auto data = static_cast<FormattedBlockData*>(block.userData());
+    if (data)
+      data->formatted = false;
+  }
+}
+
+qint64
+XmlHighlighter::MemoryUsage::total() const
+{
+  return formatRuns + blockFormats;
+}
+
+XmlHighlighter::MemoryUsage
+XmlHighlighter::memoryUsage() const
+{
+  MemoryUsage usage;
+  usage.formatRuns = m_runs.memoryUsage();
+  usage.blockFormats = m_blockFormatsBytes;
+  return usage;
+}
+
+void
+XmlHighlighter::rehighlightRange(int from, int to)
+{
+  auto doc = document();
+  if (!doc || to < from)
+    return;
+  // an edited range is always formatted.
+  m_forced = true;
+  auto block = doc->findBlock(qMax(0, from));
+  auto last = doc->findBlock(qMax(from, to - 1));
+  if (!last.isValid())
+    last = doc->lastBlock();
+  while (block.isValid()) {
+    rehighlightBlock(block);
+    if (block == last)
+      break;
+    block = block.next();
+  }
+  m_forced = false;
+}
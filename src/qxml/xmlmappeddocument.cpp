@@ -0,0 +1,374 @@
+#include "qxml/xmlmappeddocument.h"
+#include "qxml/xmlscanner.h"
+#include "qxml/xmltrace.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/*
+ * Walks the markup of data from..to a construct at a time and keeps open, the
+ * offsets of the start tags of the open elements, up to date. from has to be
+ * outside any markup, which is true of every checkpoint.
+ *
+ * atTag(offset) is called at the < of every construct before it is read and
+ * stops the walk by returning false. Returns the offset the walk stopped at.
+ */
+template<typename AtTag>
+qint64
+walkMarkup(const char* data,
+           qint64 size,
+           qint64 from,
+           qint64 to,
+           QVector<qint64>& open,
+           AtTag atTag)
+{
+  static const XmlScanner tagStart("<");
+  static const XmlScanner tagEnd("\"'>");
+  std::string_view view(data, size_t(size));
+
+  auto endOf = [&](qint64 start, std::string_view terminator) -> qint64 {
+    auto found = view.find(terminator, size_t(start));
+    return found == std::string_view::npos ? size
+                                           : qint64(found + terminator.size());
+  };
+
+  auto position = from;
+  while (position < to) {
+    auto lt = qint64(tagStart.find(data, size_t(size), size_t(position)));
+    if (lt >= to || lt >= size)
+      return to;
+    if (!atTag(lt))
+      return lt;
+
+    auto rest = view.substr(size_t(lt));
+    if (rest.substr(0, 4) == "<!--") {
+      position = endOf(lt + 4, "-->");
+    } else if (rest.substr(0, 9) == "<![CDATA[") {
+      position = endOf(lt + 9, "]]>");
+    } else if (rest.substr(0, 2) == "<?") {
+      position = endOf(lt + 2, "?>");
+    } else if (rest.substr(0, 2) == "<!") {
+      // a doctype, possibly with an internal subset.
+      auto depth = 0;
+      position = lt + 2;
+      while (position < size) {
+        auto c = data[position++];
+        if (c == '[')
+          ++depth;
+        else if (c == ']')
+          --depth;
+        else if (c == '>' && depth <= 0)
+          break;
+      }
+    } else {
+      // a start or end tag, > may appear inside quoted attribute values.
+      auto quote = '\0';
+      position = lt + 1;
+      while (position < size) {
+        position = qint64(tagEnd.find(data, size_t(size), size_t(position)));
+        if (position >= size)
+          break;
+        auto c = data[position++];
+        if (quote != '\0') {
+          if (c == quote)
+            quote = '\0';
+        } else if (c == '"' || c == '\'') {
+          quote = c;
+        } else {
+          break;
+        }
+      }
+      if (rest.substr(0, 2) == "</") {
+        // a position inside the end tag is still inside the element.
+        if (!open.isEmpty() && position < to)
+          open.removeLast();
+      } else if (position < 2 || data[position - 2] != '/' ||
+                 data[position - 1] != '>') {
+        open.append(lt);
+      }
+    }
+  }
+  return position;
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlMappedDocument
+//====================================================================
+XmlMappedDocument::XmlMappedDocument() {}
+
+XmlMappedDocument::~XmlMappedDocument()
+{
+  close();
+}
+
+bool
+XmlMappedDocument::open(const QString& filename)
+{
+  close();
+  m_file.setFileName(filename);
+  if (!m_file.open(QIODevice::ReadOnly))
+    return false;
+
+  m_size = m_file.size();
+  if (m_size > 0) {
+    m_data = reinterpret_cast<const char*>(m_file.map(0, m_size));
+    if (!m_data) {
+      m_file.close();
+      m_size = 0;
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+XmlMappedDocument::close()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_indexed = false;
+    m_lineCount = 0;
+    m_lineIndex.clear();
+    m_checkpoints.clear();
+  }
+  if (m_data)
+    m_file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(m_data)));
+  m_data = nullptr;
+  m_size = 0;
+  if (m_file.isOpen())
+    m_file.close();
+}
+
+bool
+XmlMappedDocument::isOpen() const
+{
+  return m_file.isOpen();
+}
+
+QString
+XmlMappedDocument::filename() const
+{
+  return m_file.fileName();
+}
+
+qint64
+XmlMappedDocument::size() const
+{
+  return m_size;
+}
+
+qint64
+XmlMappedDocument::charStart(qint64 offset) const
+{
+  offset = qBound(qint64(0), offset, m_size);
+  // UTF-8 continuation bytes are 10xxxxxx.
+  while (offset > 0 && offset < m_size &&
+         (uchar(m_data[offset]) & 0xC0) == 0x80)
+    --offset;
+  return offset;
+}
+
+qint64
+XmlMappedDocument::lineStart(qint64 offset, qint64 from) const
+{
+  from = qBound(qint64(0), from, m_size);
+  offset = qBound(from, offset, m_size);
+  if (!m_data)
+    return 0;
+  std::string_view view(m_data + from, size_t(offset - from));
+  auto found = view.rfind('\n');
+  return found == std::string_view::npos ? from : from + qint64(found + 1);
+}
+
+qint64
+XmlMappedDocument::nextLineStart(qint64 offset, qint64 to) const
+{
+  static const XmlScanner newlines("\n");
+  to = to < 0 ? m_size : qMin(to, m_size);
+  offset = qMax(qint64(0), offset);
+  if (!m_data || offset >= to)
+    return to;
+  auto found = qint64(newlines.find(m_data, size_t(to), size_t(offset)));
+  return found >= to ? to : found + 1;
+}
+
+QVector<qint64>
+XmlMappedDocument::lineStarts(qint64 from, qint64 to) const
+{
+  static const XmlScanner newlines("\n");
+  from = qBound(qint64(0), from, m_size);
+  to = qBound(from, to, m_size);
+  QVector<qint64> starts;
+  if (!m_data)
+    return starts;
+  if (from == 0 || m_data[from - 1] == '\n')
+    starts.append(from);
+  std::vector<uint32_t> offsets;
+  newlines.scan(m_data + from, size_t(to - from), offsets, 1);
+  starts.reserve(starts.size() + int(offsets.size()));
+  for (auto offset : offsets)
+    starts.append(from + offset);
+  return starts;
+}
+
+QString
+XmlMappedDocument::text(qint64 from, qint64 to) const
+{
+  from = qBound(qint64(0), from, m_size);
+  to = qBound(from, to, m_size);
+  if (!m_data || to == from)
+    return QString();
+  return QString::fromUtf8(m_data + from, int(to - from));
+}
+
+void
+XmlMappedDocument::buildIndex(const std::atomic<bool>& cancel)
+{
+  QXML_TRACE_SCOPE("XmlMappedDocument::buildIndex");
+  static const XmlScanner newlines("\n");
+  // scanned a slice at a time so that the offsets fit the scanner and cancel
+  // is seen promptly.
+  static const qint64 SLICE = 16 * 1024 * 1024;
+
+  QVector<qint64> lineIndex{ 0 };
+  auto lineCount = qint64(1);
+  std::vector<uint32_t> offsets;
+  for (qint64 slice = 0; slice < m_size; slice += SLICE) {
+    if (cancel)
+      return;
+    auto length = qMin(SLICE, m_size - slice);
+    offsets.clear();
+    newlines.scan(m_data + slice, size_t(length), offsets, 1);
+    for (auto offset : offsets) {
+      if (lineCount % LINE_STRIDE == 0)
+        lineIndex.append(slice + offset);
+      ++lineCount;
+    }
+  }
+
+  QVector<Checkpoint> checkpoints{ Checkpoint() };
+  QVector<qint64> open;
+  auto next = CHECKPOINT_BYTES;
+  auto completed = true;
+  walkMarkup(m_data, m_size, 0, m_size, open, [&](qint64 offset) {
+    if (offset >= next) {
+      if (cancel) {
+        completed = false;
+        return false;
+      }
+      checkpoints.append({ offset, open });
+      next = offset + CHECKPOINT_BYTES;
+    }
+    return true;
+  });
+  if (!completed)
+    return;
+
+  QMutexLocker locker(&m_mutex);
+  m_lineCount = lineCount;
+  m_lineIndex = lineIndex;
+  m_checkpoints = checkpoints;
+  m_indexed = true;
+}
+
+bool
+XmlMappedDocument::isIndexed() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_indexed;
+}
+
+qint64
+XmlMappedDocument::lineCount() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_indexed ? m_lineCount : -1;
+}
+
+qint64
+XmlMappedDocument::lineNumber(qint64 offset) const
+{
+  static const XmlScanner newlines("\n");
+  qint64 line, from;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!m_indexed)
+      return -1;
+    offset = qBound(qint64(0), offset, m_size);
+    auto it =
+      std::upper_bound(m_lineIndex.cbegin(), m_lineIndex.cend(), offset) - 1;
+    line = qint64(it - m_lineIndex.cbegin()) * LINE_STRIDE;
+    from = *it;
+  }
+  // at most LINE_STRIDE newlines to count.
+  std::vector<uint32_t> offsets;
+  newlines.scan(m_data + from, size_t(offset - from), offsets);
+  return line + qint64(offsets.size());
+}
+
+qint64
+XmlMappedDocument::lineOffset(qint64 line) const
+{
+  qint64 offset, remaining;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!m_indexed || line < 0 || line >= m_lineCount)
+      return -1;
+    offset = m_lineIndex.at(int(line / LINE_STRIDE));
+    remaining = line % LINE_STRIDE;
+  }
+  for (; remaining > 0; --remaining)
+    offset = nextLineStart(offset);
+  return offset;
+}
+
+QVector<XmlMappedDocument::Element>
+XmlMappedDocument::elementPath(qint64 offset) const
+{
+  QVector<Element> path;
+  Checkpoint checkpoint;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!m_indexed)
+      return path;
+    offset = qBound(qint64(0), offset, m_size);
+    auto it = std::upper_bound(
+                m_checkpoints.cbegin(),
+                m_checkpoints.cend(),
+                offset,
+                [](qint64 o, const Checkpoint& c) { return o < c.offset; }) -
+              1;
+    checkpoint = *it;
+  }
+
+  // a position inside a start tag belongs to that element, hence offset + 1.
+  auto open = checkpoint.open;
+  walkMarkup(m_data, m_size, checkpoint.offset, offset + 1, open, [](qint64) {
+    return true;
+  });
+  path.reserve(open.size());
+  for (auto start : open)
+    path.append({ start, elementName(start) });
+  return path;
+}
+
+QString
+XmlMappedDocument::elementName(qint64 offset) const
+{
+  auto end = offset + 1;
+  while (end < m_size) {
+    auto c = m_data[end];
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '>' ||
+        c == '/')
+      break;
+    ++end;
+  }
+  return QString::fromUtf8(m_data + offset + 1, int(end - offset - 1));
+}
@@ -0,0 +1,327 @@
+#include "qxml/xmlmappedview.h"
+#include "qxml/xmlhighlighter.h"
+#include "qxml/xmltrace.h"
+
+#include <QHBoxLayout>
+#include <QTextBlock>
+
+#include <algorithm>
+
+//====================================================================
+//=== XmlMappedView
+//====================================================================
+XmlMappedView::XmlMappedView(QWidget* parent)
+  : QWidget(parent)
+  , m_mapped(new XmlMappedDocument())
+  , m_editor(new QPlainTextEdit(this))
+  , m_fileScrollBar(new QScrollBar(Qt::Vertical, this))
+{
+  auto layout = new QHBoxLayout;
+  layout->setContentsMargins(0, 0, 0, 0);
+  layout->setSpacing(0);
+  layout->addWidget(m_editor);
+  layout->addWidget(m_fileScrollBar);
+  setLayout(layout);
+
+  // The window is a slice of the file, the file scroll bar replaces the
+  // editor's. Unwrapped lines keep the editor scroll value a block number.
+  m_editor->setReadOnly(true);
+  m_editor->setLineWrapMode(QPlainTextEdit::NoWrap);
+  m_editor->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+  m_fileScrollBar->setRange(0, 0);
+
+  // Lexical highlighting never touches the parser.
+  m_highlighter = new XmlHighlighter(nullptr, m_editor->document());
+  m_highlighter->setMode(XmlHighlighter::LexicalMode);
+
+  connect(m_editor->verticalScrollBar(),
+          &QScrollBar::valueChanged,
+          this,
+          &XmlMappedView::editorScrolled);
+  connect(m_fileScrollBar,
+          &QScrollBar::valueChanged,
+          this,
+          &XmlMappedView::fileScrolled);
+  connect(m_editor, &QPlainTextEdit::cursorPositionChanged, this, [this]() {
+    emit cursorOffsetChanged(cursorOffset());
+  });
+}
+
+XmlMappedView::~XmlMappedView()
+{
+  stopIndexing();
+  delete m_mapped;
+}
+
+bool
+XmlMappedView::openFile(const QString& filename)
+{
+  closeFile();
+  if (!m_mapped->open(filename))
+    return false;
+
+  loadWindow(0);
+  updateFileScrollBar();
+
+  m_cancelIndex = false;
+  auto thread =
+    QThread::create([this]() { m_mapped->buildIndex(m_cancelIndex); });
+  m_indexThread = thread;
+  connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+  connect(thread, &QThread::finished, this, [this, thread]() {
+    // a thread stopped by closeFile() is no longer m_indexThread.
+    if (thread != m_indexThread)
+      return;
+    m_indexThread = nullptr;
+    if (m_mapped->isIndexed())
+      emit indexed();
+  });
+  thread->start(QThread::LowPriority);
+  return true;
+}
+
+void
+XmlMappedView::closeFile()
+{
+  stopIndexing();
+  m_mapped->close();
+  m_windowStart = m_windowEnd = 0;
+  m_blockOffsets.clear();
+  m_moving = true;
+  m_editor->clear();
+  m_fileScrollBar->setRange(0, 0);
+  m_moving = false;
+}
+
+const XmlMappedDocument*
+XmlMappedView::mappedDocument() const
+{
+  return m_mapped;
+}
+
+QPlainTextEdit*
+XmlMappedView::editor() const
+{
+  return m_editor;
+}
+
+XmlHighlighter*
+XmlMappedView::highlighter() const
+{
+  return m_highlighter;
+}
+
+qint64
+XmlMappedView::windowStart() const
+{
+  return m_windowStart;
+}
+
+qint64
+XmlMappedView::windowEnd() const
+{
+  return m_windowEnd;
+}
+
+qint64
+XmlMappedView::cursorOffset() const
+{
+  return offsetAt(m_editor->textCursor().position());
+}
+
+qint64
+XmlMappedView::currentLine() const
+{
+  return m_mapped->lineNumber(cursorOffset());
+}
+
+QStringList
+XmlMappedView::currentPath() const
+{
+  QStringList path;
+  for (const auto& element : m_mapped->elementPath(cursorOffset()))
+    path.append(element.name);
+  return path;
+}
+
+void
+XmlMappedView::scrollToOffset(qint64 offset)
+{
+  offset = qBound(qint64(0), offset, m_mapped->size());
+  m_moving = true;
+  if (offset < m_windowStart || offset >= m_windowEnd)
+    loadWindow(offset);
+  auto cursor = m_editor->textCursor();
+  cursor.setPosition(positionAt(offset));
+  m_editor->setTextCursor(cursor);
+  showOffsetAtTop(m_mapped->lineStart(offset, m_windowStart));
+  m_moving = false;
+  updateFileScrollBar();
+}
+
+bool
+XmlMappedView::gotoLine(qint64 line)
+{
+  auto offset = m_mapped->lineOffset(line);
+  if (offset < 0)
+    return false;
+  scrollToOffset(offset);
+  return true;
+}
+
+void
+XmlMappedView::loadWindow(qint64 around)
+{
+  QXML_TRACE_SCOPE("XmlMappedView::loadWindow");
+  auto size = m_mapped->size();
+  auto half = WINDOW_BYTES / 2;
+
+  // Whole lines where possible, a line longer than the window is cut at a
+  // character boundary.
+  auto target = qBound(qint64(0), around - half, size);
+  auto start = m_mapped->lineStart(target, qMax(qint64(0), target - half));
+  if (start != 0 && start == qMax(qint64(0), target - half))
+    start = m_mapped->charStart(target);
+  target = qMin(size, start + WINDOW_BYTES);
+  auto end = m_mapped->nextLineStart(target, target + half);
+  if (end == target + half)
+    end = m_mapped->charStart(target);
+
+  m_windowStart = start;
+  m_windowEnd = end;
+  m_blockOffsets = m_mapped->lineStarts(start, end);
+  if (m_blockOffsets.isEmpty() || m_blockOffsets.first() != start)
+    m_blockOffsets.prepend(start);
+
+  auto moving = m_moving;
+  m_moving = true;
+  m_editor->setPlainText(m_mapped->text(start, end));
+  m_moving = moving;
+}
+
+void
+XmlMappedView::editorScrolled(int value)
+{
+  if (m_moving || !m_mapped->isOpen())
+    return;
+
+  auto scrollBar = m_editor->verticalScrollBar();
+  auto margin = scrollBar->maximum() / 8;
+  auto nearStart = value < margin && m_windowStart > 0;
+  auto nearEnd =
+    value > scrollBar->maximum() - margin && m_windowEnd < m_mapped->size();
+  if (nearStart || nearEnd) {
+    auto top = topOffset();
+    auto cursor = cursorOffset();
+    m_moving = true;
+    loadWindow(top);
+    if (cursor >= m_windowStart && cursor < m_windowEnd) {
+      auto textCursor = m_editor->textCursor();
+      textCursor.setPosition(positionAt(cursor));
+      m_editor->setTextCursor(textCursor);
+    }
+    showOffsetAtTop(top);
+    m_moving = false;
+  }
+  updateFileScrollBar();
+}
+
+void
+XmlMappedView::fileScrolled(int value)
+{
+  if (m_moving || !m_mapped->isOpen())
+    return;
+
+  auto size = m_mapped->size();
+  // split so that size * value cannot overflow.
+  auto offset = size / SCROLL_STEPS * value +
+                size % SCROLL_STEPS * value / SCROLL_STEPS;
+  m_moving = true;
+  if (offset < m_windowStart || offset > m_windowEnd ||
+      (m_windowEnd < size && offset > m_windowEnd - WINDOW_BYTES / 4) ||
+      (m_windowStart > 0 && offset < m_windowStart + WINDOW_BYTES / 4))
+    loadWindow(offset);
+  auto from = qMax(m_windowStart, offset - WINDOW_BYTES / 2);
+  showOffsetAtTop(m_mapped->lineStart(offset, from));
+  m_moving = false;
+}
+
+void
+XmlMappedView::updateFileScrollBar()
+{
+  auto size = m_mapped->size();
+  auto moving = m_moving;
+  m_moving = true;
+  if (size <= 0) {
+    m_fileScrollBar->setRange(0, 0);
+  } else {
+    // the page step is the share of the file the visible lines cover.
+    auto blocks = qMax(1, m_editor->document()->blockCount());
+    auto bytesPerLine =
+      qMax(qint64(1), (m_windowEnd - m_windowStart) / blocks);
+    auto visibleLines = qMax(1, m_editor->viewport()->height() /
+                                  qMax(1, m_editor->fontMetrics().height()));
+    auto page = qBound(qint64(1),
+                       visibleLines * bytesPerLine * SCROLL_STEPS / size,
+                       qint64(SCROLL_STEPS));
+    m_fileScrollBar->setRange(0, SCROLL_STEPS);
+    m_fileScrollBar->setPageStep(int(page));
+    m_fileScrollBar->setSingleStep(qMax(1, int(page / visibleLines)));
+    m_fileScrollBar->setValue(int(topOffset() * SCROLL_STEPS / size));
+  }
+  m_moving = moving;
+}
+
+qint64
+XmlMappedView::offsetAt(int position) const
+{
+  if (m_blockOffsets.isEmpty())
+    return 0;
+  auto block = m_editor->document()->findBlock(position);
+  if (!block.isValid())
+    return m_windowEnd;
+  auto number = qMin(block.blockNumber(), int(m_blockOffsets.size()) - 1);
+  auto column = position - block.position();
+  return m_blockOffsets.at(number) + block.text().left(column).toUtf8().size();
+}
+
+int
+XmlMappedView::positionAt(qint64 offset) const
+{
+  if (m_blockOffsets.isEmpty())
+    return 0;
+  offset = qBound(m_windowStart, offset, m_windowEnd);
+  auto it =
+    std::upper_bound(m_blockOffsets.cbegin(), m_blockOffsets.cend(), offset) -
+    1;
+  auto number = int(it - m_blockOffsets.cbegin());
+  auto block = m_editor->document()->findBlockByNumber(number);
+  if (!block.isValid())
+    return m_editor->document()->characterCount() - 1;
+  auto column = m_mapped->text(*it, m_mapped->charStart(offset)).length();
+  return block.position() + qMin(int(column), block.length() - 1);
+}
+
+qint64
+XmlMappedView::topOffset() const
+{
+  return offsetAt(m_editor->cursorForPosition(QPoint(0, 0)).position());
+}
+
+void
+XmlMappedView::showOffsetAtTop(qint64 offset)
+{
+  auto block = m_editor->document()->findBlock(positionAt(offset));
+  m_editor->verticalScrollBar()->setValue(block.blockNumber());
+}
+
+void
+XmlMappedView::stopIndexing()
+{
+  if (!m_indexThread)
+    return;
+  m_cancelIndex = true;
+  m_indexThread->wait();
+  // the thread deletes itself through its finished() connection.
+  m_indexThread = nullptr;
+}
@@ -0,0 +1,359 @@
+#include "qxml/xmloutlinemodel.h"
+#include "qxml/xmldocument.h"
+#include "qxml/xmltrace.h"
+
+#include <algorithm>
+
+//====================================================================
+//=== XmlOutlineModel
+//====================================================================
+XmlOutlineModel::XmlOutlineModel(QObject* parent)
+  : QAbstractItemModel(parent)
+  , m_keyAttributes({ QStringLiteral("id"), QStringLiteral("name") })
+{
+}
+
+XmlOutlineModel::~XmlOutlineModel() {}
+
+void
+XmlOutlineModel::setDocument(XmlDocument* document)
+{
+  disconnect(m_documentConnection);
+  if (!document) {
+    setSnapshot(nullptr);
+    return;
+  }
+  m_documentConnection = connect(document,
+                                 &XmlDocument::snapshotPublished,
+                                 this,
+                                 [this, document]() {
+                                   setSnapshot(document->snapshot());
+                                 });
+  setSnapshot(document->snapshot());
+}
+
+void
+XmlOutlineModel::setSnapshot(const XmlSnapshot::Ptr& snapshot)
+{
+  QXML_TRACE_SCOPE("XmlOutlineModel::setSnapshot");
+  if (!snapshot) {
+    removeItems(&m_root, 0, int(m_root.children.size()));
+    m_root.node.reset();
+    m_root.indexed = false;
+    return;
+  }
+  if (!m_root.node) {
+    m_root.node = snapshot->rootPtr();
+    m_root.indexed = false;
+    // views only ask to fetch the top level after a reset, which this model
+    // never does, so it is fetched straight away. It is the root element.
+    fetchMore(QModelIndex());
+    return;
+  }
+  update(&m_root, snapshot->rootPtr());
+}
+
+const QStringList&
+XmlOutlineModel::keyAttributes() const
+{
+  return m_keyAttributes;
+}
+
+void
+XmlOutlineModel::setKeyAttributes(const QStringList& names)
+{
+  // every label may change but no row does, so only the rows fetched so
+  // far are reported, and only their labels.
+  m_keyAttributes = names;
+  labelsChanged(&m_root);
+}
+
+void
+XmlOutlineModel::labelsChanged(Item* item)
+{
+  if (item->children.empty())
+    return;
+  auto parent = indexFor(item);
+  emit dataChanged(index(0, 0, parent),
+                   index(int(item->children.size()) - 1, 0, parent),
+                   { Qt::DisplayRole });
+  for (const auto& child : item->children)
+    labelsChanged(child.get());
+}
+
+int
+XmlOutlineModel::position(const QModelIndex& index) const
+{
+  if (!index.isValid())
+    return -1;
+  auto position = 0;
+  for (auto item = itemFor(index); item; item = item->parent)
+    position += item->offset;
+  return position;
+}
+
+QModelIndex
+XmlOutlineModel::index(int row, int column, const QModelIndex& parent) const
+{
+  if (!hasIndex(row, column, parent))
+    return {};
+  auto item = itemFor(parent);
+  return createIndex(row, column, item->children[size_t(row)].get());
+}
+
+QModelIndex
+XmlOutlineModel::parent(const QModelIndex& index) const
+{
+  if (!index.isValid())
+    return {};
+  return indexFor(itemFor(index)->parent);
+}
+
+int
+XmlOutlineModel::rowCount(const QModelIndex& parent) const
+{
+  if (parent.column() > 0)
+    return 0;
+  return int(itemFor(parent)->children.size());
+}
+
+int
+XmlOutlineModel::columnCount(const QModelIndex&) const
+{
+  return 1;
+}
+
+bool
+XmlOutlineModel::hasChildren(const QModelIndex& parent) const
+{
+  if (parent.column() > 0)
+    return false;
+  auto item = itemFor(parent);
+  if (!item->node)
+    return false;
+  indexElements(item);
+  return !item->elements.empty();
+}
+
+bool
+XmlOutlineModel::canFetchMore(const QModelIndex& parent) const
+{
+  auto item = itemFor(parent);
+  if (!item->node)
+    return false;
+  indexElements(item);
+  return item->children.size() < item->elements.size();
+}
+
+void
+XmlOutlineModel::fetchMore(const QModelIndex& parent)
+{
+  auto item = itemFor(parent);
+  if (!item->node)
+    return;
+  indexElements(item);
+  auto fetched = int(item->children.size());
+  auto count = qMin(FETCH_BATCH, int(item->elements.size()) - fetched);
+  insertItems(item, fetched, count, fetched);
+}
+
+QVariant
+XmlOutlineModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid())
+    return {};
+  const auto& node = *itemFor(index)->node;
+  switch (role) {
+    case Qt::DisplayRole:
+      return label(node);
+    case Qt::ToolTipRole: {
+      auto tip = node.name;
+      for (const auto& attribute : node.attributes)
+        tip += QStringLiteral("\n%1=\"%2\"").arg(attribute.name,
+                                                 attribute.value);
+      return tip;
+    }
+    case PositionRole:
+      return position(index);
+    case NameRole:
+      return node.name;
+    default:
+      return {};
+  }
+}
+
+XmlOutlineModel::Item*
+XmlOutlineModel::itemFor(const QModelIndex& index) const
+{
+  if (!index.isValid())
+    return const_cast<Item*>(&m_root);
+  return static_cast<Item*>(index.internalPointer());
+}
+
+QModelIndex
+XmlOutlineModel::indexFor(Item* item) const
+{
+  if (!item || item == &m_root)
+    return {};
+  return createIndex(item->row, 0, item);
+}
+
+void
+XmlOutlineModel::indexElements(Item* item)
+{
+  if (item->indexed)
+    return;
+  item->elements.clear();
+  const auto& children = item->node->children;
+  for (size_t i = 0; i < children.size(); ++i) {
+    if (children[i].node->kind == XmlSnapshotNode::Element)
+      item->elements.push_back(int(i));
+  }
+  item->indexed = true;
+}
+
+QString
+XmlOutlineModel::label(const XmlSnapshotNode& node) const
+{
+  auto text = node.name;
+  for (const auto& key : m_keyAttributes) {
+    for (const auto& attribute : node.attributes) {
+      if (attribute.name == key) {
+        text += QStringLiteral(" %1=\"%2\"").arg(attribute.name,
+                                                 attribute.value);
+        break;
+      }
+    }
+  }
+  return text;
+}
+
+void
+XmlOutlineModel::update(Item* item, const XmlSnapshotNode::Ptr& node)
+{
+  // a subtree shared by both snapshots has not changed, nor has anything
+  // below it.
+  if (item->node == node)
+    return;
+
+  auto isRoot = (item == &m_root);
+  auto oldLabel = isRoot ? QString() : label(*item->node);
+  auto wasIndexed = item->indexed;
+  auto oldCount = wasIndexed ? int(item->elements.size()) : 0;
+  auto rows = int(item->children.size());
+  // only the rows of a fully fetched element can be matched from its end.
+  auto fetchedAll = wasIndexed && rows == oldCount;
+
+  item->node = node;
+  item->indexed = false;
+  indexElements(item);
+  auto count = int(item->elements.size());
+
+  if (!isRoot &&
+      (label(*node) != oldLabel ||
+       (rows == 0 && wasIndexed && (oldCount > 0) != (count > 0)))) {
+    auto index = indexFor(item);
+    emit dataChanged(index, index);
+  }
+
+  // elements are matched from either end, by identity or hash, so that an
+  // inserted or removed element does not shift the rows after it onto its
+  // neighbours. A single changed element between two that match, or at
+  // the end, is matched by name. What lies between is replaced. A matched
+  // element keeps its row and is updated in turn.
+  auto nodeOf = [item, &node](int row, int element) {
+    const auto& a = item->children[size_t(row)]->node;
+    auto index = size_t(item->elements[size_t(element)]);
+    return std::make_pair(a.get(), node->children[index].node.get());
+  };
+  auto same = [&nodeOf](int row, int element) {
+    auto [a, b] = nodeOf(row, element);
+    return a == b || a->hash == b->hash;
+  };
+  auto sameName = [&nodeOf](int row, int element) {
+    auto [a, b] = nodeOf(row, element);
+    return a->name == b->name;
+  };
+  auto prefix = 0;
+  while (prefix < rows && prefix < count) {
+    auto next = prefix + 1;
+    if (!same(prefix, prefix) &&
+        !(sameName(prefix, prefix) &&
+          (next < rows && next < count ? same(next, next)
+                                       : next == rows && next == count)))
+      break;
+    ++prefix;
+  }
+  auto suffix = 0;
+  if (fetchedAll) {
+    while (suffix < rows - prefix && suffix < count - prefix) {
+      auto row = rows - 1 - suffix;
+      auto element = count - 1 - suffix;
+      if (!same(row, element) &&
+          !(sameName(row, element) &&
+            (row > prefix && element > prefix
+               ? same(row - 1, element - 1)
+               : row == prefix && element == prefix)))
+        break;
+      ++suffix;
+    }
+  }
+
+  for (auto row = 0; row < prefix; ++row)
+    updateChild(item, row, row);
+  removeItems(item, prefix, rows - prefix - suffix);
+  // the rows of an element that was only partly fetched are fetched again
+  // from the first change.
+  if (fetchedAll)
+    insertItems(item, prefix, count - prefix - suffix, prefix);
+  for (auto row = count - suffix; row < count; ++row)
+    updateChild(item, row, row);
+}
+
+void
+XmlOutlineModel::updateChild(Item* item, int row, int element)
+{
+  auto child = item->children[size_t(row)].get();
+  const auto& entry =
+    item->node->children[size_t(item->elements[size_t(element)])];
+  child->offset = entry.offset;
+  update(child, entry.node);
+}
+
+void
+XmlOutlineModel::insertItems(Item* item, int row, int count, int firstElement)
+{
+  if (count <= 0)
+    return;
+  beginInsertRows(indexFor(item), row, row + count - 1);
+  std::vector<std::unique_ptr<Item>> items;
+  items.reserve(size_t(count));
+  for (auto i = 0; i < count; ++i) {
+    const auto& entry =
+      item->node->children[size_t(item->elements[size_t(firstElement + i)])];
+    auto child = std::make_unique<Item>();
+    child->parent = item;
+    child->offset = entry.offset;
+    child->node = entry.node;
+    items.push_back(std::move(child));
+  }
+  item->children.insert(item->children.begin() + row,
+                        std::make_move_iterator(items.begin()),
+                        std::make_move_iterator(items.end()));
+  for (auto i = size_t(row); i < item->children.size(); ++i)
+    item->children[i]->row = int(i);
+  endInsertRows();
+}
+
+void
+XmlOutlineModel::removeItems(Item* item, int row, int count)
+{
+  if (count <= 0)
+    return;
+  beginRemoveRows(indexFor(item), row, row + count - 1);
+  item->children.erase(item->children.begin() + row,
+                       item->children.begin() + row + count);
+  for (auto i = size_t(row); i < item->children.size(); ++i)
+    item->children[i]->row = int(i);
+  endRemoveRows();
+}
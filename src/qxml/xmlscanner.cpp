@@ -0,0 +1,461 @@
+#include "qxml/xmlscanner.h"
+
+#include <atomic>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||             \
+  defined(_M_IX86)
+#define QXML_SCANNER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define QXML_SCANNER_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC compiles AVX2 intrinsics without a target switch.
+#define QXML_TARGET_AVX2
+#else
+#define QXML_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+//! The characters being looked for, as unsigned code units.
+struct CharSet
+{
+  unsigned char chars[8];
+  int count;
+};
+
+inline int
+lowestBit(uint64_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return int(index);
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+template<typename T>
+inline bool
+matches(const CharSet& set, T c)
+{
+  using Unit = typename std::make_unsigned<T>::type;
+  for (auto i = 0; i < set.count; ++i) {
+    if (Unit(c) == set.chars[i])
+      return true;
+  }
+  return false;
+}
+
+//=== Kernels
+// Each kernel compares BLOCK code units at a time and returns a mask with
+// UNIT_BITS set bits for every matching unit, lowest unit first.
+
+template<typename T>
+struct ScalarKernel
+{
+  static constexpr size_t BLOCK = 1;
+  static constexpr int UNIT_BITS = 1;
+  const CharSet& set;
+  explicit ScalarKernel(const CharSet& s)
+    : set(s)
+  {
+  }
+  uint64_t mask(const T* p) const { return matches(set, *p) ? 1 : 0; }
+};
+
+#if defined(QXML_SCANNER_X86)
+struct Sse2Kernel8
+{
+  static constexpr size_t BLOCK = 16;
+  static constexpr int UNIT_BITS = 1;
+  __m128i chars[8];
+  int count;
+  explicit Sse2Kernel8(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = _mm_set1_epi8(char(set.chars[i]));
+  }
+  uint64_t mask(const char* p) const
+  {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto m = _mm_setzero_si128();
+    for (auto i = 0; i < count; ++i)
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(v, chars[i]));
+    return uint32_t(_mm_movemask_epi8(m));
+  }
+};
+
+struct Sse2Kernel16
+{
+  static constexpr size_t BLOCK = 16;
+  static constexpr int UNIT_BITS = 1;
+  __m128i chars[8];
+  int count;
+  explicit Sse2Kernel16(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = _mm_set1_epi16(short(set.chars[i]));
+  }
+  uint64_t mask(const char16_t* p) const
+  {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+    auto ma = _mm_setzero_si128();
+    auto mb = _mm_setzero_si128();
+    for (auto i = 0; i < count; ++i) {
+      ma = _mm_or_si128(ma, _mm_cmpeq_epi16(a, chars[i]));
+      mb = _mm_or_si128(mb, _mm_cmpeq_epi16(b, chars[i]));
+    }
+    // each 0xFFFF becomes 0xFF, one byte per unit.
+    return uint32_t(_mm_movemask_epi8(_mm_packs_epi16(ma, mb)));
+  }
+};
+
+struct Avx2Kernel8
+{
+  static constexpr size_t BLOCK = 32;
+  static constexpr int UNIT_BITS = 1;
+  __m256i chars[8];
+  int count;
+  QXML_TARGET_AVX2 explicit Avx2Kernel8(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = _mm256_set1_epi8(char(set.chars[i]));
+  }
+  QXML_TARGET_AVX2 uint64_t mask(const char* p) const
+  {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto m = _mm256_setzero_si256();
+    for (auto i = 0; i < count; ++i)
+      m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, chars[i]));
+    return uint32_t(_mm256_movemask_epi8(m));
+  }
+};
+
+struct Avx2Kernel16
+{
+  static constexpr size_t BLOCK = 32;
+  static constexpr int UNIT_BITS = 1;
+  __m256i chars[8];
+  int count;
+  QXML_TARGET_AVX2 explicit Avx2Kernel16(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = _mm256_set1_epi16(short(set.chars[i]));
+  }
+  QXML_TARGET_AVX2 uint64_t mask(const char16_t* p) const
+  {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16));
+    auto ma = _mm256_setzero_si256();
+    auto mb = _mm256_setzero_si256();
+    for (auto i = 0; i < count; ++i) {
+      ma = _mm256_or_si256(ma, _mm256_cmpeq_epi16(a, chars[i]));
+      mb = _mm256_or_si256(mb, _mm256_cmpeq_epi16(b, chars[i]));
+    }
+    // packs works within 128 bit lanes, the permute restores unit order.
+    auto packed =
+      _mm256_permute4x64_epi64(_mm256_packs_epi16(ma, mb), 0xD8);
+    return uint32_t(_mm256_movemask_epi8(packed));
+  }
+};
+#endif
+
+#if defined(QXML_SCANNER_NEON)
+struct NeonKernel8
+{
+  static constexpr size_t BLOCK = 16;
+  static constexpr int UNIT_BITS = 4;
+  uint8x16_t chars[8];
+  int count;
+  explicit NeonKernel8(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = vdupq_n_u8(set.chars[i]);
+  }
+  uint64_t mask(const char* p) const
+  {
+    auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    auto m = vdupq_n_u8(0);
+    for (auto i = 0; i < count; ++i)
+      m = vorrq_u8(m, vceqq_u8(v, chars[i]));
+    // narrowing shift, four bits per byte.
+    auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+  }
+};
+
+struct NeonKernel16
+{
+  static constexpr size_t BLOCK = 8;
+  static constexpr int UNIT_BITS = 8;
+  uint16x8_t chars[8];
+  int count;
+  explicit NeonKernel16(const CharSet& set)
+    : count(set.count)
+  {
+    for (auto i = 0; i < count; ++i)
+      chars[i] = vdupq_n_u16(set.chars[i]);
+  }
+  uint64_t mask(const char16_t* p) const
+  {
+    auto v = vld1q_u16(reinterpret_cast<const uint16_t*>(p));
+    auto m = vdupq_n_u16(0);
+    for (auto i = 0; i < count; ++i)
+      m = vorrq_u16(m, vceqq_u16(v, chars[i]));
+    return vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(m)), 0);
+  }
+};
+#endif
+
+//=== Drivers
+// The drivers are stamped out once per target so that the kernel inlines.
+#define QXML_SCANNER_DRIVERS(NAME, ATTR)                                      \
+  template<typename K, typename T>                                             \
+  ATTR void NAME##Scan(const CharSet& set,                                     \
+                       const T* data,                                          \
+                       size_t length,                                          \
+                       std::vector<uint32_t>& offsets,                         \
+                       uint32_t base)                                          \
+  {                                                                            \
+    K kernel(set);                                                             \
+    const uint64_t unitMask = (uint64_t(1) << K::UNIT_BITS) - 1;               \
+    size_t i = 0;                                                              \
+    for (; i + K::BLOCK <= length; i += K::BLOCK) {                            \
+      auto mask = kernel.mask(data + i);                                       \
+      while (mask) {                                                           \
+        auto bit = lowestBit(mask);                                            \
+        offsets.push_back(base + uint32_t(i + size_t(bit / K::UNIT_BITS)));    \
+        mask &= ~(unitMask << bit);                                            \
+      }                                                                        \
+    }                                                                          \
+    for (; i < length; ++i) {                                                  \
+      if (matches(set, data[i]))                                               \
+        offsets.push_back(base + uint32_t(i));                                 \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  template<typename K, typename T>                                             \
+  ATTR size_t NAME##Find(                                                      \
+    const CharSet& set, const T* data, size_t length, size_t from)             \
+  {                                                                            \
+    K kernel(set);                                                             \
+    size_t i = from;                                                           \
+    for (; i + K::BLOCK <= length; i += K::BLOCK) {                            \
+      auto mask = kernel.mask(data + i);                                       \
+      if (mask)                                                                \
+        return i + size_t(lowestBit(mask) / K::UNIT_BITS);                     \
+    }                                                                          \
+    for (; i < length; ++i) {                                                  \
+      if (matches(set, data[i]))                                               \
+        return i;                                                              \
+    }                                                                          \
+    return length;                                                             \
+  }
+
+QXML_SCANNER_DRIVERS(base, )
+#if defined(QXML_SCANNER_X86)
+QXML_SCANNER_DRIVERS(avx2, QXML_TARGET_AVX2)
+#endif
+
+#undef QXML_SCANNER_DRIVERS
+
+XmlScanner::Isa
+detectIsa()
+{
+#if defined(QXML_SCANNER_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuidex(info, 7, 0);
+  auto avx2 = (info[1] & (1 << 5)) != 0;
+  __cpuid(info, 1);
+  // the OS has to save the YMM registers as well.
+  auto osxsave = (info[2] & (1 << 27)) != 0;
+  if (avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+    return XmlScanner::Avx2;
+#else
+  if (__builtin_cpu_supports("avx2"))
+    return XmlScanner::Avx2;
+#endif
+  return XmlScanner::Sse2;
+#elif defined(QXML_SCANNER_NEON)
+  return XmlScanner::Neon;
+#else
+  return XmlScanner::Scalar;
+#endif
+}
+
+std::atomic<int>&
+currentIsa()
+{
+  static std::atomic<int> isa{ int(detectIsa()) };
+  return isa;
+}
+
+template<typename T>
+void
+dispatchScan(const CharSet& set,
+             const T* data,
+             size_t length,
+             std::vector<uint32_t>& offsets,
+             uint32_t base)
+{
+  constexpr auto wide = sizeof(T) == 2;
+  switch (XmlScanner::Isa(currentIsa().load(std::memory_order_relaxed))) {
+#if defined(QXML_SCANNER_X86)
+    case XmlScanner::Avx2:
+      if constexpr (wide)
+        avx2Scan<Avx2Kernel16>(set, data, length, offsets, base);
+      else
+        avx2Scan<Avx2Kernel8>(set, data, length, offsets, base);
+      return;
+    case XmlScanner::Sse2:
+      if constexpr (wide)
+        baseScan<Sse2Kernel16>(set, data, length, offsets, base);
+      else
+        baseScan<Sse2Kernel8>(set, data, length, offsets, base);
+      return;
+#elif defined(QXML_SCANNER_NEON)
+    case XmlScanner::Neon:
+      if constexpr (wide)
+        baseScan<NeonKernel16>(set, data, length, offsets, base);
+      else
+        baseScan<NeonKernel8>(set, data, length, offsets, base);
+      return;
+#endif
+    default:
+      baseScan<ScalarKernel<T>>(set, data, length, offsets, base);
+      return;
+  }
+}
+
+template<typename T>
+size_t
+dispatchFind(const CharSet& set, const T* data, size_t length, size_t from)
+{
+  constexpr auto wide = sizeof(T) == 2;
+  if (from >= length)
+    return length;
+  switch (XmlScanner::Isa(currentIsa().load(std::memory_order_relaxed))) {
+#if defined(QXML_SCANNER_X86)
+    case XmlScanner::Avx2:
+      if constexpr (wide)
+        return avx2Find<Avx2Kernel16>(set, data, length, from);
+      else
+        return avx2Find<Avx2Kernel8>(set, data, length, from);
+    case XmlScanner::Sse2:
+      if constexpr (wide)
+        return baseFind<Sse2Kernel16>(set, data, length, from);
+      else
+        return baseFind<Sse2Kernel8>(set, data, length, from);
+#elif defined(QXML_SCANNER_NEON)
+    case XmlScanner::Neon:
+      if constexpr (wide)
+        return baseFind<NeonKernel16>(set, data, length, from);
+      else
+        return baseFind<NeonKernel8>(set, data, length, from);
+#endif
+    default:
+      return baseFind<ScalarKernel<T>>(set, data, length, from);
+  }
+}
+
+CharSet
+charSet(const char* chars, int count)
+{
+  CharSet set{};
+  for (auto i = 0; i < count; ++i)
+    set.chars[i] = static_cast<unsigned char>(chars[i]);
+  set.count = count;
+  return set;
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlScanner
+//====================================================================
+XmlScanner::XmlScanner(const char* chars)
+{
+  for (; chars && *chars && m_count < 8; ++chars) {
+    // only ASCII can be found without decoding.
+    if (static_cast<unsigned char>(*chars) < 0x80)
+      m_chars[m_count++] = *chars;
+  }
+}
+
+void
+XmlScanner::scan(const char16_t* data,
+                 size_t length,
+                 std::vector<uint32_t>& offsets,
+                 uint32_t base) const
+{
+  dispatchScan(charSet(m_chars, m_count), data, length, offsets, base);
+}
+
+void
+XmlScanner::scan(const char* data,
+                 size_t length,
+                 std::vector<uint32_t>& offsets,
+                 uint32_t base) const
+{
+  dispatchScan(charSet(m_chars, m_count), data, length, offsets, base);
+}
+
+size_t
+XmlScanner::find(const char16_t* data, size_t length, size_t from) const
+{
+  return dispatchFind(charSet(m_chars, m_count), data, length, from);
+}
+
+size_t
+XmlScanner::find(const char* data, size_t length, size_t from) const
+{
+  return dispatchFind(charSet(m_chars, m_count), data, length, from);
+}
+
+XmlScanner::Isa
+XmlScanner::isa()
+{
+  return Isa(currentIsa().load(std::memory_order_relaxed));
+}
+
+const char*
+XmlScanner::isaName(Isa isa)
+{
+  switch (isa) {
+    case Sse2:
+      return "sse2";
+    case Avx2:
+      return "avx2";
+    case Neon:
+      return "neon";
+    case Scalar:
+    default:
+      return "scalar";
+  }
+}
+
+void
+XmlScanner::setIsa(Isa isa)
+{
+  auto best = detectIsa();
+  auto available = (isa == Scalar || isa == best ||
+                    (isa == Sse2 && best == Avx2));
+  currentIsa().store(int(available ? isa : best), std::memory_order_relaxed);
+}
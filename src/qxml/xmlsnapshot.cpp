@@ -0,0 +1,818 @@
+#include "qxml/xmlsnapshot.h"
+#include "qxml/xmlmemory.h"
+#include "qxml/xmltrace.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+std::atomic<quint64> nextVersion{ 1 };
+
+//! How far ahead among the previous children a match is looked for.
+const size_t MATCH_LOOKAHEAD = 8;
+
+//! Returns the heap taken by node itself, made by std::make_shared, not by
+//! its children.
+qint64
+ownBytes(const XmlSnapshotNode& node)
+{
+  using namespace XmlMemory;
+  auto bytes = qint64(sizeof(XmlSnapshotNode)) + CONTROL_BYTES +
+               ALLOCATION_BYTES + stringBytes(node.name) +
+               stringBytes(node.content);
+  if (node.attributes.capacity() > 0)
+    bytes += qint64(node.attributes.capacity()) *
+               qint64(sizeof(XmlSnapshotAttribute)) +
+             ALLOCATION_BYTES;
+  for (const auto& attribute : node.attributes)
+    bytes += stringBytes(attribute.name) + stringBytes(attribute.value);
+  return bytes + node.children.tableBytes();
+}
+
+/*
+ * Builds the snapshot nodes of one parse, taking over the subtrees of the
+ * previous snapshot that lie wholly outside the changed text. Inside it, a
+ * node is matched by hash with a child of the previous node its parent was
+ * matched with, and taken over if it turns out the same, text layout
+ * included.
+ *
+ * The nodes that hold the changed text are built anew. Each keeps its
+ * previous version, found by its start, as the place to look up its
+ * unchanged children. Those are met in order, so the lookup only moves
+ * forward through the previous children.
+ */
+class Builder
+{
+public:
+  Builder(const XmlSnapshot::Ptr& previous,
+          XmlEventParser::TextRange changed,
+          int delta)
+    : m_previous(previous)
+    , m_changed(changed)
+    , m_delta(delta)
+  {
+  }
+
+  //! The previous version of a node that is being built, and where the
+  //! lookup of its children has got to.
+  struct Previous
+  {
+    const XmlSnapshotNode* node = nullptr;
+    size_t next = 0;
+  };
+
+  XmlSnapshotNode::Ptr build(Node* node,
+                             int parentStart,
+                             Previous& parent,
+                             const XmlSnapshotNode::Ptr* match);
+  void buildChildren(XmlSnapshotNode& result,
+                     StartNode* element,
+                     int start,
+                     Previous& previous,
+                     const XmlSnapshotNode::Ptr* match);
+  Previous previousRoot() const;
+  static const XmlSnapshotNode::Ptr* matchChild(
+    const XmlSnapshotNode::Ptr* parent,
+    size_t& next,
+    quint64 hash);
+
+private:
+  XmlSnapshot::Ptr m_previous;
+  XmlEventParser::TextRange m_changed;
+  int m_delta;
+
+  static XmlSnapshotNode::Kind kindOf(Node* node);
+  static int endOf(Node* node);
+  XmlSnapshotNode::Ptr previousNode(int start,
+                                    XmlSnapshotNode::Kind kind,
+                                    int length) const;
+  static XmlSnapshotNode::Ptr previousChild(Previous& parent,
+                                            int offset,
+                                            XmlSnapshotNode::Kind kind,
+                                            int length);
+  static const XmlSnapshotNode* previousContainer(Previous& parent,
+                                                  int offset,
+                                                  XmlSnapshotNode::Kind kind);
+  static void addAttribute(XmlSnapshotNode& node,
+                           const QString& name,
+                           const QString& value,
+                           int nameStart,
+                           int valueStart);
+  static bool isSame(const XmlSnapshotNode& node,
+                     const XmlSnapshotNode& previous);
+};
+
+XmlSnapshotNode::Kind
+Builder::kindOf(Node* node)
+{
+  switch (node->type) {
+    case Node::XmlDeclaration:
+      return XmlSnapshotNode::Declaration;
+    case Node::Start:
+      return XmlSnapshotNode::Element;
+    case Node::Text:
+      return XmlSnapshotNode::Text;
+    case Node::CData:
+      return XmlSnapshotNode::CData;
+    case Node::Comment:
+      return XmlSnapshotNode::Comment;
+    case Node::Instruction:
+      return XmlSnapshotNode::Instruction;
+    default:
+      return XmlSnapshotNode::Document;
+  }
+}
+
+int
+Builder::endOf(Node* node)
+{
+  // an element runs to the end of its end tag.
+  if (node->type == Node::Start) {
+    auto closer = static_cast<StartNode*>(node)->closer;
+    if (closer)
+      return qMax(node->end(), closer->end());
+  }
+  return node->end();
+}
+
+XmlSnapshotNode::Ptr
+Builder::previousNode(int start, XmlSnapshotNode::Kind kind, int length) const
+{
+  // descend from the root through the children that hold start, the
+  // children of a node are ordered by offset.
+  auto node = &m_previous->rootPtr();
+  auto nodeStart = 0;
+  while (!(*node)->children.empty()) {
+    const auto& children = (*node)->children;
+    auto index = children.upperBound(start - nodeStart);
+    if (index == 0)
+      return {};
+    auto child = children[index - 1];
+    auto childStart = nodeStart + child.offset;
+    if (childStart == start && child.node->kind == kind &&
+        child.node->length == length)
+      return child.node;
+    if (start >= childStart + child.node->length)
+      return {};
+    node = &child.node;
+    nodeStart = childStart;
+  }
+  return {};
+}
+
+XmlSnapshotNode::Ptr
+Builder::previousChild(Previous& parent,
+                       int offset,
+                       XmlSnapshotNode::Kind kind,
+                       int length)
+{
+  const auto& children = parent.node->children;
+  while (parent.next < children.size() &&
+         children[parent.next].offset < offset)
+    ++parent.next;
+  if (parent.next < children.size()) {
+    auto child = children[parent.next];
+    if (child.offset == offset && child.node->kind == kind &&
+        child.node->length == length)
+      return child.node;
+  }
+  return {};
+}
+
+const XmlSnapshotNode*
+Builder::previousContainer(Previous& parent,
+                           int offset,
+                           XmlSnapshotNode::Kind kind)
+{
+  // the node holds the changed text, so it may have grown or shrunk. No two
+  // nodes with children start at the same place.
+  const auto& children = parent.node->children;
+  while (parent.next < children.size() &&
+         children[parent.next].offset < offset)
+    ++parent.next;
+  if (parent.next < children.size()) {
+    auto child = children[parent.next];
+    if (child.offset == offset && child.node->kind == kind)
+      return child.node.get();
+  }
+  return nullptr;
+}
+
+Builder::Previous
+Builder::previousRoot() const
+{
+  Previous root;
+  if (m_previous)
+    root.node = &m_previous->root();
+  return root;
+}
+
+const XmlSnapshotNode::Ptr*
+Builder::matchChild(const XmlSnapshotNode::Ptr* parent,
+                    size_t& next,
+                    quint64 hash)
+{
+  if (!parent)
+    return nullptr;
+  // children are inserted and removed, rarely reordered, so the match is
+  // looked for a little way ahead of the last one.
+  const auto& children = (*parent)->children;
+  auto last = qMin(children.size(), next + MATCH_LOOKAHEAD);
+  for (auto i = next; i < last; ++i) {
+    if (children[i].node->hash == hash) {
+      next = i + 1;
+      return &children[i].node;
+    }
+  }
+  return nullptr;
+}
+
+bool
+Builder::isSame(const XmlSnapshotNode& node, const XmlSnapshotNode& previous)
+{
+  // the hashes cover the names and content, the rest is the layout. The
+  // children are the same if they were taken over themselves.
+  if (node.hash != previous.hash || node.kind != previous.kind ||
+      node.length != previous.length || node.name != previous.name ||
+      node.nameOffset != previous.nameOffset ||
+      node.contentOffset != previous.contentOffset ||
+      node.startTagLength != previous.startTagLength ||
+      node.endTagOffset != previous.endTagOffset ||
+      node.attributes.size() != previous.attributes.size() ||
+      node.children.size() != previous.children.size())
+    return false;
+  for (size_t i = 0; i < node.attributes.size(); ++i) {
+    const auto& a = node.attributes[i];
+    const auto& b = previous.attributes[i];
+    if (a.name != b.name || a.nameOffset != b.nameOffset ||
+        a.valueOffset != b.valueOffset)
+      return false;
+  }
+  return node.children.isSameAs(previous.children);
+}
+
+void
+Builder::addAttribute(XmlSnapshotNode& node,
+                      const QString& name,
+                      const QString& value,
+                      int nameStart,
+                      int valueStart)
+{
+  XmlSnapshotAttribute attribute;
+  attribute.name = name;
+  attribute.value = value;
+  attribute.nameOffset = nameStart;
+  attribute.valueOffset = valueStart;
+  node.attributes.push_back(attribute);
+}
+
+XmlSnapshotNode::Ptr
+Builder::build(Node* node,
+               int parentStart,
+               Previous& parent,
+               const XmlSnapshotNode::Ptr* match)
+{
+  auto start = node->start();
+  auto end = endOf(node);
+  auto kind = kindOf(node);
+
+  // text outside the changed range is the same as before, only moved if it
+  // follows it, and so are the nodes that lie wholly in it. The parent
+  // holds the changed text, so it starts where it did.
+  if (m_previous && (end <= m_changed.from || start >= m_changed.to)) {
+    auto oldStart = (end <= m_changed.from ? start : start - m_delta);
+    auto old =
+      parent.node
+        ? previousChild(parent, oldStart - parentStart, kind, end - start)
+        : previousNode(oldStart, kind, end - start);
+    if (old)
+      return old;
+  }
+  Previous previous;
+  if (parent.node && start <= m_changed.from)
+    previous.node = previousContainer(parent, start - parentStart, kind);
+
+  auto result = std::make_shared<XmlSnapshotNode>();
+  result->kind = kind;
+  result->length = end - start;
+  result->hash = node->hash;
+  switch (node->type) {
+    case Node::XmlDeclaration: {
+      auto declaration = static_cast<XmlDeclarationNode*>(node);
+      result->name = declaration->name;
+      if (declaration->nameStart() >= 0)
+        result->nameOffset = declaration->nameStart() - start;
+      if (declaration->hasVersion())
+        addAttribute(*result,
+                     QStringLiteral("version"),
+                     declaration->version,
+                     declaration->versionStart() - start,
+                     declaration->versionValueStart() - start);
+      if (declaration->hasEncoding())
+        addAttribute(*result,
+                     QStringLiteral("encoding"),
+                     declaration->encoding,
+                     declaration->encodingStart() - start,
+                     declaration->encodingValueStart() - start);
+      if (declaration->hasStandalone())
+        addAttribute(*result,
+                     QStringLiteral("standalone"),
+                     declaration->standalone,
+                     declaration->standaloneStart() - start,
+                     declaration->standaloneValueStart() - start);
+      break;
+    }
+    case Node::Start: {
+      auto element = static_cast<StartNode*>(node);
+      result->name = element->name;
+      result->nameOffset = element->nameStart() - start;
+      result->startTagLength = element->length();
+      if (element->closer && element->closer->length() > 0)
+        result->endTagOffset = element->closer->start() - start;
+      result->attributes.reserve(size_t(element->attributes.size()));
+      for (auto attribute : element->attributes)
+        addAttribute(*result,
+                     attribute->name,
+                     attribute->value,
+                     attribute->nameStart() - start,
+                     attribute->hasValue() ? attribute->valueStart() - start
+                                           : -1);
+      buildChildren(*result, element, start, previous, match);
+      break;
+    }
+    case Node::Text:
+      result->content = static_cast<TextNode*>(node)->text;
+      result->contentOffset = 0;
+      break;
+    case Node::CData: {
+      auto cdata = static_cast<CDataNode*>(node);
+      result->content = cdata->data;
+      result->contentOffset = cdata->dataStart() - start;
+      break;
+    }
+    case Node::Comment: {
+      auto comment = static_cast<CommentNode*>(node);
+      result->content = comment->comment;
+      result->contentOffset = comment->commentStart() - start;
+      break;
+    }
+    case Node::Instruction: {
+      auto instruction = static_cast<ProcessingInstruction*>(node);
+      result->name = instruction->target;
+      result->nameOffset = instruction->targetStart() - start;
+      result->content = instruction->data;
+      result->contentOffset = instruction->dataStart() - start;
+      break;
+    }
+    default:
+      break;
+  }
+  result->bytes += ownBytes(*result);
+  // the node is an unchanged one that has moved, for instance after the
+  // whole text was replaced by a slightly different one.
+  if (match && isSame(*result, **match))
+    return *match;
+  return result;
+}
+
+void
+Builder::buildChildren(XmlSnapshotNode& result,
+                       StartNode* element,
+                       int start,
+                       Previous& previous,
+                       const XmlSnapshotNode::Ptr* match)
+{
+  // the chunks of the previous children that lie wholly before or after the
+  // changed text hold the same nodes as the first and last children now, so
+  // they are taken over without going through their children.
+  const auto& children = element->children;
+  const XmlSnapshotChildren* old = nullptr;
+  size_t before = 0;
+  size_t after = 0;
+  size_t chunks = 0;
+  auto first = size_t(0);
+  auto last = size_t(children.size());
+  if (previous.node) {
+    old = &previous.node->children;
+    chunks = old->chunkCount();
+    auto from = m_changed.from - start;
+    auto to = m_changed.to - m_delta - start;
+    while (before < chunks && old->chunkEnd(before) <= from)
+      ++before;
+    after = chunks;
+    while (after > before && old->chunkStart(after - 1) >= to)
+      --after;
+    first = (before < chunks ? old->chunkFirst(before) : old->size());
+    auto kept = (after < chunks ? old->size() - old->chunkFirst(after) : 0);
+    if (first + kept <= last) {
+      last -= kept;
+    } else {
+      old = nullptr;
+      first = 0;
+    }
+  }
+
+  if (old) {
+    result.children.appendChunks(*old, 0, before, 0);
+    previous.next = first;
+  }
+  size_t next = (old && match && match->get() == previous.node ? first : 0);
+  for (auto i = first; i < last; ++i) {
+    auto child = children.at(int(i));
+    auto built =
+      build(child, start, previous, matchChild(match, next, child->hash));
+    result.children.append(child->start() - start, built);
+  }
+  if (old)
+    result.children.appendChunks(*old, after, chunks, m_delta);
+  result.size += result.children.nodeCount();
+  result.bytes += result.children.subtreeBytes();
+}
+
+//! Returns the nodes without a parent: the root element and the declaration,
+//! comments and instructions before and after it. Only those before and
+//! after the root element are looked at, not the ones inside it.
+std::vector<Node*>
+topLevelNodes(const XmlEventParser& parser)
+{
+  std::vector<Node*> top;
+  const auto& nodes = parser.nodes();
+  auto root = parser.rootNode();
+  auto first = 0;
+  for (; first < nodes.size() && nodes.at(first) != root; ++first) {
+    auto node = nodes.at(first);
+    if (!node->parent && node->type != Node::End)
+      top.push_back(node);
+  }
+  if (!root)
+    return top;
+  top.push_back(root);
+  auto closer = static_cast<StartNode*>(root)->closer;
+  auto last = nodes.size();
+  while (last > first + 1 && nodes.at(last - 1) != closer)
+    --last;
+  for (auto i = last; i < nodes.size(); ++i) {
+    auto node = nodes.at(i);
+    if (!node->parent && node->type != Node::End)
+      top.push_back(node);
+  }
+  return top;
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlSnapshotChildren
+//====================================================================
+XmlSnapshotChildren::Entry
+XmlSnapshotChildren::const_iterator::operator*() const
+{
+  const auto& piece = (*m_pieces)[m_piece];
+  const auto& child = piece.chunk->children[m_index];
+  return { piece.base + child.offset, child.node };
+}
+
+XmlSnapshotChildren::const_iterator&
+XmlSnapshotChildren::const_iterator::operator++()
+{
+  if (++m_index >= (*m_pieces)[m_piece].chunk->children.size()) {
+    ++m_piece;
+    m_index = 0;
+  }
+  return *this;
+}
+
+bool
+XmlSnapshotChildren::const_iterator::operator==(
+  const const_iterator& other) const
+{
+  return m_piece == other.m_piece && m_index == other.m_index;
+}
+
+bool
+XmlSnapshotChildren::const_iterator::operator!=(
+  const const_iterator& other) const
+{
+  return !(*this == other);
+}
+
+size_t
+XmlSnapshotChildren::size() const
+{
+  return m_size;
+}
+
+bool
+XmlSnapshotChildren::empty() const
+{
+  return m_size == 0;
+}
+
+size_t
+XmlSnapshotChildren::pieceOf(size_t index) const
+{
+  // the last piece that starts at or before index.
+  auto it = std::upper_bound(
+    m_pieces.cbegin(), m_pieces.cend(), index, [](size_t i, const Piece& p) {
+      return i < p.first;
+    });
+  return size_t(it - m_pieces.cbegin()) - 1;
+}
+
+XmlSnapshotChildren::Entry
+XmlSnapshotChildren::operator[](size_t index) const
+{
+  const auto& piece = m_pieces[pieceOf(index)];
+  const auto& child = piece.chunk->children[index - piece.first];
+  return { piece.base + child.offset, child.node };
+}
+
+XmlSnapshotChildren::const_iterator
+XmlSnapshotChildren::begin() const
+{
+  const_iterator it;
+  it.m_pieces = &m_pieces;
+  return it;
+}
+
+XmlSnapshotChildren::const_iterator
+XmlSnapshotChildren::end() const
+{
+  const_iterator it;
+  it.m_pieces = &m_pieces;
+  it.m_piece = m_pieces.size();
+  return it;
+}
+
+size_t
+XmlSnapshotChildren::upperBound(int offset) const
+{
+  // the pieces are ordered by offset, and so are the children of each.
+  auto piece = std::upper_bound(
+    m_pieces.cbegin(), m_pieces.cend(), offset, [](int o, const Piece& p) {
+      return o < p.base + p.chunk->children.front().offset;
+    });
+  if (piece == m_pieces.cbegin())
+    return 0;
+  --piece;
+  const auto& children = piece->chunk->children;
+  auto child = std::upper_bound(
+    children.cbegin(),
+    children.cend(),
+    offset - piece->base,
+    [](int o, const Child& c) { return o < c.offset; });
+  return piece->first + size_t(child - children.cbegin());
+}
+
+bool
+XmlSnapshotChildren::isSameAs(const XmlSnapshotChildren& other) const
+{
+  if (m_size != other.m_size)
+    return false;
+  // a chunk both tables took over at the same place is skipped whole.
+  auto a = begin();
+  auto b = other.begin();
+  auto last = end();
+  while (a != last) {
+    if (a.m_index == 0 && b.m_index == 0) {
+      const auto& x = m_pieces[a.m_piece];
+      const auto& y = other.m_pieces[b.m_piece];
+      if (x.chunk == y.chunk && x.base == y.base) {
+        ++a.m_piece;
+        ++b.m_piece;
+        continue;
+      }
+    }
+    auto x = *a;
+    auto y = *b;
+    if (x.offset != y.offset || x.node != y.node)
+      return false;
+    ++a;
+    ++b;
+  }
+  return true;
+}
+
+int
+XmlSnapshotChildren::nodeCount() const
+{
+  return m_nodeCount;
+}
+
+qint64
+XmlSnapshotChildren::subtreeBytes() const
+{
+  return m_subtreeBytes;
+}
+
+qint64
+XmlSnapshotChildren::tableBytes() const
+{
+  // a chunk shared with other snapshots counts in each, as its nodes do.
+  using namespace XmlMemory;
+  qint64 bytes = 0;
+  if (m_pieces.capacity() > 0)
+    bytes += qint64(m_pieces.capacity()) * qint64(sizeof(Piece)) +
+             ALLOCATION_BYTES;
+  for (const auto& piece : m_pieces)
+    bytes += qint64(sizeof(Chunk)) + CONTROL_BYTES + ALLOCATION_BYTES +
+             qint64(piece.chunk->children.capacity()) *
+               qint64(sizeof(Child)) +
+             ALLOCATION_BYTES;
+  return bytes;
+}
+
+void
+XmlSnapshotChildren::append(int offset, const NodePtr& node)
+{
+  // children are not reserved for, most elements have only a few.
+  if (!m_open || m_open->children.size() >= size_t(CHUNK)) {
+    m_open = std::make_shared<Chunk>();
+    Piece piece;
+    piece.base = offset;
+    piece.first = m_size;
+    piece.chunk = m_open;
+    m_pieces.push_back(piece);
+  }
+  auto relative = offset - m_pieces.back().base;
+  m_open->children.push_back({ relative, node });
+  m_open->end = qMax(m_open->end, relative + node->length);
+  m_open->nodeCount += node->size;
+  m_open->bytes += node->bytes;
+  ++m_size;
+  m_nodeCount += node->size;
+  m_subtreeBytes += node->bytes;
+}
+
+size_t
+XmlSnapshotChildren::chunkCount() const
+{
+  return m_pieces.size();
+}
+
+size_t
+XmlSnapshotChildren::chunkFirst(size_t chunk) const
+{
+  return m_pieces[chunk].first;
+}
+
+int
+XmlSnapshotChildren::chunkStart(size_t chunk) const
+{
+  const auto& piece = m_pieces[chunk];
+  return piece.base + piece.chunk->children.front().offset;
+}
+
+int
+XmlSnapshotChildren::chunkEnd(size_t chunk) const
+{
+  const auto& piece = m_pieces[chunk];
+  return piece.base + piece.chunk->end;
+}
+
+void
+XmlSnapshotChildren::appendChunks(const XmlSnapshotChildren& other,
+                                  size_t first,
+                                  size_t last,
+                                  int shift)
+{
+  for (auto i = first; i < last; ++i) {
+    const auto& piece = other.m_pieces[i];
+    const auto& chunk = *piece.chunk;
+    if (chunk.children.size() < size_t(CHUNK / 4)) {
+      for (const auto& child : chunk.children)
+        append(piece.base + shift + child.offset, child.node);
+      continue;
+    }
+    Piece shared;
+    shared.base = piece.base + shift;
+    shared.first = m_size;
+    shared.chunk = piece.chunk;
+    m_pieces.push_back(shared);
+    // the next child starts a chunk of its own.
+    m_open.reset();
+    m_size += chunk.children.size();
+    m_nodeCount += chunk.nodeCount;
+    m_subtreeBytes += chunk.bytes;
+  }
+}
+
+//====================================================================
+//=== XmlSnapshot
+//====================================================================
+XmlSnapshot::Ptr
+XmlSnapshot::build(const XmlEventParser& parser,
+                   int length,
+                   int revision,
+                   const Ptr& previous,
+                   XmlEventParser::TextRange changed)
+{
+  QXML_TRACE_SCOPE("XmlSnapshot::build");
+  auto snapshot = std::make_shared<XmlSnapshot>();
+  snapshot->m_revision = revision;
+  snapshot->m_version = nextVersion.fetch_add(1, std::memory_order_relaxed);
+
+  auto usable = bool(previous);
+  if (usable && changed.from < 0) {
+    if (previous->length() == length) {
+      // nothing changed, the whole tree is shared.
+      snapshot->m_root = previous->m_root;
+      return snapshot;
+    }
+    usable = false;
+  }
+
+  Builder builder(usable ? previous : Ptr(),
+                  changed,
+                  usable ? length - previous->length() : 0);
+  auto root = std::make_shared<XmlSnapshotNode>();
+  root->kind = XmlSnapshotNode::Document;
+  root->length = length;
+  root->size = 0;
+  root->hash = XmlSnapshotNode::Document;
+
+  // the top level nodes are the root element and the declaration, comments
+  // and instructions before and after it, they have no parent.
+  const auto* previousRoot = (usable ? &previous->m_root : nullptr);
+  auto previousTop = builder.previousRoot();
+  size_t next = 0;
+  for (auto node : topLevelNodes(parser)) {
+    auto match = Builder::matchChild(previousRoot, next, node->hash);
+    auto built = builder.build(node, 0, previousTop, match);
+    root->size += built->size;
+    root->bytes += built->bytes;
+    root->hash = Node::combineHash(root->hash, built->hash);
+    root->children.append(node->start(), built);
+  }
+  root->bytes += ownBytes(*root);
+  snapshot->m_root = root;
+  return snapshot;
+}
+
+const XmlSnapshotNode&
+XmlSnapshot::root() const
+{
+  return *m_root;
+}
+
+const XmlSnapshotNode::Ptr&
+XmlSnapshot::rootPtr() const
+{
+  return m_root;
+}
+
+int
+XmlSnapshot::length() const
+{
+  return m_root->length;
+}
+
+int
+XmlSnapshot::revision() const
+{
+  return m_revision;
+}
+
+quint64
+XmlSnapshot::version() const
+{
+  return m_version;
+}
+
+int
+XmlSnapshot::nodeCount() const
+{
+  return m_root->size;
+}
+
+XmlSnapshot::Located
+XmlSnapshot::nodeAt(int position) const
+{
+  auto path = pathAt(position);
+  if (path.empty())
+    return { m_root.get(), 0 };
+  return path.back();
+}
+
+std::vector<XmlSnapshot::Located>
+XmlSnapshot::pathAt(int position) const
+{
+  std::vector<Located> path;
+  const XmlSnapshotNode* node = m_root.get();
+  auto nodeStart = 0;
+  while (!node->children.empty()) {
+    const auto& children = node->children;
+    auto index = children.upperBound(position - nodeStart);
+    if (index == 0)
+      break;
+    auto child = children[index - 1];
+    auto childStart = nodeStart + child.offset;
+    if (position >= childStart + child.node->length)
+      break;
+    node = child.node.get();
+    nodeStart = childStart;
+    path.push_back({ node, nodeStart });
+  }
+  return path;
+}
@@ -0,0 +1,153 @@
+#include "qxml/xmlsoftreformatter.h"
+#include "qxml/xmltrace.h"
+
+//====================================================================
+//=== XmlSoftReformatter
+//====================================================================
+XmlSoftReformatter::XmlSoftReformatter(int threshold)
+  : m_threshold(threshold)
+{
+}
+
+void
+XmlSoftReformatter::setBreaking(bool breaking)
+{
+  m_breaking = breaking;
+}
+
+const QVector<int>&
+XmlSoftReformatter::softBreaks() const
+{
+  return m_softBreaks;
+}
+
+QString
+XmlSoftReformatter::reformat(QStringView text, bool last)
+{
+  QXML_TRACE_SCOPE("XmlSoftReformatter::reformat");
+  m_pending.append(text.data(), int(text.size()));
+  auto length = int(m_pending.length());
+  auto end = last ? length : qMax(0, length - LOOKAHEAD);
+  QString shown;
+  shown.reserve(end + end / SOFT_WIDTH + 16);
+  for (auto i = 0; i < end; ++i) {
+    auto c = m_pending.at(i);
+    shown += c;
+    ++m_shownLength;
+    m_column = (c == '\n' ? 0 : m_column + 1);
+    if (m_threshold > 0 && m_column > m_threshold)
+      m_breaking = true;
+    auto tagClosed = false;
+    switch (m_state) {
+      case InContent:
+        if (c == '<') {
+          auto rest = QStringView(m_pending).mid(i);
+          m_markupLength = 0;
+          if (rest.startsWith(QLatin1String("<!--")))
+            m_state = InComment;
+          else if (rest.startsWith(QLatin1String("<![CDATA[")))
+            m_state = InCData;
+          else if (rest.startsWith(QLatin1String("<?")))
+            m_state = InProcessingInstruction;
+          else if (rest.startsWith(QLatin1String("<!"))) {
+            m_state = InDoctype;
+            m_doctypeDepth = 0;
+          } else {
+            m_state = InTag;
+            m_tag = c;
+          }
+        } else if (!c.isSpace()) {
+          m_elements.last().mixed = true;
+        }
+        break;
+      case InTag:
+        if (c == '"') {
+          m_state = InTagDoubleQuote;
+        } else if (c == '\'') {
+          m_state = InTagSingleQuote;
+        } else if (c == '>') {
+          m_state = InContent;
+          tagClosed = true;
+          if (m_tag.startsWith(QLatin1String("</"))) {
+            if (m_elements.size() > 1)
+              m_elements.removeLast();
+          } else if (!m_tag.endsWith('/')) {
+            Element element;
+            auto space = xmlSpaceOf(m_tag);
+            element.preserve =
+              (space < 0 ? m_elements.last().preserve : space == 1);
+            m_elements.append(element);
+          }
+          break;
+        }
+        m_tag += c;
+        break;
+      case InTagDoubleQuote:
+        m_tag += c;
+        if (c == '"')
+          m_state = InTag;
+        break;
+      case InTagSingleQuote:
+        m_tag += c;
+        if (c == '\'')
+          m_state = InTag;
+        break;
+      case InDoctype:
+        // the internal subset holds declarations that end in > too.
+        if (c == '[')
+          ++m_doctypeDepth;
+        else if (c == ']')
+          --m_doctypeDepth;
+        else if (c == '>' && m_doctypeDepth <= 0)
+          m_state = InContent;
+        break;
+      case InComment:
+        if (c == '>' && m_markupLength >= 6 && m_previous[1] == '-' &&
+            m_previous[0] == '-')
+          m_state = InContent;
+        break;
+      case InCData:
+        if (c == '>' && m_markupLength >= 11 && m_previous[1] == ']' &&
+            m_previous[0] == ']')
+          m_state = InContent;
+        break;
+      case InProcessingInstruction:
+        if (c == '>' && m_markupLength >= 3 && m_previous[0] == '?')
+          m_state = InContent;
+        break;
+    }
+    if (m_state != InContent) {
+      ++m_markupLength;
+      m_previous[1] = m_previous[0];
+      m_previous[0] = c;
+    }
+    if (!tagClosed || !m_breaking || m_column < SOFT_WIDTH ||
+        i + 1 >= length || m_pending.at(i + 1) != '<')
+      continue;
+    const auto& element = m_elements.last();
+    if (element.preserve || element.mixed)
+      continue;
+    m_softBreaks.append(m_shownLength);
+    shown += QLatin1Char('\n');
+    ++m_shownLength;
+    m_column = 0;
+  }
+  m_pending.remove(0, end);
+  return shown;
+}
+
+int
+XmlSoftReformatter::xmlSpaceOf(QStringView tag)
+{
+  // 1 if the start tag sets xml:space to preserve, 0 if it sets it to
+  // anything else and -1 if it does not set it.
+  auto at = tag.indexOf(QLatin1String("xml:space"));
+  if (at < 1 || !tag.at(at - 1).isSpace())
+    return -1;
+  auto i = at + 9;
+  while (i < tag.size() && (tag.at(i).isSpace() || tag.at(i) == '='))
+    ++i;
+  if (i >= tag.size() || (tag.at(i) != '"' && tag.at(i) != '\''))
+    return -1;
+  return tag.mid(i + 1).startsWith(QLatin1String("preserve")) ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+#include "qxml/xmltrace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+
+//====================================================================
+//=== XmlTrace
+//====================================================================
+XmlTrace::XmlTrace()
+  : m_enabled(false)
+{
+  m_clock.start();
+}
+
+XmlTrace*
+XmlTrace::instance()
+{
+  static XmlTrace trace;
+  return &trace;
+}
+
+bool
+XmlTrace::isEnabled() const
+{
+  return m_enabled.load(std::memory_order_relaxed);
+}
+
+void
+XmlTrace::setEnabled(bool enabled)
+{
+  m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void
+XmlTrace::clear()
+{
+  QMutexLocker locker(&m_mutex);
+  m_events.clear();
+}
+
+int
+XmlTrace::count() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_events.size();
+}
+
+qint64
+XmlTrace::now() const
+{
+  return m_clock.nsecsElapsed();
+}
+
+int
+XmlTrace::currentThreadId()
+{
+  static std::atomic<int> nextId{ 1 };
+  thread_local int threadId = 0;
+  if (threadId == 0) {
+    threadId = nextId.fetch_add(1);
+    auto thread = QThread::currentThread();
+    auto name = thread ? thread->objectName() : QString();
+    if (name.isEmpty()) {
+      if (QCoreApplication::instance() &&
+          thread == QCoreApplication::instance()->thread())
+        name = QStringLiteral("GUI");
+      else
+        name = QStringLiteral("Thread %1").arg(threadId);
+    }
+    QMutexLocker locker(&m_mutex);
+    m_threadNames.append({ threadId, name });
+  }
+  return threadId;
+}
+
+void
+XmlTrace::addEvent(const char* name, qint64 start, qint64 duration)
+{
+  auto threadId = currentThreadId();
+  QMutexLocker locker(&m_mutex);
+  m_events.append({ name, start, duration, threadId });
+}
+
+QByteArray
+XmlTrace::toJson() const
+{
+  QMutexLocker locker(&m_mutex);
+  auto pid = QByteArray::number(QCoreApplication::applicationPid());
+
+  // Written by hand rather than through QJsonDocument, a trace of a large
+  // rehighlight holds millions of events.
+  QByteArray json;
+  json.reserve(64 + (m_events.size() + m_threadNames.size()) * 96);
+  json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+  auto first = true;
+  for (const auto& thread : m_threadNames) {
+    if (!first)
+      json += ",\n";
+    first = false;
+    auto name = thread.name.toUtf8();
+    name.replace('\\', "\\\\").replace('"', "\\\"");
+    json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid +
+            ",\"tid\":" + QByteArray::number(thread.threadId) +
+            ",\"args\":{\"name\":\"" + name + "\"}}";
+  }
+
+  for (const auto& event : m_events) {
+    if (!first)
+      json += ",\n";
+    first = false;
+    // trace-event timestamps are in microseconds.
+    json += "{\"name\":\"";
+    json += event.name;
+    json += "\",\"cat\":\"qxml\",\"ph\":\"X\",\"ts\":";
+    json += QByteArray::number(double(event.start) / 1000.0, 'f', 3);
+    json += ",\"dur\":";
+    json += QByteArray::number(double(event.duration) / 1000.0, 'f', 3);
+    json += ",\"pid\":" + pid + ",\"tid\":";
+    json += QByteArray::number(event.threadId);
+    json += "}";
+  }
+
+  json += "]}\n";
+  return json;
+}
+
+bool
+XmlTrace::write(const QString& filename) const
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  auto json = toJson();
+  return file.write(json) == json.size();
+}
+
+//====================================================================
+//=== XmlTraceScope
+//====================================================================
+XmlTraceScope::XmlTraceScope(const char* name)
+  : m_name(name)
+  , m_start(-1)
+{
+  auto trace = XmlTrace::instance();
+  if (trace->isEnabled())
+    m_start = trace->now();
+}
+
+XmlTraceScope::~XmlTraceScope()
+{
+  if (m_start < 0)
+    return;
+  auto trace = XmlTrace::instance();
+  trace->addEvent(m_name, m_start, trace->now() - m_start);
+}
@@ -0,0 +1,576 @@
+#include "qxml/xmlvalidator.h"
+#include "qxml/xmltrace.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QUrl>
+
+#include <libxml/parser.h>
+#include <libxml/valid.h>
+#include <libxml/xmlerror.h>
+#include <libxml/xmlschemas.h>
+#include <libxml/xmlversion.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+#if LIBXML_VERSION >= 21200
+using ErrorPointer = const xmlError*;
+#else
+using ErrorPointer = xmlErrorPtr;
+#endif
+
+//! An error as libxml reports it.
+struct Message
+{
+  int line = 0;
+  int column = 0;
+  bool warning = false;
+  QString message;
+};
+
+/*
+ * Collects the errors libxml reports on this thread while it is in scope.
+ * Parse and DTD errors only go to the thread's structured error handler,
+ * XML Schema errors go to the handler of the validation context.
+ */
+class ErrorCollector
+{
+public:
+  ErrorCollector()
+    : m_handler(xmlStructuredError)
+    , m_context(xmlStructuredErrorContext)
+  {
+    xmlSetStructuredErrorFunc(this, &ErrorCollector::handle);
+  }
+  ~ErrorCollector() { xmlSetStructuredErrorFunc(m_context, m_handler); }
+  ErrorCollector(const ErrorCollector&) = delete;
+  ErrorCollector& operator=(const ErrorCollector&) = delete;
+
+  std::vector<Message> messages;
+
+  static void handle(void* data, ErrorPointer error)
+  {
+    if (!error)
+      return;
+    Message message;
+    message.line = error->line;
+    message.column = error->int2;
+    message.warning = (error->level == XML_ERR_WARNING);
+    message.message = QString::fromUtf8(error->message).trimmed();
+    static_cast<ErrorCollector*>(data)->messages.push_back(message);
+  }
+
+private:
+  xmlStructuredErrorFunc m_handler;
+  void* m_context;
+};
+
+//! The bytes libxml reads through readSource(), a cancelled read fails.
+struct Source
+{
+  const QByteArray* bytes = nullptr;
+  int at = 0;
+  const std::atomic<bool>* cancel = nullptr;
+};
+
+int
+readSource(void* context, char* buffer, int length)
+{
+  auto source = static_cast<Source*>(context);
+  if (source->cancel && *source->cancel)
+    return -1;
+  auto count = qMin(length, int(source->bytes->size()) - source->at);
+  std::memcpy(buffer, source->bytes->constData() + source->at, size_t(count));
+  source->at += count;
+  return count;
+}
+
+int
+closeSource(void*)
+{
+  return 0;
+}
+
+std::vector<Message>
+run(const QByteArray& bytes,
+    xmlSchemaPtr schema,
+    xmlDtdPtr dtd,
+    QMutex& dtdMutex,
+    const std::atomic<bool>* cancel)
+{
+  ErrorCollector collector;
+  Source source;
+  source.bytes = &bytes;
+  source.cancel = cancel;
+
+  if (schema) {
+    // XML Schemas are validated as the text streams past, no tree is built.
+    auto context = xmlSchemaNewValidCtxt(schema);
+    if (!context)
+      return {};
+    xmlSchemaSetValidStructuredErrors(
+      context, &ErrorCollector::handle, &collector);
+    // the stream takes the input over.
+    auto input = xmlParserInputBufferCreateIO(
+      readSource, closeSource, &source, XML_CHAR_ENCODING_UTF8);
+    if (input)
+      xmlSchemaValidateStream(
+        context, input, XML_CHAR_ENCODING_UTF8, nullptr, nullptr);
+    xmlSchemaFreeValidCtxt(context);
+    return std::move(collector.messages);
+  }
+
+  auto parser = xmlCreateIOParserCtxt(nullptr,
+                                      nullptr,
+                                      readSource,
+                                      closeSource,
+                                      &source,
+                                      XML_CHAR_ENCODING_UTF8);
+  if (!parser)
+    return {};
+  xmlCtxtUseOptions(parser, XML_PARSE_NONET);
+  xmlParseDocument(parser);
+  auto document = parser->myDoc;
+  auto wellFormed = parser->wellFormed;
+  parser->myDoc = nullptr;
+  xmlFreeParserCtxt(parser);
+  if (document && wellFormed && !(cancel && *cancel)) {
+    QMutexLocker locker(&dtdMutex);
+    auto context = xmlNewValidCtxt();
+    if (context) {
+      xmlValidateDtd(context, document, dtd);
+      xmlFreeValidCtxt(context);
+    }
+  }
+  if (document)
+    xmlFreeDoc(document);
+  return std::move(collector.messages);
+}
+
+//! A tag of a written snapshot, the line its closing > is on.
+struct Tag
+{
+  int line = 0;
+  int position = 0;
+  int length = 0;
+};
+
+/*
+ * Writes a snapshot out for libxml. Every tag gets a line break before its
+ * closing >, which is where libxml is when it reports an error on it, so
+ * the line of an error identifies the tag.
+ */
+class Writer
+{
+public:
+  QByteArray bytes;
+  //! Ordered by line.
+  std::vector<Tag> tags;
+
+  void write(const XmlSnapshotNode& node, int start);
+
+private:
+  int m_line = 1;
+
+  void append(const QString& text);
+  void appendEscaped(const QString& text, bool attribute);
+  void closeTag(const char* close, int position, int length);
+};
+
+void
+Writer::append(const QString& text)
+{
+  m_line += int(text.count(QLatin1Char('\n')));
+  bytes += text.toUtf8();
+}
+
+void
+Writer::appendEscaped(const QString& text, bool attribute)
+{
+  QString escaped;
+  escaped.reserve(text.size());
+  for (auto c : text) {
+    switch (c.unicode()) {
+      case '&':
+        escaped += QLatin1String("&amp;");
+        break;
+      case '<':
+        escaped += QLatin1String("&lt;");
+        break;
+      case '>':
+        escaped += QLatin1String("&gt;");
+        break;
+      case '"':
+        escaped += attribute ? QLatin1String("&quot;") : QLatin1String("\"");
+        break;
+      case '\r':
+        // a carriage return would be normalised away.
+        escaped += QLatin1String("&#13;");
+        break;
+      case '\n':
+        if (attribute) {
+          escaped += QLatin1String("&#10;");
+        } else {
+          escaped += c;
+          ++m_line;
+        }
+        break;
+      case '\t':
+        escaped += attribute ? QLatin1String("&#9;") : QLatin1String("\t");
+        break;
+      default:
+        escaped += c;
+        break;
+    }
+  }
+  bytes += escaped.toUtf8();
+}
+
+void
+Writer::closeTag(const char* close, int position, int length)
+{
+  bytes += '\n';
+  bytes += close;
+  ++m_line;
+  tags.push_back({ m_line, position, length });
+}
+
+void
+Writer::write(const XmlSnapshotNode& node, int start)
+{
+  switch (node.kind) {
+    case XmlSnapshotNode::Document:
+      for (const auto& child : node.children)
+        write(*child.node, start + child.offset);
+      break;
+    case XmlSnapshotNode::Declaration:
+      // the text is UTF-8 whatever the declaration says.
+      break;
+    case XmlSnapshotNode::Element: {
+      bytes += '<';
+      bytes += node.name.toUtf8();
+      for (const auto& attribute : node.attributes) {
+        // attributes defaulted by the DTD of the text are not in it.
+        if (attribute.nameOffset < 0)
+          continue;
+        bytes += ' ';
+        bytes += attribute.name.toUtf8();
+        bytes += "=\"";
+        appendEscaped(attribute.value, true);
+        bytes += '"';
+      }
+      if (node.children.empty()) {
+        closeTag("/>", start, node.startTagLength);
+        break;
+      }
+      closeTag(">", start, node.startTagLength);
+      for (const auto& child : node.children)
+        write(*child.node, start + child.offset);
+      bytes += "</";
+      bytes += node.name.toUtf8();
+      if (node.endTagOffset >= 0)
+        closeTag(
+          ">", start + node.endTagOffset, node.length - node.endTagOffset);
+      else
+        closeTag(">", start, node.startTagLength);
+      break;
+    }
+    case XmlSnapshotNode::Text:
+      appendEscaped(node.content, false);
+      break;
+    case XmlSnapshotNode::CData:
+      bytes += "<![CDATA[";
+      append(node.content);
+      bytes += "]]>";
+      break;
+    case XmlSnapshotNode::Comment:
+      bytes += "<!--";
+      append(node.content);
+      bytes += "-->";
+      break;
+    case XmlSnapshotNode::Instruction:
+      bytes += "<?";
+      bytes += node.name.toUtf8();
+      if (!node.content.isEmpty()) {
+        bytes += ' ';
+        append(node.content);
+      }
+      bytes += "?>";
+      break;
+  }
+}
+
+} // end of anonymous namespace
+
+//====================================================================
+//=== XmlSchema
+//====================================================================
+XmlSchema::~XmlSchema()
+{
+  if (m_schema)
+    xmlSchemaFree(m_schema);
+  if (m_dtd)
+    xmlFreeDtd(m_dtd);
+}
+
+XmlSchema::Type
+XmlSchema::typeOf(const QString& location)
+{
+  return location.endsWith(QLatin1String(".dtd"), Qt::CaseInsensitive) ? Dtd
+                                                                      : Xsd;
+}
+
+XmlSchema::Type
+XmlSchema::type() const
+{
+  return m_type;
+}
+
+const QString&
+XmlSchema::location() const
+{
+  return m_location;
+}
+
+const QDateTime&
+XmlSchema::modified() const
+{
+  return m_modified;
+}
+
+//====================================================================
+//=== XmlSchemaCache
+//====================================================================
+XmlSchemaCache::XmlSchemaCache()
+{
+  // libxml sets up its globals once, before threads use it.
+  xmlInitParser();
+}
+
+XmlSchemaCache&
+XmlSchemaCache::instance()
+{
+  static XmlSchemaCache cache;
+  return cache;
+}
+
+XmlSchema::Ptr
+XmlSchemaCache::schema(const QString& location,
+                       XmlSchema::Type type,
+                       QString* error)
+{
+  // a one letter scheme is a Windows drive.
+  QUrl url(location);
+  auto remote = (!url.isLocalFile() && url.scheme().size() > 1);
+  auto source = location;
+  QDateTime modified;
+  if (!remote) {
+    QFileInfo info(url.isLocalFile() ? url.toLocalFile() : location);
+    if (!info.exists()) {
+      if (error)
+        *error = QStringLiteral("%1: no such file").arg(location);
+      return {};
+    }
+    source = info.canonicalFilePath();
+    modified = info.lastModified();
+  }
+  auto key = (type == XmlSchema::Dtd ? QStringLiteral("dtd:")
+                                     : QStringLiteral("xsd:")) +
+             source;
+
+  {
+    QMutexLocker locker(&m_mutex);
+    auto it = m_schemas.constFind(key);
+    if (it != m_schemas.constEnd() && it.value()->modified() == modified)
+      return it.value();
+  }
+  // compiled unlocked, a large schema would hold up every other lookup. Two
+  // threads may both compile it the first time, the last one is kept.
+  auto compiled = compile(source, type, modified, error);
+  if (!compiled)
+    return {};
+  QMutexLocker locker(&m_mutex);
+  m_schemas.insert(key, compiled);
+  return compiled;
+}
+
+XmlSchema::Ptr
+XmlSchemaCache::schema(const QString& location, QString* error)
+{
+  return schema(location, XmlSchema::typeOf(location), error);
+}
+
+int
+XmlSchemaCache::size() const
+{
+  QMutexLocker locker(&m_mutex);
+  return int(m_schemas.size());
+}
+
+void
+XmlSchemaCache::clear()
+{
+  QMutexLocker locker(&m_mutex);
+  m_schemas.clear();
+}
+
+XmlSchema::Ptr
+XmlSchemaCache::compile(const QString& location,
+                        XmlSchema::Type type,
+                        const QDateTime& modified,
+                        QString* error)
+{
+  QXML_TRACE_SCOPE("XmlSchemaCache::compile");
+  ErrorCollector collector;
+  std::shared_ptr<XmlSchema> schema(new XmlSchema());
+  schema->m_type = type;
+  schema->m_location = location;
+  schema->m_modified = modified;
+  auto path = location.toUtf8();
+  if (type == XmlSchema::Xsd) {
+    auto context = xmlSchemaNewParserCtxt(path.constData());
+    if (context) {
+      xmlSchemaSetParserStructuredErrors(
+        context, &ErrorCollector::handle, &collector);
+      schema->m_schema = xmlSchemaParse(context);
+      xmlSchemaFreeParserCtxt(context);
+    }
+  } else {
+    schema->m_dtd =
+      xmlParseDTD(nullptr, reinterpret_cast<const xmlChar*>(path.constData()));
+  }
+  if (!schema->m_schema && !schema->m_dtd) {
+    if (error) {
+      // the first error says why, a missing file is only a warning.
+      const auto& messages = collector.messages;
+      auto first = std::find_if(
+        messages.cbegin(), messages.cend(), [](const Message& message) {
+          return !message.warning;
+        });
+      if (first == messages.cend())
+        first = messages.cbegin();
+      *error = QStringLiteral("%1: %2").arg(
+        location,
+        first != messages.cend() ? first->message
+                                 : QStringLiteral("cannot compile"));
+    }
+    return {};
+  }
+  return schema;
+}
+
+//====================================================================
+//=== XmlValidator
+//====================================================================
+XmlValidator::XmlValidator(QObject* parent)
+  : QObject(parent)
+{
+  // validated() crosses back to the GUI thread.
+  qRegisterMetaType<XmlValidationErrors>();
+}
+
+void
+XmlValidator::validate(const XmlSnapshot::Ptr& snapshot,
+                       const QString& location,
+                       int generation)
+{
+  QXML_TRACE_SCOPE("XmlValidator::validate");
+  m_cancel = false;
+  if (!snapshot)
+    return;
+  QString message;
+  auto schema = XmlSchemaCache::instance().schema(location, &message);
+  XmlValidationErrors errors;
+  if (schema) {
+    errors = validateSnapshot(*snapshot, *schema, &m_cancel);
+  } else {
+    XmlValidationError error;
+    error.message = message;
+    errors.append(error);
+  }
+  if (m_cancel)
+    return;
+  emit validated(generation, snapshot->revision(), errors);
+}
+
+void
+XmlValidator::cancel()
+{
+  m_cancel = true;
+}
+
+XmlValidationErrors
+XmlValidator::validateSnapshot(const XmlSnapshot& snapshot,
+                               const XmlSchema& schema,
+                               const std::atomic<bool>* cancel)
+{
+  QXML_TRACE_SCOPE("XmlValidator::validateSnapshot");
+  Writer writer;
+  writer.write(snapshot.root(), 0);
+  auto messages = run(
+    writer.bytes, schema.m_schema, schema.m_dtd, schema.m_dtdMutex, cancel);
+
+  XmlValidationErrors errors;
+  errors.reserve(int(messages.size()));
+  for (const auto& message : messages) {
+    XmlValidationError error;
+    error.warning = message.warning;
+    error.message = message.message;
+    // the tag whose closing > is on the line, or the last one before it.
+    auto it = std::upper_bound(
+      writer.tags.cbegin(),
+      writer.tags.cend(),
+      message.line,
+      [](int line, const Tag& tag) { return line < tag.line; });
+    if (message.line > 0 && it != writer.tags.cbegin()) {
+      --it;
+      error.position = it->position;
+      error.length = it->length;
+    }
+    errors.append(error);
+  }
+  return errors;
+}
+
+XmlValidationErrors
+XmlValidator::validateText(const QString& text,
+                           const XmlSchema& schema,
+                           const std::atomic<bool>* cancel)
+{
+  QXML_TRACE_SCOPE("XmlValidator::validateText");
+  auto messages = run(text.toUtf8(),
+                      schema.m_schema,
+                      schema.m_dtd,
+                      schema.m_dtdMutex,
+                      cancel);
+
+  // libxml counts line feeds, and columns in characters from 1.
+  std::vector<int> lineStarts{ 0 };
+  for (auto i = 0; i < text.size(); ++i) {
+    if (text.at(i) == QLatin1Char('\n'))
+      lineStarts.push_back(i + 1);
+  }
+  XmlValidationErrors errors;
+  errors.reserve(int(messages.size()));
+  for (const auto& message : messages) {
+    XmlValidationError error;
+    error.line = message.line;
+    error.column = message.column;
+    error.warning = message.warning;
+    error.message = message.message;
+    if (message.line > 0 && size_t(message.line) <= lineStarts.size()) {
+      auto lineStart = lineStarts[size_t(message.line - 1)];
+      auto lineEnd = size_t(message.line) < lineStarts.size()
+                       ? lineStarts[size_t(message.line)] - 1
+                       : int(text.size());
+      error.position =
+        qMin(lineStart + qMax(0, message.column - 1), lineEnd);
+    }
+    errors.append(error);
+  }
+  return errors;
+}
@@ -0,0 +1,197 @@
+#include "qxml/xmldiff.h"
+
+#include <QTemporaryDir>
+#include <QtTest>
+
+/*
+ * XmlDiff edit scripts. Positions are checked against the texts themselves,
+ * so a CR LF file has to come back in positions of the file.
+ */
+class TestXmlDiff : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void equalTexts();
+  void siblingMoved();
+  void movedToAnotherParent();
+  void attributeChanged();
+  void lineEndsAreLayout();
+  void crlfFilePositions();
+  void crlfFileMove();
+  void fileErrors();
+
+private:
+  static XmlDiff::Script compare(const QString& from, const QString& to);
+  static QString writeFile(const QTemporaryDir& dir,
+                           const QString& name,
+                           const QString& text);
+};
+
+XmlDiff::Script
+TestXmlDiff::compare(const QString& from, const QString& to)
+{
+  auto a = XmlDiff::snapshotOf(from);
+  auto b = XmlDiff::snapshotOf(to);
+  if (!a || !b)
+    return {};
+  return XmlDiff::compare(*a, *b);
+}
+
+QString
+TestXmlDiff::writeFile(const QTemporaryDir& dir,
+                       const QString& name,
+                       const QString& text)
+{
+  auto path = dir.filePath(name);
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+    return QString();
+  file.write(text.toUtf8());
+  return path;
+}
+
+void
+TestXmlDiff::equalTexts()
+{
+  QString text = "<r><a x=\"1\" y=\"2\">t</a><!-- c --></r>";
+  QVERIFY(compare(text, text).isEmpty());
+  // attribute order and whitespace between elements are not differences.
+  QVERIFY(compare(text, "<r>\n  <a y=\"2\" x=\"1\">t</a>\n  <!-- c -->\n</r>")
+            .isEmpty());
+}
+
+void
+TestXmlDiff::siblingMoved()
+{
+  QString from = "<r><a/><b/><c/></r>";
+  QString to = "<r><c/><a/><b/></r>";
+  auto script = compare(from, to);
+  QCOMPARE(int(script.size()), 1);
+  const auto& operation = script.first();
+  QCOMPARE(operation.type, XmlDiff::Operation::Moved);
+  QCOMPARE(operation.kind, XmlSnapshotNode::Element);
+  QCOMPARE(operation.name, QStringLiteral("c"));
+  QCOMPARE(operation.path, QStringLiteral("/r"));
+  QCOMPARE(operation.oldPosition, int(from.indexOf("<c/>")));
+  QCOMPARE(operation.newPosition, int(to.indexOf("<c/>")));
+  QCOMPARE(operation.oldLength, 4);
+  QCOMPARE(operation.newLength, 4);
+}
+
+void
+TestXmlDiff::movedToAnotherParent()
+{
+  // a deletion and an insertion of the same subtree are one move.
+  QString from = "<r><p><x>1</x></p><q/></r>";
+  QString to = "<r><p/><q><x>1</x></q></r>";
+  auto script = compare(from, to);
+  QCOMPARE(int(script.size()), 1);
+  const auto& operation = script.first();
+  QCOMPARE(operation.type, XmlDiff::Operation::Moved);
+  QCOMPARE(operation.name, QStringLiteral("x"));
+  QCOMPARE(operation.oldPosition, int(from.indexOf("<x>")));
+  QCOMPARE(operation.newPosition, int(to.indexOf("<x>")));
+  QCOMPARE(operation.oldLength, 8);
+  QCOMPARE(operation.newLength, 8);
+}
+
+void
+TestXmlDiff::attributeChanged()
+{
+  QString from = "<r><a v=\"1\"/><b/></r>";
+  QString to = "<r><a v=\"22\" w=\"3\"/><b/></r>";
+  auto script = compare(from, to);
+  QCOMPARE(int(script.size()), 2);
+  QCOMPARE(script.at(0).type, XmlDiff::Operation::AttributeChanged);
+  QCOMPARE(script.at(0).name, QStringLiteral("v"));
+  QCOMPARE(script.at(0).path, QStringLiteral("/r"));
+  QCOMPARE(script.at(0).oldValue, QStringLiteral("1"));
+  QCOMPARE(script.at(0).newValue, QStringLiteral("22"));
+  QCOMPARE(script.at(0).oldPosition, int(from.indexOf("1\"")));
+  QCOMPARE(script.at(0).newPosition, int(to.indexOf("22")));
+  QCOMPARE(script.at(1).type, XmlDiff::Operation::AttributeAdded);
+  QCOMPARE(script.at(1).name, QStringLiteral("w"));
+  QCOMPARE(script.at(1).newPosition, int(to.indexOf("w=")));
+}
+
+void
+TestXmlDiff::lineEndsAreLayout()
+{
+  QString lf = "<r>\n<a>t</a>\n</r>\n";
+  QString crlf = "<r>\r\n<a>t</a>\r\n</r>\r\n";
+  QString cr = "<r>\r<a>t</a>\r</r>\r";
+  QVERIFY(compare(lf, crlf).isEmpty());
+  QVERIFY(compare(crlf, cr).isEmpty());
+
+  // the snapshot holds the text as a QTextDocument would.
+  auto snapshot = XmlDiff::snapshotOf(crlf);
+  QVERIFY(snapshot);
+  QCOMPARE(snapshot->length(), int(lf.length()));
+}
+
+void
+TestXmlDiff::crlfFilePositions()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  QString from = "<r>\r\n  <a v=\"1\"/>\r\n  <b>old</b>\r\n</r>\r\n";
+  QString to = "<r>\r\n  <a v=\"22\"/>\r\n  <b>new</b>\r\n</r>\r\n";
+  QString error;
+  auto script = XmlDiff::compareFiles(
+    writeFile(dir, "from.xml", from), writeFile(dir, "to.xml", to), &error);
+  QVERIFY2(error.isEmpty(), qPrintable(error));
+  QCOMPARE(int(script.size()), 2);
+
+  QCOMPARE(script.at(0).type, XmlDiff::Operation::AttributeChanged);
+  QCOMPARE(script.at(0).oldPosition, int(from.indexOf("1\"")));
+  QCOMPARE(script.at(0).oldLength, 1);
+  QCOMPARE(script.at(0).newPosition, int(to.indexOf("22")));
+  QCOMPARE(script.at(0).newLength, 2);
+
+  QCOMPARE(script.at(1).type, XmlDiff::Operation::TextChanged);
+  QCOMPARE(script.at(1).oldPosition, int(from.indexOf("old")));
+  QCOMPARE(script.at(1).oldLength, 3);
+  QCOMPARE(script.at(1).newPosition, int(to.indexOf("new")));
+  QCOMPARE(script.at(1).newLength, 3);
+}
+
+void
+TestXmlDiff::crlfFileMove()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  QString from = "<r>\r\n<a/>\r\n<b/>\r\n</r>\r\n";
+  QString to = "<r>\r\n<b/>\r\n<a/>\r\n</r>\r\n";
+  QString error;
+  auto script = XmlDiff::compareFiles(
+    writeFile(dir, "from.xml", from), writeFile(dir, "to.xml", to), &error);
+  QVERIFY2(error.isEmpty(), qPrintable(error));
+  QCOMPARE(int(script.size()), 1);
+  const auto& operation = script.first();
+  QCOMPARE(operation.type, XmlDiff::Operation::Moved);
+  QCOMPARE(operation.name, QStringLiteral("b"));
+  QCOMPARE(operation.oldPosition, int(from.indexOf("<b/>")));
+  QCOMPARE(operation.newPosition, int(to.indexOf("<b/>")));
+  QCOMPARE(operation.oldLength, 4);
+}
+
+void
+TestXmlDiff::fileErrors()
+{
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  auto good = writeFile(dir, "good.xml", "<r/>");
+  auto bad = writeFile(dir, "bad.xml", "<r>");
+  QString error;
+  QVERIFY(XmlDiff::compareFiles(good, dir.filePath("missing.xml"), &error)
+            .isEmpty());
+  QVERIFY(!error.isEmpty());
+  error.clear();
+  QVERIFY(XmlDiff::compareFiles(good, bad, &error).isEmpty());
+  QVERIFY(error.startsWith(bad));
+  QVERIFY(!XmlDiff::snapshotOf("<r>"));
+}
+
+QTEST_GUILESS_MAIN(TestXmlDiff)
+#include "tst_xmldiff.moc"
@@ -0,0 +1,134 @@
+#include "qxml/xmleventparser.h"
+
+#include <QtTest>
+
+/*
+ * The bounds of XmlEventParser::setLimits(). A parse that exceeds one fails,
+ * says which in limitError() and leaves no tree, not even the previous one.
+ */
+class TestXmlLimits : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void withinLimits();
+  void depthLimit();
+  void attributeLimit();
+  void nodeLimit();
+  void textLengthLimit();
+  void dropsPreviousTree();
+  void limitsApplyToLaterParses();
+};
+
+void
+TestXmlLimits::withinLimits()
+{
+  XmlEventParser parser(nullptr);
+  parser.setLimits(XmlEventParser::Limits::untrusted());
+  QVERIFY(parser.parseString("<r a=\"1\"><b>text</b><!-- c --></r>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::NoLimitExceeded);
+  QVERIFY(!parser.nodes().isEmpty());
+}
+
+void
+TestXmlLimits::depthLimit()
+{
+  XmlEventParser parser(nullptr);
+  XmlEventParser::Limits limits;
+  limits.maxDepth = 2;
+  parser.setLimits(limits);
+  QVERIFY(parser.parseString("<a><b/></a>"));
+  QVERIFY(!parser.parseString("<a><b><c/></b></a>"));
+  const auto& error = parser.limitError();
+  QCOMPARE(error.limit, XmlEventParser::DepthLimit);
+  QCOMPARE(error.maximum, qint64(2));
+  QVERIFY(error.value > error.maximum);
+  QCOMPARE(error.name, QStringLiteral("c"));
+  QVERIFY(parser.nodes().isEmpty());
+  QVERIFY(!parser.errorMessage().isEmpty());
+}
+
+void
+TestXmlLimits::attributeLimit()
+{
+  XmlEventParser parser(nullptr);
+  XmlEventParser::Limits limits;
+  limits.maxAttributes = 2;
+  parser.setLimits(limits);
+  QVERIFY(parser.parseString("<r a=\"1\" b=\"2\"/>"));
+  QVERIFY(!parser.parseString("<r a=\"1\" b=\"2\" c=\"3\"/>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::AttributeLimit);
+  QCOMPARE(parser.limitError().value, qint64(3));
+  QCOMPARE(parser.limitError().name, QStringLiteral("r"));
+  QVERIFY(parser.nodes().isEmpty());
+}
+
+void
+TestXmlLimits::nodeLimit()
+{
+  XmlEventParser parser(nullptr);
+  XmlEventParser::Limits limits;
+  limits.maxNodes = 10;
+  parser.setLimits(limits);
+  QString text = "<r>";
+  for (auto i = 0; i < 20; ++i)
+    text += "<e/>";
+  text += "</r>";
+  QVERIFY(!parser.parseString(text));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::NodeLimit);
+  QVERIFY(parser.limitError().nodeCount <= 10);
+  QVERIFY(parser.nodes().isEmpty());
+}
+
+void
+TestXmlLimits::textLengthLimit()
+{
+  XmlEventParser parser(nullptr);
+  XmlEventParser::Limits limits;
+  limits.maxTextLength = 16;
+  parser.setLimits(limits);
+  QVERIFY(!parser.parseString("<r>" + QString(17, 'x') + "</r>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::TextLengthLimit);
+  QVERIFY(!parser.parseString("<r a=\"" + QString(17, 'x') + "\"/>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::TextLengthLimit);
+  QCOMPARE(parser.limitError().name, QStringLiteral("a"));
+}
+
+void
+TestXmlLimits::dropsPreviousTree()
+{
+  // a text that is not well formed keeps the previous tree, one that
+  // exceeds a bound does not.
+  XmlEventParser parser(nullptr);
+  XmlEventParser::Limits limits;
+  limits.maxDepth = 2;
+  parser.setLimits(limits);
+  QVERIFY(parser.parseString("<a><b/></a>"));
+  auto count = parser.nodes().size();
+  QVERIFY(count > 0);
+  QVERIFY(!parser.parseString("<a><b></a>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::NoLimitExceeded);
+  QCOMPARE(parser.nodes().size(), count);
+  QVERIFY(!parser.parseString("<a><b><c/></b></a>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::DepthLimit);
+  QVERIFY(parser.nodes().isEmpty());
+  QVERIFY(parser.rootNode() == nullptr);
+}
+
+void
+TestXmlLimits::limitsApplyToLaterParses()
+{
+  XmlEventParser parser(nullptr);
+  QVERIFY(parser.parseString("<a><b><c/></b></a>"));
+  XmlEventParser::Limits limits;
+  limits.maxDepth = 2;
+  parser.setLimits(limits);
+  QCOMPARE(parser.limits().maxDepth, 2);
+  QVERIFY(!parser.parseString("<a><b><c/></b></a>"));
+  parser.setLimits(XmlEventParser::Limits());
+  QVERIFY(parser.parseString("<a><b><c/></b></a>"));
+  QCOMPARE(parser.limitError().limit, XmlEventParser::NoLimitExceeded);
+}
+
+QTEST_GUILESS_MAIN(TestXmlLimits)
+#include "tst_xmllimits.moc"
@@ -0,0 +1,218 @@
+#include "qxml/xmldocument.h"
+#include "qxml/xmloutlinemodel.h"
+
+#include <QAbstractItemModelTester>
+#include <QSignalSpy>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QtTest>
+
+/*
+ * XmlOutlineModel follows the snapshots of an XmlDocument. Rows of elements
+ * an edit leaves alone keep their indexes, the others are inserted, removed
+ * or relabelled, and the model is never reset or relaid out.
+ */
+class TestXmlOutlineModel : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void init();
+  void cleanup();
+  void rowsAreFetchedLazily();
+  void insertKeepsRows();
+  void removeKeepsRows();
+  void keyAttributeChangesLabel();
+
+private:
+  XmlDocument* m_document = nullptr;
+  XmlOutlineModel* m_model = nullptr;
+  QAbstractItemModelTester* m_tester = nullptr;
+
+  QModelIndex fetchedRoot();
+  void replace(int position, int length, const QString& text);
+  static void fetchAll(QAbstractItemModel& model, const QModelIndex& parent);
+};
+
+namespace {
+
+const QString TEXT = "<r>\n"
+                     "  <a k=\"1\"/>\n"
+                     "  <b k=\"2\"><x/></b>\n"
+                     "  <c k=\"3\"/>\n"
+                     "</r>";
+
+} // end of anonymous namespace
+
+void
+TestXmlOutlineModel::init()
+{
+  m_document = new XmlDocument(this);
+  m_document->beginText();
+  m_document->textDocument()->setPlainText(TEXT);
+  m_document->endText(TEXT);
+  if (!m_document->snapshot())
+    m_document->reparse();
+  QVERIFY(m_document->snapshot());
+
+  m_model = new XmlOutlineModel(this);
+  m_model->setKeyAttributes({ "k" });
+  m_model->setDocument(m_document);
+}
+
+void
+TestXmlOutlineModel::cleanup()
+{
+  delete m_tester;
+  delete m_model;
+  delete m_document;
+  m_tester = nullptr;
+  m_model = nullptr;
+  m_document = nullptr;
+}
+
+void
+TestXmlOutlineModel::fetchAll(QAbstractItemModel& model,
+                              const QModelIndex& parent)
+{
+  while (model.canFetchMore(parent))
+    model.fetchMore(parent);
+}
+
+QModelIndex
+TestXmlOutlineModel::fetchedRoot()
+{
+  fetchAll(*m_model, QModelIndex());
+  auto root = m_model->index(0, 0);
+  fetchAll(*m_model, root);
+  // the tester fetches every row itself, so it is only made once the rows
+  // are in.
+  m_tester = new QAbstractItemModelTester(
+    m_model, QAbstractItemModelTester::FailureReportingMode::QtTest, this);
+  return root;
+}
+
+void
+TestXmlOutlineModel::replace(int position, int length, const QString& text)
+{
+  QTextCursor cursor(m_document->textDocument());
+  cursor.setPosition(position);
+  cursor.setPosition(position + length, QTextCursor::KeepAnchor);
+  cursor.insertText(text);
+  m_document->reparse();
+}
+
+void
+TestXmlOutlineModel::rowsAreFetchedLazily()
+{
+  fetchAll(*m_model, QModelIndex());
+  QCOMPARE(m_model->rowCount(), 1);
+  auto root = m_model->index(0, 0);
+  QVERIFY(m_model->hasChildren(root));
+  QCOMPARE(m_model->rowCount(root), 0);
+  QVERIFY(m_model->canFetchMore(root));
+  fetchAll(*m_model, root);
+  QCOMPARE(m_model->rowCount(root), 3);
+  QCOMPARE(m_model->data(m_model->index(1, 0, root)).toString(),
+           QStringLiteral("b k=\"2\""));
+  QCOMPARE(m_model->position(m_model->index(2, 0, root)),
+           int(TEXT.indexOf("<c")));
+}
+
+void
+TestXmlOutlineModel::insertKeepsRows()
+{
+  auto root = fetchedRoot();
+  QPersistentModelIndex persistentRoot(root);
+  QPersistentModelIndex a(m_model->index(0, 0, root));
+  QPersistentModelIndex b(m_model->index(1, 0, root));
+  QPersistentModelIndex c(m_model->index(2, 0, root));
+  auto cPosition = m_model->position(c);
+
+  QSignalSpy reset(m_model, &QAbstractItemModel::modelReset);
+  QSignalSpy layout(m_model, &QAbstractItemModel::layoutChanged);
+  QSignalSpy inserted(m_model, &QAbstractItemModel::rowsInserted);
+  QSignalSpy removed(m_model, &QAbstractItemModel::rowsRemoved);
+
+  QString added = "<n/>\n  ";
+  replace(int(TEXT.indexOf("<b")), 0, added);
+
+  QCOMPARE(reset.count(), 0);
+  QCOMPARE(layout.count(), 0);
+  QCOMPARE(removed.count(), 0);
+  QCOMPARE(inserted.count(), 1);
+  QCOMPARE(inserted.first().at(0).value<QModelIndex>(), root);
+  QCOMPARE(inserted.first().at(1).toInt(), 1);
+  QCOMPARE(inserted.first().at(2).toInt(), 1);
+
+  QVERIFY(persistentRoot.isValid());
+  QCOMPARE(m_model->rowCount(root), 4);
+  QCOMPARE(a.row(), 0);
+  QCOMPARE(b.row(), 2);
+  QCOMPARE(c.row(), 3);
+  QCOMPARE(b.data(XmlOutlineModel::NameRole).toString(), QStringLiteral("b"));
+  QCOMPARE(m_model->index(1, 0, root).data(XmlOutlineModel::NameRole)
+             .toString(),
+           QStringLiteral("n"));
+  QCOMPARE(m_model->position(c), cPosition + int(added.length()));
+}
+
+void
+TestXmlOutlineModel::removeKeepsRows()
+{
+  auto root = fetchedRoot();
+  QPersistentModelIndex b(m_model->index(1, 0, root));
+  QPersistentModelIndex c(m_model->index(2, 0, root));
+
+  QSignalSpy reset(m_model, &QAbstractItemModel::modelReset);
+  QSignalSpy layout(m_model, &QAbstractItemModel::layoutChanged);
+  QSignalSpy removed(m_model, &QAbstractItemModel::rowsRemoved);
+
+  QString gone = "<a k=\"1\"/>\n  ";
+  replace(int(TEXT.indexOf(gone)), int(gone.length()), QString());
+
+  QCOMPARE(reset.count(), 0);
+  QCOMPARE(layout.count(), 0);
+  QCOMPARE(removed.count(), 1);
+  QCOMPARE(removed.first().at(1).toInt(), 0);
+  QCOMPARE(removed.first().at(2).toInt(), 0);
+  QCOMPARE(m_model->rowCount(root), 2);
+  QCOMPARE(b.row(), 0);
+  QCOMPARE(c.row(), 1);
+  QCOMPARE(c.data(XmlOutlineModel::NameRole).toString(), QStringLiteral("c"));
+}
+
+void
+TestXmlOutlineModel::keyAttributeChangesLabel()
+{
+  auto root = fetchedRoot();
+  QPersistentModelIndex b(m_model->index(1, 0, root));
+
+  QSignalSpy reset(m_model, &QAbstractItemModel::modelReset);
+  QSignalSpy layout(m_model, &QAbstractItemModel::layoutChanged);
+  QSignalSpy inserted(m_model, &QAbstractItemModel::rowsInserted);
+  QSignalSpy removed(m_model, &QAbstractItemModel::rowsRemoved);
+  QSignalSpy changed(m_model, &QAbstractItemModel::dataChanged);
+
+  replace(int(TEXT.indexOf("2\"")), 1, "9");
+
+  QCOMPARE(reset.count(), 0);
+  QCOMPARE(layout.count(), 0);
+  QCOMPARE(inserted.count(), 0);
+  QCOMPARE(removed.count(), 0);
+  QCOMPARE(b.row(), 1);
+  QCOMPARE(b.data().toString(), QStringLiteral("b k=\"9\""));
+
+  auto covered = false;
+  for (const auto& arguments : changed) {
+    auto topLeft = arguments.at(0).value<QModelIndex>();
+    auto bottomRight = arguments.at(1).value<QModelIndex>();
+    if (topLeft.parent() == root && topLeft.row() <= b.row() &&
+        bottomRight.row() >= b.row())
+      covered = true;
+  }
+  QVERIFY(covered);
+}
+
+QTEST_MAIN(TestXmlOutlineModel)
+#include "tst_xmloutlinemodel.moc"
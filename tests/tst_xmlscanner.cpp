@@ -0,0 +1,162 @@
+#include "qxml/xmlscanner.h"
+
+#include <QRandomGenerator>
+#include <QtTest>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+/*
+ * Every instruction set XmlScanner can use on this processor has to find
+ * what the scalar loop finds, at every length and alignment, so that the
+ * vector loops and their tails agree with it.
+ */
+class TestXmlScanner : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void initTestCase();
+  void cleanupTestCase();
+  void scalarMatchesReference();
+  void vectorMatchesScalar_data();
+  void vectorMatchesScalar();
+
+private:
+  XmlScanner::Isa m_best = XmlScanner::Scalar;
+
+  static std::vector<std::u16string> texts();
+  static std::vector<uint32_t> reference(const std::u16string& text,
+                                         const char* chars);
+};
+
+namespace {
+
+//! Code units that look like markup to a scanner that only compares
+//! bytes: the low or high byte of each is a structural character.
+const char16_t LOOKALIKES[] = { 0x013C, 0x3C00, 0x3E3E, 0x0A26, 0x2722,
+                                0x00E9, 0x4E2D, 0xD83D, 0xDE00 };
+
+const char* const SETS[] = { XmlScanner::STRUCTURAL, "\n", "<>", "]]->?&;=" };
+
+} // end of anonymous namespace
+
+void
+TestXmlScanner::initTestCase()
+{
+  m_best = XmlScanner::isa();
+}
+
+void
+TestXmlScanner::cleanupTestCase()
+{
+  XmlScanner::setIsa(m_best);
+}
+
+std::vector<std::u16string>
+TestXmlScanner::texts()
+{
+  // every length up to a few vectors with a tail, then a long text.
+  const char16_t alphabet[] = { u'<', u'>', u'&', u'"', u'\'', u'\n', u'a',
+                                u' ', u']', u'-', u'?', u'=', u';' };
+  QRandomGenerator random(1);
+  std::vector<std::u16string> result;
+  for (auto length = 0; length <= 200; ++length) {
+    std::u16string text;
+    for (auto i = 0; i < length; ++i) {
+      auto pick = random.bounded(4);
+      if (pick == 0)
+        text += LOOKALIKES[random.bounded(int(std::size(LOOKALIKES)))];
+      else if (pick == 1)
+        text += alphabet[random.bounded(int(std::size(alphabet)))];
+      else
+        text += char16_t(u'a' + random.bounded(26));
+    }
+    result.push_back(text);
+  }
+  std::u16string large;
+  for (auto i = 0; i < 64 * 1024; ++i)
+    large += (i % 97 == 0 ? u'<' : i % 89 == 0 ? u'\n' : u'x');
+  result.push_back(large);
+  return result;
+}
+
+std::vector<uint32_t>
+TestXmlScanner::reference(const std::u16string& text, const char* chars)
+{
+  std::vector<uint32_t> offsets;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != 0 && text[i] < 0x80 && std::strchr(chars, char(text[i])))
+      offsets.push_back(uint32_t(i));
+  }
+  return offsets;
+}
+
+void
+TestXmlScanner::scalarMatchesReference()
+{
+  XmlScanner::setIsa(XmlScanner::Scalar);
+  QCOMPARE(XmlScanner::isa(), XmlScanner::Scalar);
+  for (auto chars : SETS) {
+    XmlScanner scanner(chars);
+    for (const auto& text : texts()) {
+      std::vector<uint32_t> offsets;
+      scanner.scan(text.data(), text.size(), offsets);
+      QVERIFY(offsets == reference(text, chars));
+    }
+  }
+}
+
+void
+TestXmlScanner::vectorMatchesScalar_data()
+{
+  QTest::addColumn<int>("isa");
+  for (auto isa : { XmlScanner::Sse2, XmlScanner::Avx2, XmlScanner::Neon })
+    QTest::newRow(XmlScanner::isaName(isa)) << int(isa);
+}
+
+void
+TestXmlScanner::vectorMatchesScalar()
+{
+  QFETCH(int, isa);
+  XmlScanner::setIsa(XmlScanner::Isa(isa));
+  if (XmlScanner::isa() != XmlScanner::Isa(isa))
+    QSKIP("The processor does not have this instruction set.");
+
+  for (auto chars : SETS) {
+    XmlScanner scanner(chars);
+    for (const auto& text : texts()) {
+      // UTF-16, and UTF-8 from each alignment of the buffer.
+      auto utf8 = QString::fromStdU16String(text).toStdString();
+      std::vector<uint32_t> expected16;
+      std::vector<uint32_t> expected8;
+      XmlScanner::setIsa(XmlScanner::Scalar);
+      scanner.scan(text.data(), text.size(), expected16, 7);
+      scanner.scan(utf8.data(), utf8.size(), expected8);
+      auto from = std::min<size_t>(3, text.size());
+      auto expectedFind = scanner.find(text.data(), text.size(), from);
+
+      XmlScanner::setIsa(XmlScanner::Isa(isa));
+      std::vector<uint32_t> offsets16;
+      scanner.scan(text.data(), text.size(), offsets16, 7);
+      QVERIFY(offsets16 == expected16);
+      QCOMPARE(quint64(scanner.find(text.data(), text.size(), from)),
+               quint64(expectedFind));
+      for (size_t skip = 0; skip < 4 && skip <= utf8.size(); ++skip) {
+        std::vector<uint32_t> offsets8;
+        scanner.scan(
+          utf8.data() + skip, utf8.size() - skip, offsets8, uint32_t(skip));
+        std::vector<uint32_t> tail;
+        for (auto offset : expected8) {
+          if (offset >= skip)
+            tail.push_back(offset);
+        }
+        QVERIFY(offsets8 == tail);
+      }
+    }
+  }
+}
+
+QTEST_GUILESS_MAIN(TestXmlScanner)
+#include "tst_xmlscanner.moc"
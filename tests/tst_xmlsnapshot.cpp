@@ -0,0 +1,189 @@
+#include "qxml/xmldocument.h"
+#include "qxml/xmleventparser.h"
+#include "qxml/xmlsnapshot.h"
+
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QtTest>
+
+/*
+ * XmlSnapshot versions share the subtrees an edit did not touch, whether
+ * the snapshot is built directly or published by XmlDocument.
+ */
+class TestXmlSnapshot : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void unchangedTextSharesTree();
+  void editSharesSiblings();
+  void documentEditSharesSiblings();
+  void newTextSharesMatchingSubtrees();
+  void largeTableSharesChildren();
+
+private:
+  static const XmlSnapshotNode& element(const XmlSnapshot& snapshot);
+  static void setText(XmlDocument& document, const QString& text);
+  static void insert(XmlDocument& document, int position, const QString& text);
+};
+
+const XmlSnapshotNode&
+TestXmlSnapshot::element(const XmlSnapshot& snapshot)
+{
+  // the texts here start with the root element.
+  return *snapshot.root().children[0].node;
+}
+
+void
+TestXmlSnapshot::setText(XmlDocument& document, const QString& text)
+{
+  document.beginText();
+  document.textDocument()->setPlainText(text);
+  document.endText(text);
+}
+
+void
+TestXmlSnapshot::insert(XmlDocument& document,
+                        int position,
+                        const QString& text)
+{
+  QTextCursor cursor(document.textDocument());
+  cursor.setPosition(position);
+  cursor.insertText(text);
+  document.reparse();
+}
+
+void
+TestXmlSnapshot::unchangedTextSharesTree()
+{
+  QString text = "<r><a>1</a><b>2</b></r>";
+  XmlEventParser parser(nullptr);
+  QVERIFY(parser.parseString(text));
+  auto first = XmlSnapshot::build(parser, int(text.length()), 0);
+  QVERIFY(parser.parseString(text));
+  auto second =
+    XmlSnapshot::build(parser, int(text.length()), 1, first, {});
+  QVERIFY(second->version() > first->version());
+  QCOMPARE(&element(*second), &element(*first));
+}
+
+void
+TestXmlSnapshot::editSharesSiblings()
+{
+  QString before = "<r><a>1</a><b>2</b><c>3</c></r>";
+  QString after = "<r><a>1</a><b>2x</b><c>3</c></r>";
+  XmlEventParser parser(nullptr);
+  QVERIFY(parser.parseString(before));
+  auto first = XmlSnapshot::build(parser, int(before.length()), 0);
+  QVERIFY(parser.parseString(after));
+  XmlEventParser::TextRange changed;
+  changed.from = int(after.indexOf("2x"));
+  changed.to = changed.from + 2;
+  auto second =
+    XmlSnapshot::build(parser, int(after.length()), 1, first, changed);
+
+  const auto& r1 = element(*first);
+  const auto& r2 = element(*second);
+  QVERIFY(&r1 != &r2);
+  QCOMPARE(int(r2.children.size()), 3);
+  QCOMPARE(r2.children[0].node.get(), r1.children[0].node.get());
+  QVERIFY(r2.children[1].node.get() != r1.children[1].node.get());
+  QCOMPARE(r2.children[2].node.get(), r1.children[2].node.get());
+  // the offsets are kept by the parent, the shared node has none.
+  QCOMPARE(r2.children[2].offset, r1.children[2].offset + 1);
+  QCOMPARE(r2.children[1].node->children[0].node->content,
+           QStringLiteral("2x"));
+}
+
+void
+TestXmlSnapshot::documentEditSharesSiblings()
+{
+  XmlDocument document;
+  QString text = "<r>\n<a>1</a>\n<b>2</b>\n<c>3</c>\n</r>";
+  setText(document, text);
+  if (!document.snapshot())
+    document.reparse();
+  auto first = document.snapshot();
+  QVERIFY(first);
+
+  insert(document, int(text.indexOf("2")) + 1, "x");
+  auto second = document.snapshot();
+  QVERIFY(second);
+  QVERIFY(second != first);
+  QCOMPARE(second->length(), first->length() + 1);
+
+  // the children are a, b and c with the line ends between them.
+  const auto& r1 = element(*first);
+  const auto& r2 = element(*second);
+  QCOMPARE(int(r2.children.size()), int(r1.children.size()));
+  for (size_t i = 0; i < r1.children.size(); ++i) {
+    const auto& node = *r1.children[i].node;
+    if (node.kind == XmlSnapshotNode::Element && node.name == "b")
+      QVERIFY(r2.children[i].node != r1.children[i].node);
+    else
+      QCOMPARE(r2.children[i].node.get(), r1.children[i].node.get());
+  }
+}
+
+void
+TestXmlSnapshot::newTextSharesMatchingSubtrees()
+{
+  // a text set anew is changed throughout, the subtrees that match are
+  // still taken over.
+  XmlDocument document;
+  setText(document, "<r><a>1</a><b>2</b><c>3</c></r>");
+  if (!document.snapshot())
+    document.reparse();
+  auto first = document.snapshot();
+  QVERIFY(first);
+
+  setText(document, "<r><a>1</a><b>22</b><c>3</c></r>");
+  if (!document.snapshot() || document.snapshot() == first)
+    document.reparse();
+  auto second = document.snapshot();
+  QVERIFY(second && second != first);
+  const auto& r1 = element(*first);
+  const auto& r2 = element(*second);
+  QCOMPARE(r2.children[0].node.get(), r1.children[0].node.get());
+  QVERIFY(r2.children[1].node != r1.children[1].node);
+  QCOMPARE(r2.children[2].node.get(), r1.children[2].node.get());
+}
+
+void
+TestXmlSnapshot::largeTableSharesChildren()
+{
+  // enough children for the table of the root element to be chunked.
+  const int COUNT = 50 * XmlSnapshotChildren::CHUNK;
+  QString text = "<r>";
+  for (auto i = 0; i < COUNT; ++i)
+    text += QStringLiteral("<e i=\"%1\"/>").arg(i, 5, 10, QChar('0'));
+  text += "</r>";
+
+  XmlDocument document;
+  setText(document, text);
+  if (!document.snapshot())
+    document.reparse();
+  auto first = document.snapshot();
+  QVERIFY(first);
+  QVERIFY(element(*first).children.chunkCount() > 1);
+
+  auto edited = COUNT / 2;
+  auto value = QStringLiteral("%1").arg(edited, 5, 10, QChar('0'));
+  insert(document, int(text.indexOf(value)), "x");
+  auto second = document.snapshot();
+  QVERIFY(second && second != first);
+
+  const auto& r1 = element(*first);
+  const auto& r2 = element(*second);
+  QCOMPARE(int(r2.children.size()), int(r1.children.size()));
+  QVERIFY(r2.children.chunkCount() > 1);
+  for (size_t i = 0; i < r1.children.size(); ++i) {
+    if (int(i) == edited)
+      QVERIFY(r2.children[i].node != r1.children[i].node);
+    else if (r2.children[i].node != r1.children[i].node)
+      QFAIL(qPrintable(QStringLiteral("child %1 was rebuilt").arg(i)));
+  }
+}
+
+QTEST_MAIN(TestXmlSnapshot)
+#include "tst_xmlsnapshot.moc"
@@ -0,0 +1,120 @@
+#include "xmlcorpusgenerator.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QTextStream>
+
+int
+main(int argc, char* argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("qxml_corpus");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+    "Writes a reproducible synthetic XML document. The same options and seed "
+    "always produce the same output.");
+  parser.addHelpOption();
+
+  QCommandLineOption presetOption(
+    "preset", "Workload shape: default, svg, records or soap.", "name", "default");
+  QCommandLineOption outputOption(
+    { "o", "output" }, "Output file, standard output if omitted.", "file");
+  QCommandLineOption seedOption("seed", "Random seed.", "n");
+  QCommandLineOption sizeOption("size", "Approximate size in KB.", "kb");
+  QCommandLineOption depthOption("depth", "Maximum nesting depth.", "n");
+  QCommandLineOption fanOutOption("fan-out", "Children per element.", "n");
+  QCommandLineOption attributesOption(
+    "attributes", "Attributes per element.", "n");
+  QCommandLineOption valueLengthOption(
+    "value-length", "Attribute value length.", "n");
+  QCommandLineOption identicalOption("identical-values",
+                                     "Give every attribute the same value.");
+  QCommandLineOption textOption("text", "Relative weight of text nodes.", "n");
+  QCommandLineOption commentOption(
+    "comment", "Relative weight of comments.", "n");
+  QCommandLineOption cdataOption(
+    "cdata", "Relative weight of CDATA sections.", "n");
+  QCommandLineOption piOption(
+    "pi", "Relative weight of processing instructions.", "n");
+  QCommandLineOption leafLengthOption(
+    "leaf-length", "Length of text, comment, CDATA and PI bodies.", "n");
+  QCommandLineOption whitespaceOption(
+    "whitespace", "Probability (0-1) of a newline before a node.", "ratio");
+  QCommandLineOption nonAsciiOption(
+    "non-ascii", "Probability (0-1) of a non ASCII character.", "ratio");
+  QCommandLineOption singleLineOption("single-line",
+                                      "Write the document as a single line.");
+  parser.addOptions({ presetOption,
+                      outputOption,
+                      seedOption,
+                      sizeOption,
+                      depthOption,
+                      fanOutOption,
+                      attributesOption,
+                      valueLengthOption,
+                      identicalOption,
+                      textOption,
+                      commentOption,
+                      cdataOption,
+                      piOption,
+                      leafLengthOption,
+                      whitespaceOption,
+                      nonAsciiOption,
+                      singleLineOption });
+  parser.process(app);
+
+  auto options = XmlCorpusGenerator::preset(
+    XmlCorpusGenerator::presetFromName(parser.value(presetOption)));
+  if (parser.isSet(seedOption))
+    options.seed = parser.value(seedOption).toULongLong();
+  if (parser.isSet(sizeOption))
+    options.size = parser.value(sizeOption).toLongLong() * 1024;
+  if (parser.isSet(depthOption))
+    options.depth = parser.value(depthOption).toInt();
+  if (parser.isSet(fanOutOption))
+    options.fanOut = parser.value(fanOutOption).toInt();
+  if (parser.isSet(attributesOption))
+    options.attributeCount = parser.value(attributesOption).toInt();
+  if (parser.isSet(valueLengthOption))
+    options.valueLength = parser.value(valueLengthOption).toInt();
+  if (parser.isSet(identicalOption))
+    options.identicalValues = true;
+  if (parser.isSet(textOption))
+    options.textWeight = parser.value(textOption).toInt();
+  if (parser.isSet(commentOption))
+    options.commentWeight = parser.value(commentOption).toInt();
+  if (parser.isSet(cdataOption))
+    options.cdataWeight = parser.value(cdataOption).toInt();
+  if (parser.isSet(piOption))
+    options.piWeight = parser.value(piOption).toInt();
+  if (parser.isSet(leafLengthOption))
+    options.leafLength = parser.value(leafLengthOption).toInt();
+  if (parser.isSet(whitespaceOption))
+    options.whitespaceRatio = parser.value(whitespaceOption).toDouble();
+  if (parser.isSet(nonAsciiOption))
+    options.nonAsciiDensity = parser.value(nonAsciiOption).toDouble();
+  if (parser.isSet(singleLineOption))
+    options.singleLine = true;
+
+  QFile file;
+  auto opened = false;
+  if (parser.isSet(outputOption)) {
+    file.setFileName(parser.value(outputOption));
+    opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+  } else {
+    opened = file.open(stdout, QIODevice::WriteOnly);
+  }
+  if (!opened) {
+    QTextStream(stderr) << "Unable to open output: " << file.errorString()
+                        << Qt::endl;
+    return 1;
+  }
+
+  if (!XmlCorpusGenerator(options).write(&file)) {
+    QTextStream(stderr) << "Write failed: " << file.errorString() << Qt::endl;
+    return 1;
+  }
+  return 0;
+}
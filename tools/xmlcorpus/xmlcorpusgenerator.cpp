@@ -0,0 +1,323 @@
+#include "xmlcorpusgenerator.h"
+
+#include <QVector>
+
+//====================================================================
+//=== XmlCorpusGenerator
+//====================================================================
+XmlCorpusGenerator::XmlCorpusGenerator(const Options& options)
+  : m_options(options)
+  , m_state(options.seed)
+{
+  if (m_options.names.isEmpty())
+    m_options.names.append("root");
+  // with no leaf types the root element needs child elements to grow.
+  auto leafWeights = m_options.textWeight + m_options.commentWeight +
+                     m_options.cdataWeight + m_options.piWeight;
+  if (leafWeights <= 0 && m_options.depth < 1)
+    m_options.depth = 1;
+}
+
+XmlCorpusGenerator::Options
+XmlCorpusGenerator::preset(Preset preset)
+{
+  Options options;
+  switch (preset) {
+    case DeepSvg:
+      options.depth = 64;
+      options.fanOut = 3;
+      options.attributeCount = 6;
+      options.valueLength = 16;
+      options.textWeight = 0;
+      options.commentWeight = 1;
+      options.cdataWeight = 0;
+      options.piWeight = 0;
+      options.names = QStringList{ "svg", "g", "g", "g", "path" };
+      break;
+    case FlatRecords:
+      options.depth = 2;
+      options.fanOut = 5;
+      options.attributeCount = 3;
+      options.valueLength = 6;
+      options.textWeight = 1;
+      options.commentWeight = 0;
+      options.cdataWeight = 0;
+      options.piWeight = 0;
+      options.leafLength = 12;
+      options.names = QStringList{ "records", "record", "field" };
+      break;
+    case MinifiedSoap:
+      options.depth = 6;
+      options.fanOut = 4;
+      options.attributeCount = 1;
+      options.valueLength = 10;
+      options.textWeight = 1;
+      options.commentWeight = 0;
+      options.cdataWeight = 0;
+      options.piWeight = 0;
+      options.whitespaceRatio = 0.0;
+      options.singleLine = true;
+      options.names = QStringList{ "soap:Envelope", "soap:Body",
+                                   "m:Response",    "m:Result",
+                                   "m:Item",        "m:Value" };
+      break;
+    case Default:
+    default:
+      break;
+  }
+  return options;
+}
+
+XmlCorpusGenerator::Preset
+XmlCorpusGenerator::presetFromName(const QString& name)
+{
+  auto lower = name.toLower();
+  if (lower == "svg")
+    return DeepSvg;
+  if (lower == "records")
+    return FlatRecords;
+  if (lower == "soap")
+    return MinifiedSoap;
+  return Default;
+}
+
+quint64
+XmlCorpusGenerator::next()
+{
+  // splitmix64, chosen over QRandomGenerator so that the output does not
+  // depend on the Qt or standard library version.
+  auto z = (m_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+int
+XmlCorpusGenerator::bounded(int limit)
+{
+  if (limit <= 0)
+    return 0;
+  return int(next() % quint64(limit));
+}
+
+bool
+XmlCorpusGenerator::chance(double probability)
+{
+  if (probability <= 0.0)
+    return false;
+  if (probability >= 1.0)
+    return true;
+  return double(next() >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+void
+XmlCorpusGenerator::appendChars(QString& s, int length)
+{
+  static const char ascii[] = "abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+  static const char16_t nonAscii[] = { u'é', u'ß', u'λ', u'Ж',
+                                       u'ñ', u'Ω', u'中', u'日' };
+  const int asciiCount = int(sizeof(ascii)) - 1;
+  const int nonAsciiCount = int(sizeof(nonAscii) / sizeof(nonAscii[0]));
+
+  for (auto i = 0; i < length; ++i) {
+    if (chance(m_options.nonAsciiDensity)) {
+      auto index = bounded(nonAsciiCount + 1);
+      if (index == nonAsciiCount) {
+        // a character outside the BMP, a surrogate pair in UTF-16.
+        s += QChar(0xD83D);
+        s += QChar(0xDE00);
+      } else {
+        s += QChar(nonAscii[index]);
+      }
+    } else {
+      s += QLatin1Char(ascii[bounded(asciiCount)]);
+    }
+  }
+}
+
+void
+XmlCorpusGenerator::appendNewLine(QString& s, int depth)
+{
+  if (m_options.singleLine || !chance(m_options.whitespaceRatio))
+    return;
+  s += QLatin1Char('\n');
+  for (auto i = 0; i < depth; ++i)
+    s += QLatin1String("  ");
+}
+
+void
+XmlCorpusGenerator::appendStartTag(QString& s,
+                                   const QString& name,
+                                   int depth,
+                                   bool empty)
+{
+  s += QLatin1Char('<');
+  s += name;
+
+  if (depth == 0) {
+    // declare every namespace prefix used by the element names.
+    QStringList prefixes;
+    for (const auto& n : m_options.names) {
+      auto colon = n.indexOf(QLatin1Char(':'));
+      if (colon > 0 && !prefixes.contains(n.left(colon)))
+        prefixes.append(n.left(colon));
+    }
+    for (const auto& prefix : prefixes) {
+      s += QStringLiteral(" xmlns:%1=\"urn:qxml:%1\"").arg(prefix);
+    }
+  }
+
+  for (auto i = 0; i < m_options.attributeCount; ++i) {
+    s += QLatin1String(" a");
+    s += QString::number(i);
+    s += QLatin1String("=\"");
+    if (m_options.identicalValues)
+      s += m_identicalValue;
+    else
+      appendChars(s, m_options.valueLength);
+    s += QLatin1Char('"');
+  }
+  s += empty ? QLatin1String("/>") : QLatin1String(">");
+}
+
+void
+XmlCorpusGenerator::appendLeaf(QString& s, int depth)
+{
+  auto total = m_options.textWeight + m_options.commentWeight +
+               m_options.cdataWeight + m_options.piWeight;
+  auto pick = bounded(total);
+  auto length = m_options.leafLength / 2 + bounded(m_options.leafLength + 1);
+
+  appendNewLine(s, depth);
+  if (pick < m_options.textWeight) {
+    appendChars(s, length);
+    return;
+  }
+  pick -= m_options.textWeight;
+  if (pick < m_options.commentWeight) {
+    s += QLatin1String("<!-- ");
+    appendChars(s, length);
+    s += QLatin1String(" -->");
+    return;
+  }
+  pick -= m_options.commentWeight;
+  if (pick < m_options.cdataWeight) {
+    s += QLatin1String("<![CDATA[<raw & ");
+    appendChars(s, length);
+    s += QLatin1String(">]]>");
+    return;
+  }
+  s += QLatin1String("<?process ");
+  appendChars(s, length);
+  s += QLatin1String("?>");
+}
+
+void
+XmlCorpusGenerator::generate(const std::function<void(const QString&)>& sink,
+                             int chunkSize)
+{
+  struct Open
+  {
+    QString name;
+    //! Child nodes still to be written, -1 for unlimited.
+    int remaining;
+  };
+
+  m_state = m_options.seed;
+  m_identicalValue.clear();
+  appendChars(m_identicalValue, m_options.valueLength);
+
+  auto leafWeights = m_options.textWeight + m_options.commentWeight +
+                     m_options.cdataWeight + m_options.piWeight;
+  auto names = m_options.names;
+  auto nameForDepth = [&names](int depth) {
+    return names.at(depth < names.size() ? depth : names.size() - 1);
+  };
+
+  qint64 written = 0;
+  QString s;
+  s.reserve(chunkSize + 4096);
+  auto flush = [&](bool force) {
+    if (force || s.length() >= chunkSize) {
+      written += s.length();
+      sink(s);
+      s.resize(0);
+    }
+  };
+
+  s += QLatin1String("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+  if (!m_options.singleLine)
+    s += QLatin1Char('\n');
+
+  // The root element takes children until the size is reached, the stack
+  // keeps very deep documents off the call stack.
+  QVector<Open> stack;
+  appendStartTag(s, nameForDepth(0), 0, false);
+  stack.append({ nameForDepth(0), -1 });
+
+  while (!stack.isEmpty()) {
+    auto& top = stack.last();
+    auto full = written + s.length() >= m_options.size;
+
+    if (full || top.remaining == 0) {
+      appendNewLine(s, stack.size() - 1);
+      s += QLatin1String("</");
+      s += top.name;
+      s += QLatin1Char('>');
+      stack.removeLast();
+      flush(false);
+      continue;
+    }
+
+    if (top.remaining > 0)
+      --top.remaining;
+
+    auto depth = stack.size();
+    // mixed content below the first level, except in single child chains
+    // where a leaf would cut the nesting short.
+    auto element = depth <= m_options.depth &&
+                   (leafWeights == 0 || depth == 1 || m_options.fanOut <= 1 ||
+                    !chance(0.1));
+    if (element) {
+      auto name = nameForDepth(depth);
+      appendNewLine(s, depth);
+      if (m_options.fanOut <= 0 ||
+          (leafWeights == 0 && depth == m_options.depth)) {
+        appendStartTag(s, name, depth, true);
+      } else {
+        appendStartTag(s, name, depth, false);
+        stack.append({ name, m_options.fanOut });
+      }
+    } else if (leafWeights > 0) {
+      appendLeaf(s, depth);
+    }
+    flush(false);
+  }
+
+  if (!m_options.singleLine)
+    s += QLatin1Char('\n');
+  flush(true);
+}
+
+QString
+XmlCorpusGenerator::generate()
+{
+  QString text;
+  text.reserve(m_options.size + 4096);
+  generate([&text](const QString& chunk) { text += chunk; });
+  return text;
+}
+
+bool
+XmlCorpusGenerator::write(QIODevice* device)
+{
+  auto ok = true;
+  generate([device, &ok](const QString& chunk) {
+    if (ok) {
+      auto bytes = chunk.toUtf8();
+      ok = device->write(bytes) == bytes.size();
+    }
+  });
+  return ok;
+}
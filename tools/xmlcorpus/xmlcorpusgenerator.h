@@ -0,0 +1,106 @@
+#pragma once
+
+#include <QIODevice>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+/*!
+ * \class XmlCorpusGenerator xmlcorpusgenerator.h
+ * "tools/xmlcorpus/xmlcorpusgenerator.h" \brief Generates reproducible
+ * synthetic XML documents.
+ *
+ * The same Options and seed always produce the same document, on any machine
+ * and with any Qt version, so benchmark and performance test inputs never have
+ * to be shipped as fixture files.
+ *
+ * \code
+ *  XmlCorpusGenerator::Options options =
+ *    XmlCorpusGenerator::preset(XmlCorpusGenerator::FlatRecords);
+ *  options.size = 16 * 1024 * 1024;
+ *  auto text = XmlCorpusGenerator(options).generate();
+ * \endcode
+ */
+class XmlCorpusGenerator
+{
+public:
+  /*!
+   * \enum XmlCorpusGenerator::Preset
+   *
+   * Customer shaped workloads.
+   */
+  enum Preset
+  {
+    Default,     //!< Moderately nested, indented, mixed content.
+    DeepSvg,     //!< Deeply nested graphics with many attributes.
+    FlatRecords, //!< Flat record dump, millions of small siblings.
+    MinifiedSoap, //!< SOAP envelope on a single line with no whitespace.
+  };
+
+  struct Options
+  {
+    //! The seed for the pseudo random sequence.
+    quint64 seed = 1;
+    //! The approximate size of the document in characters.
+    qint64 size = 1024 * 1024;
+    //! The maximum element nesting depth below the root element.
+    int depth = 4;
+    //! The number of child nodes of each non root element.
+    int fanOut = 6;
+    //! The number of attributes on each element.
+    int attributeCount = 2;
+    //! The length of each attribute value.
+    int valueLength = 8;
+    //! If true every attribute value is identical.
+    bool identicalValues = false;
+    //! Relative weights of the leaf node types.
+    int textWeight = 8;
+    int commentWeight = 1;
+    int cdataWeight = 1;
+    int piWeight = 1;
+    //! The length of text, comment, CDATA and processing instruction bodies.
+    int leafLength = 24;
+    //! Probability (0..1) that a node starts on a new, indented line.
+    double whitespaceRatio = 1.0;
+    //! Probability (0..1) that a generated character is not ASCII.
+    double nonAsciiDensity = 0.0;
+    //! If true the whole document is written as one line.
+    bool singleLine = false;
+    //! The element names that are cycled through by depth.
+    QStringList names = { "root", "group", "item", "field", "value" };
+  };
+
+  explicit XmlCorpusGenerator(const Options& options);
+
+  //! Returns the options for one of the preset workloads.
+  static Options preset(Preset preset);
+  //! Returns the preset matching name ("default", "svg", "records", "soap")
+  //! or Default if the name is unknown.
+  static Preset presetFromName(const QString& name);
+
+  //! Generates the whole document as a string.
+  QString generate();
+
+  //! Writes the document to device as UTF-8. Returns false on a write error.
+  bool write(QIODevice* device);
+
+  //! Generates the document in pieces of about chunkSize characters which are
+  //! passed to sink.
+  void generate(const std::function<void(const QString&)>& sink,
+                int chunkSize = 64 * 1024);
+
+private:
+  Options m_options;
+  quint64 m_state;
+  QString m_identicalValue;
+
+  quint64 next();
+  int bounded(int limit);
+  bool chance(double probability);
+
+  void appendChars(QString& s, int length);
+  void appendNewLine(QString& s, int depth);
+  void appendStartTag(QString& s, const QString& name, int depth, bool empty);
+  void appendLeaf(QString& s, int depth);
+};